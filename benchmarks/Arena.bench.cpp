@@ -0,0 +1,93 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+
+// Every heap allocation in the process goes through here so we can count them
+static size_t allocations = 0;
+
+void *operator new(size_t n)
+{
+    allocations++;
+    if (void *p = malloc(n))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Same data and training loop as examples/example1.cpp
+vector<pair<vector<shared_ptr<Value>>, vector<shared_ptr<Value>>>> generate_training_data(int num_samples)
+{
+    vector<pair<vector<shared_ptr<Value>>, vector<shared_ptr<Value>>>> data;
+    mt19937 rng(42);
+    uniform_real_distribution<> dist(-1.0, 1.0);
+
+    for (int i = 0; i < num_samples; ++i)
+    {
+        double x1 = dist(rng);
+        double x2 = dist(rng);
+        data.push_back({{make_shared<Value>(x1), make_shared<Value>(x2)}, {make_shared<Value>(3.0 * x1 + 2.0 * x2)}});
+    }
+    return data;
+}
+
+void step(MLP &model, const vector<shared_ptr<Value>> &inputs, const vector<shared_ptr<Value>> &targets)
+{
+    auto loss = simpleLoss(model(inputs), targets);
+    model.zero_grad();
+    loss->backward();
+    for (auto &p : model.parameters())
+    {
+        p->setData(p->getData() - 0.001f * p->getGrad());
+    }
+}
+
+void run(bool useArena, int epochs)
+{
+    MLP model(2, {5, 1});
+    auto data = generate_training_data(100);
+    GraphArena arena;
+
+    auto start = chrono::steady_clock::now();
+    size_t before = allocations;
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+        for (auto &sample : data)
+        {
+            if (useArena)
+            {
+                {
+                    ArenaScope scope(arena);
+                    step(model, sample.first, sample.second);
+                }
+                arena.reset();
+            }
+            else
+            {
+                step(model, sample.first, sample.second);
+            }
+        }
+    }
+    size_t steps = size_t(epochs) * data.size();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << (useArena ? "arena" : "heap ") << "\t| allocations/step = " << double(allocations - before) / steps
+         << "\t| steps/sec = " << steps / seconds << endl;
+}
+
+int main()
+{
+    int epochs = 200;
+    run(false, epochs);
+    run(true, epochs);
+    return 0;
+}
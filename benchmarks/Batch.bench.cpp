@@ -0,0 +1,50 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Training throughput of the tensor engine for growing batch sizes
+void run(int batch, int samples)
+{
+    const int nin = 64, nout = 10;
+    MLP model(nin, {128, 128, nout}, engine::tensor);
+    mt19937 rng(42);
+    uniform_real_distribution<float> dist(-1.0, 1.0);
+
+    vector<vector<shared_ptr<Value>>> x(batch), y(batch);
+    for (int s = 0; s < batch; s++)
+    {
+        for (int i = 0; i < nin; i++)
+            x[s].push_back(make_shared<Value>(dist(rng)));
+        for (int i = 0; i < nout; i++)
+            y[s].push_back(make_shared<Value>(dist(rng)));
+    }
+
+    GraphArena arena;
+    auto start = chrono::steady_clock::now();
+    for (int done = 0; done < samples; done += batch)
+    {
+        {
+            ArenaScope scope(arena);
+            auto loss = simpleLoss(model(x), y);
+            model.zero_grad();
+            loss->backward();
+            for (auto &p : model.parameters())
+            {
+                p->setData(p->getData() - 0.01f * p->getGrad());
+            }
+        }
+        arena.reset();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "batch = " << batch << "\t| samples/sec = " << samples / seconds << endl;
+}
+
+int main()
+{
+    for (int batch : {1, 8, 32, 128})
+    {
+        run(batch, 4096);
+    }
+    return 0;
+}
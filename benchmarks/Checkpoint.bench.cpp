@@ -0,0 +1,56 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+// Time to save and load a model with about 1.9M parameters in the text and
+// binary formats. The binary file was just written, so it is in the page
+// cache, like on a server restarted with the same model.
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    const string text = "build/bench-model.txt";
+    const string binary = "build/bench-model.ckpt";
+    MLP model(784, {1024, 1024, 10}, engine::tensor);
+    vector<float> x(784, 0.5f);
+    float expected = model.predict(x)[0];
+
+    auto start = chrono::steady_clock::now();
+    model.saveTo(text);
+    cout << "text save\t\t| " << seconds_since(start) * 1000 << " ms" << endl;
+    start = chrono::steady_clock::now();
+    model.saveCheckpoint(binary);
+    cout << "binary save\t\t| " << seconds_since(start) * 1000 << " ms" << endl;
+
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        const char *name = mode == engine::tensor ? "tensor" : "scalar";
+        start = chrono::steady_clock::now();
+        {
+            MLP loaded(text, mode);
+            double t = seconds_since(start);
+            cout << "text load, " << name << "\t| " << t * 1000 << " ms\t| output matches = " << (loaded.predict(x)[0] == expected) << endl;
+        }
+        start = chrono::steady_clock::now();
+        {
+            MLP loaded(binary, mode);
+            double t = seconds_since(start);
+            cout << "binary load, " << name << "\t| " << t * 1000 << " ms\t| output matches = " << (loaded.predict(x)[0] == expected) << endl;
+        }
+    }
+    start = chrono::steady_clock::now();
+    {
+        MLP loaded(Checkpoint(binary, false), engine::tensor);
+        double t = seconds_since(start);
+        cout << "binary load, no checksum\t| " << t * 1000 << " ms\t| output matches = " << (loaded.predict(x)[0] == expected) << endl;
+    }
+
+    remove(text.c_str());
+    remove(binary.c_str());
+    return 0;
+}
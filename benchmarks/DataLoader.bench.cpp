@@ -0,0 +1,106 @@
+#include "../include/DataLoader.hpp"
+#include "../include/NN.hpp"
+#include "../include/Optimizer.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+// Streaming samples from disk: raw throughput of each source, and a
+// training epoch with and without prefetching the next batch
+
+const string binPath = "build/dataloader-bench.bin";
+const string csvPath = "build/dataloader-bench.csv";
+const int nin = 32;
+const int nout = 1;
+const int samples = 100000;
+
+void writeFiles()
+{
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x((long)samples * nin), y((long)samples * nout);
+    for (auto &v : x)
+        v = dist(rng);
+    for (auto &v : y)
+        v = dist(rng);
+    BinaryDataset::write(binPath, x.data(), y.data(), samples, nin, nout);
+    ofstream csv(csvPath);
+    for (long i = 0; i < samples; i++)
+    {
+        for (int k = 0; k < nin; k++)
+            csv << x[i * nin + k] << ',';
+        csv << y[i] << '\n';
+    }
+}
+
+double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void throughput(const string &name, Dataset &data, int prefetch)
+{
+    DataLoader loader(data, 256, true, 1, prefetch);
+    Batch b;
+    double checksum = 0;
+    auto start = chrono::steady_clock::now();
+    while (loader.next(b))
+    {
+        checksum += b.x[0];
+    }
+    double s = seconds(start);
+    cout << name << "\t| prefetch " << prefetch << "\t| samples/sec = " << data.size() / s << "\t| MB/sec = "
+         << data.size() * (nin + nout) * sizeof(float) / s / 1e6 << "\t(checksum " << checksum << ")" << endl;
+}
+
+void train(const string &name, Dataset &data, int prefetch)
+{
+    MLP model(nin, {64, nout}, engine::tensor);
+    SGD sgd(model, 1e-3f);
+    GraphArena arena;
+    DataLoader loader(data, 64, true, 1, prefetch);
+    Batch b;
+    double total = 0;
+    auto start = chrono::steady_clock::now();
+    while (loader.next(b))
+    {
+        {
+            ArenaScope scope(arena);
+            vector<vector<shared_ptr<Value>>> xs(b.n), ys(b.n);
+            for (int s = 0; s < b.n; s++)
+            {
+                for (int k = 0; k < nin; k++)
+                    xs[s].push_back(Value::create(b.x[s * nin + k]));
+                ys[s].push_back(Value::create(b.y[s]));
+            }
+            auto loss = simpleLoss(model(xs), ys);
+            loss->backward();
+            total += loss->getData();
+            sgd.step();
+        }
+        arena.reset();
+    }
+    cout << name << "\t| prefetch " << prefetch << "\t| training epoch = " << seconds(start) * 1e3 << " ms" << endl;
+}
+
+int main()
+{
+    writeFiles();
+    BinaryDataset binary(binPath, nin, nout);
+    CsvDataset csv(csvPath, nin, nout);
+    // What holding the same samples as one shared_ptr<Value> per feature costs
+    double asValues = (double)samples * (nin + nout) * (sizeof(Value) + 16 + sizeof(shared_ptr<Value>));
+    cout << samples << " samples\t| as float32 = " << samples * (nin + nout) * sizeof(float) / 1e6
+         << " MB\t| as Values ~ " << asValues / 1e6 << " MB" << endl;
+
+    throughput("binary", binary, 0);
+    throughput("binary", binary, 2);
+    throughput("csv   ", csv, 0);
+    throughput("csv   ", csv, 2);
+    train("binary", binary, 0);
+    train("binary", binary, 2);
+    train("csv   ", csv, 0);
+    train("csv   ", csv, 2);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "../include/ValueStruct.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Sensitivity analysis: the full Jacobian of a scalar graph with 64 inputs
+// and 64 outputs. The baseline rebuilds the graph and backpropagates once
+// per output, since repeated backwards would accumulate into the shared
+// intermediates; Derivatives sorts the graph once, then runs one VJP per
+// output, batched VJPs, or batched JVPs.
+
+template <typename F>
+double seconds(F f, int reps)
+{
+    f();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        f();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / reps;
+}
+
+const int width = 64, depth = 8, fan = 8;
+
+// Layers of tanh(sum of fan products) over the previous layer
+vector<shared_ptr<Value>> graph(const vector<shared_ptr<Value>> &x)
+{
+    auto layer = x;
+    for (int d = 0; d < depth; d++)
+    {
+        vector<shared_ptr<Value>> next;
+        for (int i = 0; i < width; i++)
+        {
+            vector<shared_ptr<Value>> terms;
+            for (int j = 0; j < fan; j++)
+            {
+                terms.push_back(layer[(i + j * 7 + d) % width] * make_shared<Value>(0.3f - 0.05f * j));
+            }
+            next.push_back(tanh(sum(terms)));
+        }
+        layer = next;
+    }
+    return layer;
+}
+
+int main()
+{
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<shared_ptr<Value>> x;
+    for (int i = 0; i < width; i++)
+    {
+        x.push_back(make_shared<Value>(dist(rng)));
+    }
+    auto y = graph(x);
+    vector<float> J((long)width * width);
+
+    double rebuild = seconds([&]()
+                             {
+        for (int o = 0; o < width; o++)
+        {
+            for (auto &v : x)
+                v->setGrad(0);
+            graph(x)[o]->backward();
+            for (int i = 0; i < width; i++)
+                J[(long)o * width + i] = x[i]->getGrad();
+        } }, 5);
+    Derivatives d(x, y);
+    vector<float> eye((long)width * width, 0);
+    for (int i = 0; i < width; i++)
+    {
+        eye[(long)i * width + i] = 1;
+    }
+    double single = seconds([&]()
+                            {
+        for (int o = 0; o < width; o++)
+            d.vjp(eye.data() + (long)o * width, 1, J.data() + (long)o * width); }, 5);
+    double batched = seconds([&]()
+                             { d.vjp(eye.data(), width, J.data()); }, 5);
+    double forward = seconds([&]()
+                             { d.jvp(eye.data(), width, J.data()); }, 5);
+    double sort = seconds([&]()
+                          { Derivatives(x, y); }, 5);
+
+    cout << "Jacobian " << width << " x " << width << ", graph of " << depth << " x " << width << " nodes, fan-in " << fan << endl;
+    cout << "rebuild + backward per output\t| " << rebuild * 1e3 << " ms" << endl;
+    cout << "Derivatives, one VJP per output\t| " << single * 1e3 << " ms (" << rebuild / single << "x)" << endl;
+    cout << "Derivatives, batched VJP\t| " << batched * 1e3 << " ms (" << rebuild / batched << "x)" << endl;
+    cout << "Derivatives, batched JVP\t| " << forward * 1e3 << " ms (" << rebuild / forward << "x)" << endl;
+    cout << "Derivatives construction\t| " << sort * 1e3 << " ms" << endl;
+    return 0;
+}
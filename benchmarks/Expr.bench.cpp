@@ -0,0 +1,115 @@
+#include "../include/Expr.hpp"
+#include "../include/NN.hpp"
+#include <chrono>
+#include <iostream>
+#include <unordered_set>
+
+// Composite expressions built one node per operator, as the operators did
+// before expression nodes, against the same expressions as single nodes:
+// nodes, graph bytes and the time to build and backpropagate them. Then
+// simpleLoss, which now records one node per element.
+
+const int n = 100000;
+
+// One node per operator; a - b was a + b * (-1) and a / b was a * b^-1
+shared_ptr<Value> subtract(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
+{
+    return a + b * Value::create(-1);
+}
+
+template <typename F>
+void run(const string &name, F f)
+{
+    vector<shared_ptr<Value>> a, b, c;
+    for (int i = 0; i < n; i++)
+    {
+        a.push_back(make_shared<Value>(0.5f + i % 13));
+        b.push_back(make_shared<Value>(1.5f - i % 7));
+        c.push_back(make_shared<Value>(0.25f));
+    }
+    unordered_set<Value *> inputs;
+    for (int i = 0; i < n; i++)
+    {
+        inputs.insert({a[i].get(), b[i].get(), c[i].get()});
+    }
+    GraphArena arena;
+    double build = 0, back = 0;
+    size_t bytes = 0, nodes = 0;
+    const int reps = 5;
+    for (int r = 0; r < reps; r++)
+    {
+        {
+            ArenaScope scope(arena);
+            auto start = chrono::steady_clock::now();
+            vector<shared_ptr<Value>> terms;
+            terms.reserve(n);
+            for (int i = 0; i < n; i++)
+            {
+                terms.push_back(f(a[i], b[i], c[i]));
+            }
+            auto root = sum(terms);
+            auto built = chrono::steady_clock::now();
+            root->backward();
+            auto done = chrono::steady_clock::now();
+            build += chrono::duration<double>(built - start).count();
+            back += chrono::duration<double>(done - built).count();
+            bytes = arena.used();
+            // Everything but the inputs and the sum, constants included
+            vector<Value *> order;
+            build_topo(root.get(), order);
+            nodes = order.size() - 1;
+            for (Value *v : order)
+            {
+                nodes -= inputs.count(v);
+            }
+        }
+        arena.reset();
+    }
+    cout << name << "\t| " << double(nodes) / n << " nodes\t| " << double(bytes) / n << " B\t| build = "
+         << build / reps / n * 1e9 << " ns\t| backward = " << back / reps / n * 1e9 << " ns" << endl;
+}
+
+int main()
+{
+    cout << "Per expression, " << n << " of them" << endl;
+    run("a - b, nodes\t", [](auto &a, auto &b, auto &)
+        { return subtract(a, b); });
+    run("a - b, fused\t", [](auto &a, auto &b, auto &) -> shared_ptr<Value>
+        { return expr(a) - b; });
+    run("a / b, nodes\t", [](auto &a, auto &b, auto &)
+        { return a * (b ^ -1); });
+    run("a / b, fused\t", [](auto &a, auto &b, auto &) -> shared_ptr<Value>
+        { return expr(a) / b; });
+    run("(a - b)^2, nodes", [](auto &a, auto &b, auto &)
+        { auto d = subtract(a, b); return d * d; });
+    run("(a - b)^2, fused", [](auto &a, auto &b, auto &) -> shared_ptr<Value>
+        { return square(expr(a) - b); });
+    run("a * b + c, nodes", [](auto &a, auto &b, auto &c)
+        { return a * b + c; });
+    run("a * b + c, fused", [](auto &a, auto &b, auto &c) -> shared_ptr<Value>
+        { return expr(a) * b + c; });
+
+    // simpleLoss over 10 outputs, forward and backward
+    vector<shared_ptr<Value>> pred, y;
+    for (int i = 0; i < 10; i++)
+    {
+        pred.push_back(make_shared<Value>(i * 0.1f));
+        y.push_back(make_shared<Value>(i == 3));
+    }
+    GraphArena arena;
+    const int reps = 100000;
+    auto start = chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int r = 0; r < reps; r++)
+    {
+        {
+            ArenaScope scope(arena);
+            simpleLoss(pred, y)->backward();
+            bytes = arena.used();
+        }
+        arena.reset();
+    }
+    double t = chrono::duration<double>(chrono::steady_clock::now() - start).count() / reps;
+    cout << "\nsimpleLoss, 10 outputs\t| " << bytes << " B\t| forward + backward = " << t * 1e9 << " ns" << endl;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "../include/Kernels.hpp"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Average time of one call of f, in nanoseconds
+double time_ns(const function<void()> &f)
+{
+    int iterations = 1;
+    while (true)
+    {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+            f();
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        if (ns > 2e7)
+            return ns / iterations;
+        iterations *= 2;
+    }
+}
+
+void report(const string &isaName, const string &kernel, double flops, const function<void()> &f)
+{
+    double ns = time_ns(f);
+    cout << isaName << "\t| " << kernel << "\t| ns/call = " << ns << "\t| GFLOP/s = " << flops / ns << endl;
+}
+
+int main()
+{
+    const int n = 1024, rows = 512, cols = 512, batch = 32;
+    mt19937 rng(1);
+    uniform_real_distribution<float> dist(-1, 1);
+    auto fill = [&](int size)
+    {
+        vector<float> v(size);
+        for (auto &x : v)
+            x = dist(rng);
+        return v;
+    };
+    auto a = fill(n), b = fill(n), y = fill(n), gz = fill(n);
+    auto W = fill(rows * cols), x = fill(cols), g = fill(rows), out = fill(rows), gx = fill(cols);
+    auto X = fill(batch * cols), Y = fill(batch * rows), G = fill(batch * rows), dX = fill(batch * cols);
+    float sink = 0;
+
+    const char *names[] = {"scalar", "avx2", "avx512"};
+    for (isa target : {isa::scalar, isa::avx2, isa::avx512})
+    {
+        if (!setKernelIsa(target))
+            continue;
+        string name = names[int(target)];
+        report(name, "dot        ", 2.0 * n, [&]()
+               { sink += dot(a.data(), b.data(), n); });
+        report(name, "axpy       ", 2.0 * n, [&]()
+               { axpy(1e-3f, a.data(), y.data(), n); });
+        report(name, "tanh       ", n, [&]()
+               { y = a; tanh_forward(y.data(), n); });
+        report(name, "tanh grad  ", 3.0 * n, [&]()
+               { tanh_backward(a.data(), b.data(), gz.data(), n); });
+        report(name, "relu       ", n, [&]()
+               { y = a; relu_forward(y.data(), n); });
+        report(name, "gemv       ", 2.0 * rows * cols, [&]()
+               { gemv(W.data(), x.data(), g.data(), out.data(), rows, cols); });
+        report(name, "gemv_t_acc ", 2.0 * rows * cols, [&]()
+               { gemv_t_acc(W.data(), g.data(), gx.data(), rows, cols); });
+        report(name, "ger_acc    ", 2.0 * rows * cols, [&]()
+               { ger_acc(g.data(), x.data(), W.data(), rows, cols); });
+        report(name, "gemm_nt    ", 2.0 * batch * rows * cols, [&]()
+               { gemm_nt(X.data(), W.data(), g.data(), Y.data(), batch, rows, cols); });
+        report(name, "gemm_tn_acc", 2.0 * batch * rows * cols, [&]()
+               { gemm_tn_acc(G.data(), X.data(), W.data(), batch, rows, cols); });
+        report(name, "gemm_nn_acc", 2.0 * batch * rows * cols, [&]()
+               { gemm_nn_acc(G.data(), W.data(), dX.data(), batch, rows, cols); });
+    }
+    return sink == 12345.0f;
+}
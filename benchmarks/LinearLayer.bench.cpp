@@ -0,0 +1,85 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <unordered_set>
+
+// Bytes requested from the heap, to measure the memory held by a graph
+static size_t allocated = 0;
+
+void *operator new(size_t n)
+{
+    allocated += n;
+    if (void *p = malloc(n))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+size_t count_nodes(const vector<shared_ptr<Value>> &roots)
+{
+    unordered_set<Value *> seen;
+    vector<Value *> stack;
+    for (auto &r : roots)
+    {
+        stack.push_back(r.get());
+    }
+    while (!stack.empty())
+    {
+        Value *v = stack.back();
+        stack.pop_back();
+        if (!seen.insert(v).second)
+            continue;
+        for (auto &c : *v->get_prev())
+        {
+            stack.push_back(c.get());
+        }
+    }
+    return seen.size();
+}
+
+void run(int nin, int nout, engine mode, int iterations)
+{
+    LinearLayer layer(nin, nout, activation::tanh, mode);
+    vector<shared_ptr<Value>> x;
+    for (int i = 0; i < nin; i++)
+    {
+        x.push_back(make_shared<Value>(0.01f * (i % 100)));
+    }
+
+    size_t before = allocated;
+    auto out = layer(x);
+    size_t bytes = allocated - before;
+    size_t nodes = count_nodes(out) - nin;
+    out.clear();
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        auto y = layer(x);
+        auto loss = sum(y);
+        loss->backward();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << nin << "x" << nout << "\t| " << (mode == engine::tensor ? "tensor" : "scalar")
+         << "\t| nodes = " << nodes << "\t| forward bytes = " << bytes
+         << "\t| forward+backward/sec = " << iterations / seconds << endl;
+}
+
+int main()
+{
+    run(64, 64, engine::scalar, 200);
+    run(64, 64, engine::tensor, 200);
+    run(512, 512, engine::scalar, 5);
+    run(512, 512, engine::tensor, 5);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "../include/Optimizer.hpp"
+#include <chrono>
+#include <iostream>
+
+// Cost of the parameter update (and clearing the gradients) per step: the
+// hand-written loop over parameters() plus zero_grad, against the fused
+// optimizer kernels
+
+template <typename F>
+double time_per_step(F step, int steps)
+{
+    step();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        step();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / steps;
+}
+
+void run(int width, engine mode, int steps)
+{
+    MLP model(width, {width, width}, mode);
+    const float lr = 1e-4f;
+    double loop = time_per_step([&]()
+                                {
+        for (auto &p : model.parameters())
+        {
+            p->setData(p->getData() - lr * p->getGrad());
+        }
+        model.zero_grad(); }, steps);
+    SGD sgd(model, lr);
+    double plain = time_per_step([&]()
+                                 { sgd.step(); }, steps);
+    SGD momentum(model, lr, 0.9f);
+    double withMomentum = time_per_step([&]()
+                                        { momentum.step(); }, steps);
+    Adam adam(model, lr);
+    double adamStep = time_per_step([&]()
+                                    { adam.step(); }, steps);
+
+    cout << sgd.size() << " params\t| " << (mode == engine::tensor ? "tensor" : "scalar")
+         << "\t| loop + zero_grad = " << loop * 1e3 << " ms\t| SGD = " << plain * 1e3
+         << " ms\t| SGD momentum = " << withMomentum * 1e3 << " ms\t| Adam = " << adamStep * 1e3 << " ms" << endl;
+}
+
+int main()
+{
+    run(256, engine::scalar, 20);
+    run(256, engine::tensor, 20);
+    run(1024, engine::tensor, 10);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "../include/NN.hpp"
+#include "../include/ThreadPool.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Intra-op parallelism: latency of a single sample through 1024-wide
+// layers, predict() and a training step (forward and backward), with the
+// layers split across 1 to N threads. Then the backward of a wide graph of
+// scalar Values, serial and level by level.
+
+template <typename F>
+double seconds(F f, int reps)
+{
+    f();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        f();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main()
+{
+    const int width = 1024;
+    MLP model(width, {width, width, 10}, engine::tensor);
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(width), y(10);
+    vector<shared_ptr<Value>> xs, ys;
+    for (auto &v : x)
+    {
+        v = dist(rng);
+        xs.push_back(make_shared<Value>(v));
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        ys.push_back(make_shared<Value>(i == 3));
+    }
+    int most = max(4u, thread::hardware_concurrency());
+    cout << "MLP " << width << " x 2 + 10, batch 1, " << thread::hardware_concurrency() << " hardware threads" << endl;
+    double predict1 = 0, step1 = 0;
+    for (int threads = 1; threads <= most; threads *= 2)
+    {
+        setIntraOpThreads(threads);
+        double predict = seconds([&]()
+                                 { model.predict(x.data(), y.data(), 1); }, 200);
+        GraphArena arena;
+        double step = seconds([&]()
+                              {
+            {
+                ArenaScope scope(arena);
+                model.zero_grad();
+                mseLoss(model(xs), ys)->backward();
+            }
+            arena.reset(); }, 50);
+        predict1 = threads == 1 ? predict : predict1;
+        step1 = threads == 1 ? step : step1;
+        cout << threads << " threads\t| predict = " << predict * 1e6 << " us (" << predict1 / predict << "x)\t| step = "
+             << step * 1e6 << " us (" << step1 / step << "x)" << endl;
+    }
+
+    // 64 layers of 4096 nodes each, every node reading two of the previous
+    // layer, so each level is wide and children are shared
+    const int nodes = 4096, depth = 64;
+    vector<shared_ptr<Value>> layer;
+    for (int i = 0; i < nodes; i++)
+    {
+        layer.push_back(make_shared<Value>(dist(rng)));
+    }
+    for (int d = 0; d < depth; d++)
+    {
+        vector<shared_ptr<Value>> next;
+        for (int i = 0; i < nodes; i++)
+        {
+            next.push_back(tanh(layer[i] * layer[(i * 31 + d) % nodes]));
+        }
+        layer = next;
+    }
+    auto root = sum(layer);
+    long total = 2L * nodes * depth + 1;
+    cout << "\nGraph of " << total << " nodes, " << depth << " x " << nodes << " wide" << endl;
+    double serial = 0;
+    for (int threads = 1; threads <= most; threads *= 2)
+    {
+        setIntraOpThreads(threads);
+        double t = seconds([&]()
+                           { root->backward(); }, 10);
+        serial = threads == 1 ? t : serial;
+        cout << threads << " threads\t| backward = " << t * 1e3 << " ms (" << serial / t << "x)\t| "
+             << total / t / 1e6 << " M nodes/s" << endl;
+    }
+    setIntraOpThreads(1);
+    return 0;
+}
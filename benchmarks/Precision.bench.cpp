@@ -0,0 +1,85 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Inference latency of a model too large for the caches, with its weights
+// stored as float, bf16 and fp16: at small batches the products are bound
+// by the bytes of weights read. Also the throughput of the conversions.
+
+const char *name(precision p)
+{
+    return p == precision::fp32 ? "fp32" : p == precision::bf16 ? "bf16" : "fp16";
+}
+
+template <typename F>
+double seconds(F f, int reps)
+{
+    f();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        f();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main()
+{
+    const int width = 2048;
+    MLP base(width, {width, width, width, 16}, engine::tensor);
+    long weights = 3L * width * width + 16L * width;
+    // Scaled so the activations do not saturate
+    for (auto &b : base.blocks())
+    {
+        for (long i = 0; i < b.n; i++)
+        {
+            b.data[i] /= sqrt(float(width));
+        }
+    }
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(16 * width), y(16 * 16), ref(16 * 16);
+    for (auto &v : x)
+    {
+        v = dist(rng);
+    }
+    cout << "MLP " << width << " x 3 + 16, " << weights * 4 / (1 << 20) << " MiB of float weights" << endl;
+    for (int batch : {1, 16})
+    {
+        base.predict(x.data(), ref.data(), batch);
+        double fp32 = 0;
+        for (precision p : {precision::fp32, precision::bf16, precision::fp16})
+        {
+            MLP model = base.clone();
+            model.setPrecision(p);
+            double t = seconds([&]()
+                               { model.predict(x.data(), y.data(), batch); }, 20);
+            fp32 = p == precision::fp32 ? t : fp32;
+            float err = 0;
+            for (int i = 0; i < batch * 16; i++)
+            {
+                err = max(err, fabs(y[i] - ref[i]));
+            }
+            int bytes = p == precision::fp32 ? 4 : 2;
+            cout << "batch " << batch << "\t| " << name(p) << "\t| " << t * 1e3 << " ms\t| " << weights * bytes / t / 1e9
+                 << " GB/s of weights\t| speedup " << fp32 / t << "x\t| max error " << err << endl;
+        }
+    }
+
+    vector<float> f(1 << 22);
+    vector<uint16_t> h(f.size());
+    for (auto &v : f)
+    {
+        v = dist(rng);
+    }
+    for (precision p : {precision::bf16, precision::fp16})
+    {
+        double to = seconds([&]()
+                            { to_half(p, f.data(), h.data(), f.size()); }, 20);
+        double from = seconds([&]()
+                              { from_half(p, h.data(), f.data(), f.size()); }, 20);
+        cout << name(p) << "\t| to = " << f.size() / to / 1e9 << " G/s\t| from = " << f.size() / from / 1e9 << " G/s" << endl;
+    }
+    return 0;
+}
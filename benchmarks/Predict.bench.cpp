@@ -0,0 +1,67 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Every heap allocation in the process goes through here so we can count them
+static size_t allocations = 0;
+
+void *operator new(size_t n)
+{
+    allocations++;
+    if (void *p = malloc(n))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Latency of one inference through the graph and through predict()
+void run(engine mode, int calls)
+{
+    const int nin = 16;
+    MLP model(nin, {64, 64, 4}, mode);
+    vector<float> x(nin, 0.1f), y(4);
+    vector<shared_ptr<Value>> xs;
+    for (float v : x)
+    {
+        xs.push_back(make_shared<Value>(v));
+    }
+
+    size_t before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++)
+    {
+        auto out = model(xs);
+    }
+    double graph = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / calls;
+    double graphAllocs = double(allocations - before) / calls;
+
+    model.predict(x.data(), y.data()); // warm up the scratch buffers
+    before = allocations;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++)
+    {
+        model.predict(x.data(), y.data());
+    }
+    double direct = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / calls;
+    double directAllocs = double(allocations - before) / calls;
+
+    string name = mode == engine::tensor ? "tensor" : "scalar";
+    cout << name << "\t| graph   \t| us/call = " << graph << "\t| allocations/call = " << graphAllocs << endl;
+    cout << name << "\t| predict \t| us/call = " << direct << "\t| allocations/call = " << directAllocs << endl;
+}
+
+int main()
+{
+    run(engine::scalar, 2000);
+    run(engine::tensor, 20000);
+    return 0;
+}
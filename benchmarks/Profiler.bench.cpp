@@ -0,0 +1,56 @@
+#include "../include/NN.hpp"
+#include "../include/Optimizer.hpp"
+#include "../include/Profiler.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Cost of profiling a training step, disabled and enabled, followed by the
+// profile of a few steps of each engine (also written as JSON and as a
+// Chrome trace to build/)
+
+double train(MLP &model, int steps)
+{
+    SGD sgd(model, 1e-3f);
+    GraphArena arena;
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    auto start = chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++)
+    {
+        {
+            ArenaScope scope(arena);
+            vector<vector<shared_ptr<Value>>> x(16), y(16);
+            for (int s = 0; s < 16; s++)
+            {
+                for (int i = 0; i < model.inputs(); i++)
+                    x[s].push_back(Value::create(dist(rng)));
+                y[s].push_back(Value::create(dist(rng)));
+            }
+            simpleLoss(model(x), y)->backward();
+            sgd.step();
+        }
+        arena.reset();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / steps;
+}
+
+int main()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(16, {32, 32, 1}, mode);
+        train(model, 5);
+        double off = train(model, 50);
+        Profiler::reset();
+        Profiler::enable();
+        double on = train(model, 50);
+        Profiler::enable(false);
+        cout << (mode == engine::tensor ? "tensor" : "scalar") << "\t| step, profiler off = " << off * 1e3
+             << " ms\t| on = " << on * 1e3 << " ms\t| overhead = " << (on / off - 1) * 100 << " %\n\n";
+        cout << Profiler::report() << endl;
+    }
+    Profiler::writeJson("build/profile.json");
+    Profiler::writeTrace("build/trace.json");
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "../include/Quantized.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// int8 inference against the float path: latency per batch for a model in
+// cache and one too large for it, and the accuracy of the quantized model
+// on held-out samples
+
+template <typename F>
+double seconds(F f, int reps)
+{
+    f();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        f();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / reps;
+}
+
+void run(int width, int depth, int reps)
+{
+    vector<int> sizes(depth, width);
+    sizes.push_back(10);
+    MLP model(width, sizes, engine::tensor);
+    // Scaled so the activations do not saturate
+    for (auto &b : model.blocks())
+    {
+        for (long i = 0; i < b.n; i++)
+        {
+            b.data[i] /= sqrt(float(width));
+        }
+    }
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> calibration(256L * width), x(1024L * width), y(1024 * 10);
+    for (auto &v : calibration)
+    {
+        v = dist(rng);
+    }
+    for (auto &v : x)
+    {
+        v = dist(rng);
+    }
+    auto start = chrono::steady_clock::now();
+    QuantizedMLP quantized(model, calibration.data(), 256);
+    double calibrate = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long floats = model.parameters().size() * 4L;
+    cout << "MLP " << width << " x " << depth << " + 10, " << floats / 1024 << " KiB float, " << quantized.bytes() / 1024
+         << " KiB int8, calibrated in " << calibrate * 1e3 << " ms" << endl;
+    cout << "  " << compareQuantized(model, quantized, x.data(), 1024).str() << endl;
+    for (int batch : {1, 16, 64})
+    {
+        double f = seconds([&]()
+                           { model.predict(x.data(), y.data(), batch); }, reps);
+        double q = seconds([&]()
+                           { quantized.predict(x.data(), y.data(), batch); }, reps);
+        cout << "  batch " << batch << "\t| float = " << f * 1e6 << " us\t| int8 = " << q * 1e6 << " us\t| speedup "
+             << f / q << "x" << endl;
+    }
+}
+
+int main()
+{
+    run(256, 2, 2000);
+    run(2048, 3, 20);
+    return 0;
+}
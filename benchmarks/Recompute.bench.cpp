@@ -0,0 +1,58 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Activation checkpointing: graph memory kept by the forward pass of a deep
+// MLP (arena bytes in use before backward) and the time of a training step,
+// keeping every layer and with segments of k layers recomputed in backward
+
+void run(engine mode, int width, int depth, int batch, int steps)
+{
+    vector<int> sizes(depth, width);
+    sizes.push_back(10);
+    MLP base(width, sizes, mode);
+    mt19937 rng(0);
+    uniform_real_distribution<float> dist(-1, 1);
+    cout << (mode == engine::tensor ? "tensor" : "scalar") << " " << width << " x " << depth << " layers, batch " << batch << endl;
+    for (int k : {0, 1, 2, 4, depth + 1})
+    {
+        MLP model = base.clone();
+        model.setActivationCheckpointing(k);
+        GraphArena arena;
+        size_t used = 0;
+        double seconds = 0;
+        for (int step = 0; step < steps + 1; step++)
+        {
+            auto start = chrono::steady_clock::now();
+            {
+                ArenaScope scope(arena);
+                vector<vector<shared_ptr<Value>>> x(batch), y(batch);
+                for (int s = 0; s < batch; s++)
+                {
+                    for (int i = 0; i < width; i++)
+                        x[s].push_back(Value::create(dist(rng)));
+                    for (int i = 0; i < 10; i++)
+                        y[s].push_back(Value::create(i == s % 10));
+                }
+                auto loss = crossEntropy(model(x), y);
+                used = arena.used();
+                model.zero_grad();
+                loss->backward();
+            }
+            arena.reset();
+            // The first step warms up the buffers
+            if (step > 0)
+                seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        cout << "  k = " << (k == 0 ? string("off") : k == depth + 1 ? string("all") : to_string(k)) << "\t| graph = " << used / 1024.0 << " KiB\t| step = "
+             << seconds / steps * 1e3 << " ms" << endl;
+    }
+}
+
+int main()
+{
+    run(engine::scalar, 32, 8, 8, 5);
+    run(engine::tensor, 256, 16, 64, 20);
+    return 0;
+}
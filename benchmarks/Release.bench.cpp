@@ -0,0 +1,94 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Live and peak heap bytes of a training epoch without an arena: a running
+// total_loss = total_loss + loss chains every step's graph into one that
+// lives for the whole epoch, against a detached total. Then the memory a
+// large graph holds after backward() and backward(true) while its root is
+// still referenced.
+
+// Every block carries its size, so live bytes can be tracked
+static size_t live = 0, peak = 0;
+static const size_t header = 16;
+
+void *operator new(size_t n)
+{
+    char *p = static_cast<char *>(malloc(n + header));
+    if (!p)
+        throw bad_alloc();
+    *reinterpret_cast<size_t *>(p) = n;
+    live += n;
+    peak = max(peak, live);
+    return p + header;
+}
+void operator delete(void *p) noexcept
+{
+    if (!p)
+        return;
+    char *block = static_cast<char *>(p) - header;
+    live -= *reinterpret_cast<size_t *>(block);
+    free(block);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void epoch(int samples, bool detach)
+{
+    MLP model(4, {16, 16, 1});
+    vector<shared_ptr<Value>> x, y{make_shared<Value>(0.5)};
+    for (int i = 0; i < 4; i++)
+    {
+        x.push_back(make_shared<Value>(0.1 * i));
+    }
+    size_t before = live;
+    peak = live;
+    auto start = chrono::steady_clock::now();
+    auto total = make_shared<Value>(0.0);
+    for (int s = 0; s < samples; s++)
+    {
+        auto loss = simpleLoss(model(x), y);
+        loss->backward();
+        total = detach ? (total + loss->detach())->detach() : total + loss;
+    }
+    double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << (detach ? "detached total" : "chained total ") << "\t| " << samples << " samples\t| peak = "
+         << (peak - before) / 1024 << " KB\t| " << t / samples * 1e6 << " us/step" << endl;
+}
+
+void large(bool release)
+{
+    auto w = make_shared<Value>(0.5);
+    auto b = make_shared<Value>(0.1);
+    shared_ptr<Value> root = make_shared<Value>(0.3);
+    size_t before = live;
+    for (int i = 0; i < 30000; i++)
+    {
+        root = tanh(root * w + b);
+    }
+    size_t built = live - before;
+    peak = live;
+    auto start = chrono::steady_clock::now();
+    root->backward(release);
+    double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << (release ? "backward(true)" : "backward()    ") << "\t| graph = " << built / 1024 << " KB\t| peak = "
+         << (peak - before) / 1024 << " KB\t| kept after = " << (live - before) / 1024 << " KB\t| " << t * 1e3 << " ms"
+         << endl;
+}
+
+int main()
+{
+    for (int samples : {500, 1000, 2000})
+    {
+        epoch(samples, false);
+        epoch(samples, true);
+    }
+    cout << "\nChain of 90k nodes, root still referenced" << endl;
+    large(false);
+    large(true);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "../include/Server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+
+// Load generator: client threads each send single-sample requests back to
+// back for a fixed time. Reports the p50 / p99 latency of a request and the
+// throughput, for predict() behind a mutex (one request at a time) and for
+// the server with several batch sizes and deadlines.
+
+const double duration = 1.0;
+
+// f(x) runs one request and returns its outputs
+template <typename F>
+void load(const string &name, int clients, int inputs, F f)
+{
+    vector<vector<double>> latencies(clients);
+    atomic<bool> running{true};
+    vector<thread> threads;
+    for (int c = 0; c < clients; c++)
+    {
+        threads.emplace_back([&, c]()
+                             {
+            mt19937 rng(c);
+            uniform_real_distribution<float> dist(-1, 1);
+            vector<float> x(inputs);
+            while (running.load(memory_order_relaxed))
+            {
+                for (auto &v : x)
+                    v = dist(rng);
+                auto start = chrono::steady_clock::now();
+                f(x);
+                latencies[c].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            } });
+    }
+    this_thread::sleep_for(chrono::duration<double>(duration));
+    running = false;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    vector<double> all;
+    for (auto &l : latencies)
+    {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p)
+    { return all.empty() ? 0 : all[min(all.size() - 1, size_t(p * all.size()))]; };
+    cout << "  " << name << "\t| p50 = " << percentile(0.5) << " us\t| p99 = " << percentile(0.99) << " us\t| "
+         << all.size() / duration << " requests/s" << endl;
+}
+
+int main()
+{
+    MLP model(64, {256, 256, 10}, engine::tensor);
+    for (int clients : {1, 16, 64})
+    {
+        cout << clients << " clients" << endl;
+        mutex m;
+        load("mutex + predict\t", clients, 64, [&](const vector<float> &x)
+             {
+            lock_guard<mutex> lock(m);
+            return model.predict(x); });
+        for (auto config : vector<pair<int, int>>{{1, 0}, {16, 200}, {64, 1000}})
+        {
+            InferenceServer server(model, config.first, chrono::microseconds(config.second));
+            load("batch " + to_string(config.first) + ", " + to_string(config.second) + " us", clients, 64, [&](const vector<float> &x)
+                 { return server.submit(x).get(); });
+            auto s = server.stats();
+            cout << "  \t\t\t| mean batch = " << double(s.requests) / max(1L, s.batches) << endl;
+        }
+    }
+    return 0;
+}
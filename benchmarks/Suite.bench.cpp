@@ -0,0 +1,356 @@
+#include "../include/NN.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+
+// Regression suite: every case is timed for at least minTime and reported
+// as time per iteration and items (nodes, samples, ...) per second. The
+// results are written as JSON, one benchmark per line:
+//
+//   suite-bench [results.json] [baseline.json]
+//
+// With a baseline (results of an earlier run), the change of every case
+// is printed next to it.
+
+const double minTime = 0.2;
+
+struct Result
+{
+    string name;
+    long iterations;
+    double ns;
+    double itemsPerSec;
+};
+
+vector<Result> results;
+map<string, double> baseline;
+
+// Runs f until minTime has passed, doubling the iteration count
+template <typename F>
+void measure(const string &name, long items, F f)
+{
+    f();
+    long iterations = 1;
+    double seconds = 0;
+    while (true)
+    {
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+        {
+            f();
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds >= minTime)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+    Result r{name, iterations, seconds * 1e9 / iterations, items * iterations / seconds};
+    results.push_back(r);
+    cout << left << setw(36) << name << right << setw(14) << fixed << setprecision(1) << r.ns << " ns" << setw(14)
+         << setprecision(0) << r.itemsPerSec << " items/s";
+    auto b = baseline.find(name);
+    if (b != baseline.end())
+    {
+        cout << setw(10) << setprecision(1) << showpos << (b->second / r.ns - 1) * 100 << noshowpos << " % faster";
+    }
+    cout << endl;
+}
+
+// ns per iteration of every benchmark in a results file
+map<string, double> load(const string &path)
+{
+    map<string, double> out;
+    ifstream file(path);
+    string line;
+    while (getline(file, line))
+    {
+        char name[256];
+        double ns;
+        if (sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"iterations\": %*d, \"ns\": %lf", name, &ns) == 2)
+        {
+            out[name] = ns;
+        }
+    }
+    return out;
+}
+
+const char *isaName(isa i)
+{
+    return i == isa::avx512 ? "avx512" : i == isa::avx2 ? "avx2" : "scalar";
+}
+
+void save(const string &path)
+{
+    ofstream file(path, ios::trunc);
+    file << "{\"isa\": \"" << isaName(kernelIsa()) << "\", \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto &r = results[i];
+        file << "  {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"ns\": " << setprecision(6)
+             << r.ns << ", \"items_per_sec\": " << r.itemsPerSec << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]}\n";
+}
+
+vector<shared_ptr<Value>> leaves(int n, mt19937 &rng)
+{
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<shared_ptr<Value>> out;
+    for (int i = 0; i < n; i++)
+    {
+        out.push_back(make_shared<Value>(dist(rng)));
+    }
+    return out;
+}
+
+// One node per iteration, the arena rewound every 4096
+template <typename Op>
+void scalarOp(const string &name, Op op)
+{
+    auto a = make_shared<Value>(0.3);
+    auto b = make_shared<Value>(0.7);
+    GraphArena arena;
+    vector<shared_ptr<Value>> keep(4096);
+    long i = 0;
+    measure("op/" + name, 1, [&]()
+            {
+        {
+            ArenaScope scope(arena);
+            keep[i % 4096] = op(a, b);
+        }
+        if (++i % 4096 == 0)
+        {
+            fill(keep.begin(), keep.end(), nullptr);
+            arena.reset();
+        } });
+}
+
+void ops()
+{
+    scalarOp("add", [](const shared_ptr<Value> &a, const shared_ptr<Value> &b)
+             { return a + b; });
+    scalarOp("mul", [](const shared_ptr<Value> &a, const shared_ptr<Value> &b)
+             { return a * b; });
+    scalarOp("tanh", [](const shared_ptr<Value> &a, const shared_ptr<Value> &)
+             { return tanh(a); });
+    scalarOp("exp", [](const shared_ptr<Value> &a, const shared_ptr<Value> &)
+             { return exp(a); });
+}
+
+void graphs()
+{
+    mt19937 rng(0);
+    // Deep: y = tanh(y * w + b), three nodes per step. The graph is built
+    // once and backpropagated repeatedly (the order is cached on the root)
+    for (int depth : {1000, 10000})
+    {
+        auto w = make_shared<Value>(0.5);
+        auto b = make_shared<Value>(0.1);
+        GraphArena kept, arena;
+        shared_ptr<Value> y;
+        {
+            ArenaScope scope(kept);
+            y = make_shared<Value>(0.3);
+            for (int i = 0; i < depth; i++)
+            {
+                y = tanh(y * w + b);
+            }
+        }
+        measure("backward/deep-" + to_string(depth), 3L * depth, [&]()
+                { y->backward(); });
+        // Build and sort as well
+        measure("build+backward/deep-" + to_string(depth), 3L * depth, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                auto z = make_shared<Value>(0.3);
+                for (int i = 0; i < depth; i++)
+                {
+                    z = tanh(z * w + b);
+                }
+                z->backward();
+            }
+            arena.reset(); });
+        y = nullptr;
+    }
+    // Wide: the sum of n products
+    for (int width : {1000, 100000})
+    {
+        auto a = leaves(width, rng);
+        auto b = leaves(width, rng);
+        GraphArena arena;
+        measure("build+backward/wide-" + to_string(width), 2L * width, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                vector<shared_ptr<Value>> p;
+                p.reserve(width);
+                for (int i = 0; i < width; i++)
+                {
+                    p.push_back(a[i] * b[i]);
+                }
+                sum(p)->backward();
+            }
+            arena.reset(); });
+    }
+}
+
+void modules()
+{
+    mt19937 rng(1);
+    GraphArena arena;
+    for (int nin : {16, 256})
+    {
+        Neuron n(nin, activation::tanh);
+        auto x = leaves(nin, rng);
+        measure("neuron/" + to_string(nin), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                n(x)->backward();
+            }
+            arena.reset(); });
+    }
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        string e = mode == engine::tensor ? "tensor" : "scalar";
+        for (int size : {16, 128})
+        {
+            LinearLayer layer(size, size, activation::tanh, mode);
+            auto x = leaves(16 * size, rng);
+            measure("linear/" + e + "/" + to_string(size) + "x" + to_string(size) + "/b16", 16, [&]()
+                    {
+                {
+                    ArenaScope scope(arena);
+                    auto y = layer.forward(x, 16);
+                    sum(y)->backward();
+                }
+                arena.reset(); });
+        }
+        for (auto &shape : vector<pair<int, vector<int>>>{{16, {32, 32, 1}}, {64, {128, 128, 10}}})
+        {
+            MLP model(shape.first, shape.second, mode);
+            vector<vector<shared_ptr<Value>>> x, y;
+            for (int s = 0; s < 16; s++)
+            {
+                x.push_back(leaves(shape.first, rng));
+                y.push_back(leaves(shape.second.back(), rng));
+            }
+            string name = "mlp/" + e + "/" + to_string(shape.first);
+            for (int l : shape.second)
+            {
+                name += "-" + to_string(l);
+            }
+            measure(name + "/b16", 16, [&]()
+                    {
+                {
+                    ArenaScope scope(arena);
+                    simpleLoss(model(x), y)->backward();
+                }
+                arena.reset(); });
+            vector<float> xs(16 * shape.first, 0.5f), ys(16 * shape.second.back());
+            measure(name + "/predict/b16", 16, [&]()
+                    { model.predict(xs.data(), ys.data(), 16); });
+        }
+    }
+}
+
+void losses()
+{
+    mt19937 rng(2);
+    GraphArena arena;
+    for (int n : {10, 100})
+    {
+        auto x = leaves(n, rng);
+        auto y = leaves(n, rng);
+        measure("softmax/" + to_string(n), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                auto s = softMax(x);
+                sum(s)->backward();
+            }
+            arena.reset(); });
+        measure("simpleloss/" + to_string(n), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                simpleLoss(x, y)->backward();
+            }
+            arena.reset(); });
+        measure("mse/" + to_string(n), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                mseLoss(x, y)->backward();
+            }
+            arena.reset(); });
+        // Against the same loss built from softMax and log
+        measure("crossentropy/" + to_string(n), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                crossEntropy(x, y)->backward();
+            }
+            arena.reset(); });
+        measure("crossentropy-unfused/" + to_string(n), 1, [&]()
+                {
+            {
+                ArenaScope scope(arena);
+                auto p = softMax(x);
+                vector<shared_ptr<Value>> terms;
+                for (int i = 0; i < n; i++)
+                {
+                    terms.push_back(y[i] * log(p[i]));
+                }
+                (-sum(terms))->backward();
+            }
+            arena.reset(); });
+    }
+}
+
+void checkpoints()
+{
+    const string text = "build/suite-bench.txt";
+    const string binary = "build/suite-bench.ckpt";
+    MLP model(256, {256, 256, 10}, engine::tensor);
+    long params = model.parameters().size();
+    measure("checkpoint/save-text", params, [&]()
+            { model.saveTo(text); });
+    measure("checkpoint/save-binary", params, [&]()
+            { model.saveCheckpoint(binary); });
+    measure("checkpoint/load-text", params, [&]()
+            { MLP loaded(text, engine::tensor); });
+    measure("checkpoint/load-binary", params, [&]()
+            { MLP loaded(binary, engine::tensor); });
+    remove(text.c_str());
+    remove(binary.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    string out = argc > 1 ? argv[1] : "build/bench.json";
+    if (argc > 2)
+    {
+        baseline = load(argv[2]);
+        if (baseline.empty())
+        {
+            cerr << "No results in " << argv[2] << endl;
+            return 1;
+        }
+    }
+    ops();
+    graphs();
+    modules();
+    losses();
+    checkpoints();
+    save(out);
+    cout << "Results written to " << out << endl;
+    return 0;
+}
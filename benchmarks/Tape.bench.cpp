@@ -0,0 +1,115 @@
+#include "../include/NN.hpp"
+#include "../include/Tape.hpp"
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+
+// Every heap allocation in the process goes through here so we can count them
+static size_t allocations = 0;
+
+void *operator new(size_t n)
+{
+    allocations++;
+    if (void *p = malloc(n))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void update(const vector<shared_ptr<Value>> &params)
+{
+    for (auto &p : params)
+    {
+        p->setData(p->getData() - 0.001f * p->getGrad());
+    }
+}
+
+// One training step per sample, building the graph every time (in an arena)
+// or replaying a tape traced once
+void run(int nin, vector<int> sizes, engine mode, bool useTape, int steps)
+{
+    MLP model(nin, sizes, mode);
+    int nout = sizes.back();
+    mt19937 rng(42);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> data((nin + nout) * 64);
+    for (auto &v : data)
+        v = dist(rng);
+
+    vector<shared_ptr<Value>> x, y, inputs;
+    for (int i = 0; i < nin; i++)
+    {
+        x.push_back(make_shared<Value>(0));
+        inputs.push_back(x.back());
+    }
+    for (int i = 0; i < nout; i++)
+    {
+        y.push_back(make_shared<Value>(0));
+        inputs.push_back(y.back());
+    }
+    Tape tape(inputs, {simpleLoss(model(x), y)});
+    GraphArena arena;
+    auto &params = model.parameters();
+    auto blocks = model.blocks();
+
+    auto start = chrono::steady_clock::now();
+    size_t before = allocations;
+    for (int s = 0; s < steps; s++)
+    {
+        const float *sample = &data[(s % 64) * (nin + nout)];
+        // zero_grad would count the allocation of its block list
+        for (auto &b : blocks)
+        {
+            memset(b.grad, 0, b.n * sizeof(float));
+        }
+        if (useTape)
+        {
+            tape.forward(sample);
+            tape.backward();
+        }
+        else
+        {
+            {
+                ArenaScope scope(arena);
+                for (size_t i = 0; i < inputs.size(); i++)
+                {
+                    inputs[i]->setData(sample[i]);
+                }
+                auto loss = simpleLoss(model(x), y);
+                loss->backward();
+            }
+            arena.reset();
+        }
+        update(params);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << nin;
+    for (int s : sizes)
+        cout << "-" << s;
+    cout << "\t| " << (mode == engine::tensor ? "tensor" : "scalar") << "\t| " << (useTape ? "tape " : "graph")
+         << "\t| instructions = " << tape.size() << "\t| allocations/step = " << double(allocations - before) / steps
+         << "\t| steps/sec = " << steps / seconds << endl;
+}
+
+int main()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        run(2, {5, 1}, mode, false, 20000);
+        run(2, {5, 1}, mode, true, 20000);
+        run(16, {32, 32, 1}, mode, false, 2000);
+        run(16, {32, 32, 1}, mode, true, 2000);
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "../include/Trainer.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+// Data-parallel scaling: samples/sec from 1 thread up to the core count
+void run(engine mode, int threads, int batch, int steps)
+{
+    const int nin = 32, nout = 4;
+    MLP model(nin, {64, 64, nout}, mode);
+    mt19937 rng(42);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(batch * nin), y(batch * nout);
+    for (auto &v : x)
+        v = dist(rng);
+    for (auto &v : y)
+        v = dist(rng);
+
+    DataParallelTrainer trainer(model, threads);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        trainer.step(x.data(), y.data(), batch, 0.01f);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << (mode == engine::tensor ? "tensor" : "scalar") << "\t| threads = " << threads
+         << "\t| samples/sec = " << batch * steps / seconds << endl;
+}
+
+int main()
+{
+    int cores = max(1u, thread::hardware_concurrency());
+    vector<int> counts;
+    for (int t = 1; t < cores; t *= 2)
+        counts.push_back(t);
+    counts.push_back(cores);
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        for (int t : counts)
+        {
+            run(mode, t, 256, mode == engine::tensor ? 50 : 5);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "../include/ValueStruct.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Bytes requested from the heap, to measure the memory held by a graph
+static size_t allocated = 0;
+
+void *operator new(size_t n)
+{
+    allocated += n;
+    if (void *p = malloc(n))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// A deep chain y = tanh(y * w + b), three nodes per step
+void chain(int depth, bool labels)
+{
+    Value::setDebug(labels);
+    auto w = make_shared<Value>(0.5);
+    auto b = make_shared<Value>(0.1);
+    shared_ptr<Value> y = make_shared<Value>(0.3);
+
+    size_t before = allocated;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < depth; i++)
+    {
+        y = tanh(y * w + b);
+    }
+    double forward = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t bytes = allocated - before;
+
+    start = chrono::steady_clock::now();
+    y->backward();
+    double backward = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    Value::setDebug(false);
+
+    // Unlink the chain iteratively, its destructors would recurse
+    vector<shared_ptr<Value>> pending{y};
+    while (!pending.empty())
+    {
+        auto v = pending.back();
+        pending.pop_back();
+        for (auto &c : *v->get_prev())
+        {
+            pending.push_back(c);
+        }
+        v->get_prev()->clear();
+    }
+
+    long nodes = 3L * depth;
+    cout << "depth " << depth << "\t| labels " << (labels ? "on " : "off") << "\t| bytes/node = " << double(bytes) / nodes
+         << "\t| forward ops/sec = " << nodes / forward << "\t| backward ops/sec = " << nodes / backward << endl;
+}
+
+int main()
+{
+    cout << "sizeof(Value) = " << sizeof(Value) << endl;
+    // Labels grow with the depth of the expression, so keep those chains short
+    chain(1000, true);
+    chain(3000, true);
+    chain(1000, false);
+    chain(3000, false);
+    chain(100000, false);
+    return 0;
+}
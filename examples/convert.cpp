@@ -0,0 +1,49 @@
+#include "include/NN.hpp"
+#include <iostream>
+
+// Converts a model between the text format of MLP::saveTo and the binary
+// checkpoint format, in whichever direction the input file calls for:
+//
+//   convert model.txt model.ckpt
+//   convert model.ckpt model.txt
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <input model> <output model>" << endl;
+        return 1;
+    }
+    try
+    {
+        bool binary = Checkpoint::detect(argv[1]);
+        // Load in place, the weights are only read once to be written out
+        MLP model = binary ? MLP(Checkpoint(argv[1]), engine::tensor) : MLP(string(argv[1]), engine::tensor);
+        if (model.inputs() == 0)
+        {
+            cerr << "No model in " << argv[1] << endl;
+            return 1;
+        }
+        if (binary)
+        {
+            model.saveTo(argv[2]);
+        }
+        else
+        {
+            model.saveCheckpoint(argv[2]);
+        }
+        // Counted from the blocks, since parameters() would make a Value per weight
+        long count = 0;
+        for (auto &b : model.blocks())
+        {
+            count += b.n;
+        }
+        cout << argv[1] << " -> " << argv[2] << " (" << count << " parameters, "
+             << (binary ? "text" : "binary") << ")" << endl;
+    }
+    catch (exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,13 +1,17 @@
 #include "include/NN.hpp"
+#include "include/Optimizer.hpp"
+#include "include/DataLoader.hpp"
 #include <iostream>
 #include <vector>
 #include <memory>
 #include <random>
 
-// Function to generate synthetic training data (e.g., for a simple linear regression)
-std::vector<std::pair<std::vector<std::shared_ptr<Value>>, std::vector<std::shared_ptr<Value>>>> generate_training_data(int num_samples)
+// Function to generate synthetic training data (e.g., for a simple linear regression).
+// Samples are plain floats; a DataLoader streams them in batches, the same
+// way it would from a CSV or binary file (CsvDataset, BinaryDataset)
+MemoryDataset generate_training_data(int num_samples)
 {
-    std::vector<std::pair<std::vector<std::shared_ptr<Value>>, std::vector<std::shared_ptr<Value>>>> data;
+    std::vector<float> x, y;
     std::mt19937 rng(42);
     std::uniform_real_distribution<> dist(-1.0, 1.0);
 
@@ -15,15 +19,12 @@ std::vector<std::pair<std::vector<std::shared_ptr<Value>>, std::vector<std::shar
     {
         double x1 = dist(rng);
         double x2 = dist(rng);
-        double y = 3.0 * x1 + 2.0 * x2; // Target is a simple linear combination of inputs
-
-        std::vector<std::shared_ptr<Value>> inputs = {std::make_shared<Value>(x1), std::make_shared<Value>(x2)};
-        std::vector<std::shared_ptr<Value>> targets = {std::make_shared<Value>(y)};
-
-        data.push_back({inputs, targets});
+        x.push_back(x1);
+        x.push_back(x2);
+        y.push_back(3.0 * x1 + 2.0 * x2); // Target is a simple linear combination of inputs
     }
 
-    return data;
+    return MemoryDataset(x, y, 2, 1);
 }
 
 int main()
@@ -31,66 +32,80 @@ int main()
     // Define the MLP architecture
     MLP model(2, {5, 1}); // 2 input features, 1 hidden layer with 5 units, 1 output
 
-    // Generate synthetic training data
+    // Generate synthetic training data, visited in a shuffled order (seeded) one sample at a time
     int num_samples = 100;
     auto training_data = generate_training_data(num_samples);
+    DataLoader loader(training_data, 1, true, 42);
 
     // Training loop
     int epochs = 10000;
     double learning_rate = 0.001;
 
+    // Intermediate nodes of each step are allocated here and released together
+    GraphArena arena;
+    // Plain SGD; the update also clears the gradients for the next step
+    SGD optimizer(model, learning_rate);
+
+    Batch batch;
     for (int epoch = 0; epoch < epochs; ++epoch)
     {
-        auto total_loss = std::make_shared<Value>(0.0);
+        double total_loss = 0.0;
 
-        for (const auto &sample : training_data)
+        while (loader.next(batch))
         {
-            const std::vector<std::shared_ptr<Value>> &inputs = sample.first;
-            const std::vector<std::shared_ptr<Value>> &targets = sample.second;
-
-            // Forward pass
-            std::vector<std::shared_ptr<Value>> predictions = model(inputs);
-
-            // Compute loss (mean squared error)
-            auto loss = simpleLoss(predictions, targets);
-            total_loss = total_loss + loss;
-
-            // Backward pass
-            model.zero_grad(); // Reset gradients
-            loss->backward();  // Backpropagation
-
-            // Update model parameters (simple SGD)
-            for (auto &p : model.parameters())
             {
-                p->setData(p->getData() - learning_rate * p->getGrad());
+                ArenaScope scope(arena);
+                std::vector<std::shared_ptr<Value>> inputs = {Value::create(batch.x[0]), Value::create(batch.x[1])};
+                std::vector<std::shared_ptr<Value>> targets = {Value::create(batch.y[0])};
+
+                // Forward pass
+                std::vector<std::shared_ptr<Value>> predictions = model(inputs);
+
+                // Compute loss (mean squared error). The metric takes its
+                // value only: adding the node itself would chain every
+                // step's graph into one (loss->detach() gives a graph-free
+                // Value if one is needed)
+                auto loss = simpleLoss(predictions, targets);
+                total_loss += loss->getData();
+
+                // Backward pass. The arena frees the graph at the end of the
+                // step; without one, backward(true) frees it during the pass.
+                loss->backward(); // Backpropagation
+
+                // Update model parameters
+                optimizer.step();
             }
+            arena.reset(); // The step's graph is gone, rewind the arena
         }
 
         // Print the loss for this epoch
         if (epoch % 100 == 0)
         {
-            std::cout << "Epoch " << epoch << " | Loss: " << total_loss->getData() / training_data.size() << std::endl;
+            std::cout << "Epoch " << epoch << " | Loss: " << total_loss / training_data.size() << std::endl;
         }
     }
 
-    // Validation on new data
+    // Validation on new data, inference only so no graph is built
     auto validation_data = generate_training_data(20); // Generate some validation data
-    auto validation_loss = std::make_shared<Value>(0.0);
+    double validation_loss = 0.0;
 
-    for (const auto &sample : validation_data)
+    for (long s = 0; s < validation_data.size(); s++)
     {
-        const std::vector<std::shared_ptr<Value>> &inputs = sample.first;
-        const std::vector<std::shared_ptr<Value>> &targets = sample.second;
+        std::vector<float> inputs(2), targets(1);
+        validation_data.read(s, inputs.data(), targets.data());
 
         // Forward pass
-        std::vector<std::shared_ptr<Value>> predictions = model(inputs);
+        std::vector<float> predictions = model.predict(inputs);
 
         // Compute validation loss
-        auto loss = simpleLoss(predictions, targets);
-        validation_loss = validation_loss + loss;
+        for (int i = 0; i < predictions.size(); i++)
+        {
+            double dif = predictions[i] - targets[i];
+            validation_loss += dif * dif / predictions.size();
+        }
     }
 
-    std::cout << "Validation Loss: " << validation_loss->getData() / 20. << std::endl;
+    std::cout << "Validation Loss: " << validation_loss / 20. << std::endl;
 
     return 0;
 }
@@ -0,0 +1,104 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+#include <cstddef>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator for the intermediate Values of one training step.
+// Nodes created while an ArenaScope is active are carved out of a few large
+// blocks; freeing a node only decrements the live count, and reset() rewinds
+// the whole region at once so the next step reuses the same memory.
+class GraphArena
+{
+public:
+    GraphArena(size_t blockSize = 1 << 20);
+    // Asserts that no node allocated from it is still alive
+    ~GraphArena();
+    GraphArena(const GraphArena &) = delete;
+    GraphArena &operator=(const GraphArena &) = delete;
+
+    void *allocate(size_t bytes, size_t align);
+    void deallocate(void *p, size_t bytes);
+
+    // Rewind the arena; throws if nodes allocated from it are still alive
+    void reset();
+
+    size_t live();
+    size_t used();
+    size_t capacity();
+
+    // Arena that Value::create allocates from on this thread (or nullptr)
+    static GraphArena *current();
+
+private:
+    friend class ArenaScope;
+
+    struct Block
+    {
+        char *mem;
+        size_t size;
+    };
+
+    vector<Block> blocks;
+    size_t block;
+    size_t offset;
+    size_t blockSize;
+    size_t nlive;
+    size_t nused;
+};
+
+// Routes Value::create to an arena for the lifetime of the scope
+class ArenaScope
+{
+public:
+    ArenaScope(GraphArena &arena);
+    ~ArenaScope();
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    GraphArena *previous;
+};
+
+// Standard allocator over a GraphArena; a null arena falls back to the heap
+template <class T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    ArenaAllocator(GraphArena *arena = nullptr) noexcept : arena{arena} {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena{other.arena} {}
+
+    T *allocate(size_t n)
+    {
+        if (arena)
+            return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n)
+    {
+        if (arena)
+            arena->deallocate(p, n * sizeof(T));
+        else
+            ::operator delete(p);
+    }
+
+    GraphArena *arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena == b.arena;
+}
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena != b.arena;
+}
+
+#endif
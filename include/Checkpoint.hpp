@@ -0,0 +1,85 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Binary checkpoint format, version 1 (native byte order):
+//
+//   header       64 bytes, see CheckpointHeader
+//   layer table  one CheckpointEntry per layer
+//   activations  one byte per row of every layer, padded to 64 bytes
+//   weights      one block per layer at a 64-byte aligned offset: W
+//                (nout x nin, row-major) followed by b (nout), padded
+//
+// The checksum covers everything after the header. Since blocks are
+// aligned, a mapped file can be used in place as a weight matrix.
+
+const char checkpointMagic[8] = {'M', 'G', 'R', 'A', 'D', 'C', 'K', 'P'};
+const uint32_t checkpointVersion = 1;
+// Alignment of every weight block, in bytes
+const uint64_t checkpointAlign = 64;
+
+enum class dtype : uint32_t
+{
+    f32
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint32_t layers;
+    uint32_t reserved;
+    uint64_t checksum;
+    // Size of the whole file, to detect truncation
+    uint64_t size;
+    char padding[24];
+};
+
+struct CheckpointEntry
+{
+    uint32_t nin;
+    uint32_t nout;
+    // Byte offset of the layer's weight block
+    uint64_t offset;
+};
+
+// One layer as stored: an activation per row, then W followed by b
+struct CheckpointLayer
+{
+    int nin;
+    int nout;
+    const unsigned char *acts;
+    float *params;
+};
+
+void writeCheckpoint(const string &path, const vector<CheckpointLayer> &layers);
+
+// A checkpoint mapped into memory copy-on-write: the weights are read from
+// the page cache on first use instead of being parsed, and writing to them
+// (e.g. training a model loaded in place) does not modify the file.
+class Checkpoint
+{
+public:
+    // Throws if the file is not a valid checkpoint. verify = false skips the
+    // checksum, which otherwise reads the whole file up front.
+    explicit Checkpoint(const string &path, bool verify = true);
+    // Whether the file starts like a binary checkpoint
+    static bool detect(const string &path);
+
+    int layers() const;
+    CheckpointLayer layer(int i) const;
+    // Keeps the mapping alive as long as a copy is held
+    shared_ptr<void> memory() const;
+
+private:
+    shared_ptr<void> map;
+    vector<CheckpointLayer> table;
+};
+
+#endif
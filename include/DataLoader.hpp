@@ -0,0 +1,151 @@
+#ifndef DATALOADER_HPP
+#define DATALOADER_HPP
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Samples of a fixed size: inputs() features followed by outputs() targets.
+// Samples are read by index so a loader can visit them in any order, and
+// read may be called from a background thread.
+class Dataset
+{
+public:
+    virtual ~Dataset() = default;
+    virtual long size() = 0;
+    // Sample i: inputs() values into x, outputs() values into y
+    virtual void read(long i, float *x, float *y) = 0;
+    int inputs();
+    int outputs();
+
+protected:
+    Dataset(int nin, int nout);
+
+    int nin;
+    int nout;
+};
+
+// Samples held in memory: x is n x inputs and y is n x outputs (row-major)
+class MemoryDataset : public Dataset
+{
+public:
+    MemoryDataset(vector<float> x, vector<float> y, int nin, int nout);
+    long size() override;
+    void read(long i, float *x, float *y) override;
+
+private:
+    vector<float> x;
+    vector<float> y;
+};
+
+// Raw float32 records (native byte order) of inputs followed by outputs.
+// The file is mapped read-only, so it is paged in as samples are read
+// instead of being loaded up front.
+class BinaryDataset : public Dataset
+{
+public:
+    BinaryDataset(const string &path, int nin, int nout);
+    long size() override;
+    void read(long i, float *x, float *y) override;
+    // Write n samples in this format
+    static void write(const string &path, const float *x, const float *y, long n, int nin, int nout);
+
+private:
+    shared_ptr<void> map;
+    const float *records;
+    long n;
+};
+
+// One sample per line, comma-separated, inputs followed by outputs. The
+// file is mapped and only the offset of every line is kept (8 bytes per
+// sample); a line is parsed when its sample is read. Blank lines are
+// skipped, and a malformed line throws when it is read.
+class CsvDataset : public Dataset
+{
+public:
+    CsvDataset(const string &path, int nin, int nout, bool header = false);
+    long size() override;
+    void read(long i, float *x, float *y) override;
+
+private:
+    shared_ptr<void> map;
+    const char *text;
+    long bytes;
+    vector<long> lines;
+};
+
+// n samples in contiguous buffers: x is n x inputs, y is n x outputs
+struct Batch
+{
+    const float *x;
+    const float *y;
+    int n;
+};
+
+// Mini-batches from a dataset. Every epoch visits each sample once, in an
+// order that only depends on the seed and the epoch number (or in file
+// order without shuffling); the last batch of an epoch may be short. With
+// prefetch > 0 a background thread fills up to that many batches ahead
+// while the current one is in use. The dataset must outlive the loader.
+class DataLoader
+{
+public:
+    DataLoader(Dataset &data, int batch, bool shuffle = true, unsigned seed = 0, int prefetch = 2);
+    ~DataLoader();
+    DataLoader(const DataLoader &) = delete;
+    DataLoader &operator=(const DataLoader &) = delete;
+
+    // Next batch of the current epoch, valid until the following call.
+    // Returns false at the end of an epoch, and the call after that starts
+    // the next one. Errors reading the dataset are rethrown here.
+    bool next(Batch &batch);
+    // Batches per epoch
+    long batches();
+    // Current epoch, counting from 0
+    int epoch();
+
+private:
+    // A batch, or the end of an epoch when n is 0
+    struct Slot
+    {
+        vector<float> x;
+        vector<float> y;
+        int n;
+        exception_ptr error;
+    };
+
+    // Fill slot with what comes next: a batch, or the end of the epoch
+    void produce(Slot &slot);
+    void reorder();
+    void work();
+
+    Dataset &data;
+    int batch;
+    bool shuffle;
+    unsigned seed;
+    long total;
+
+    // Producer side: the order of its epoch and the position in it
+    vector<long> order;
+    long position;
+    int producing;
+
+    int consuming;
+    // Ring of slots: head..tail-1 are filled, the consumer holds head
+    vector<Slot> slots;
+    long head;
+    long tail;
+    bool holding;
+    mutex m;
+    condition_variable filled;
+    condition_variable freed;
+    bool stop;
+    thread worker;
+};
+
+#endif
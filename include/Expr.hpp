@@ -0,0 +1,303 @@
+#ifndef EXPR_HPP
+#define EXPR_HPP
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include "ValueStruct.hpp"
+
+using namespace std;
+
+// Expression templates over Values. Arithmetic on expr(a) builds a type
+// that describes the whole expression instead of one node per operator,
+// and converting it to a shared_ptr<Value> records it as a single node
+// whose value and gradient are generated from that type at compile time:
+//
+//     shared_ptr<Value> d = square(expr(a) - b);   // one node, children a and b
+//     shared_ptr<Value> y = expr(a) * b + c;       // one node, children a, b and c
+//
+// The children are the Values of the expression in order, a Value used
+// twice being a child twice. An expression only refers to its operands, so
+// it must be converted within the statement that builds it.
+
+template <class E>
+struct Expr;
+
+// Records e as one node
+template <class E>
+shared_ptr<Value> fuse(const Expr<E> &e);
+
+template <class E>
+struct Expr
+{
+    const E &self() const
+    {
+        return static_cast<const E &>(*this);
+    }
+    operator shared_ptr<Value>() const
+    {
+        return fuse(*this);
+    }
+};
+
+// Every node of an expression has size leaves, taking x[0 ... size) in
+// eval and grad. grad adds g times the derivative of the node with
+// respect to each leaf into gx. Stateless: no constants, so one rule can
+// serve every node of the type.
+struct ExprLeaf : Expr<ExprLeaf>
+{
+    static constexpr int size = 1;
+    static constexpr bool stateless = true;
+
+    explicit ExprLeaf(const shared_ptr<Value> &v) : v{&v} {}
+    float eval(const float *x) const
+    {
+        return x[0];
+    }
+    void grad(const float *, float g, float *gx) const
+    {
+        gx[0] += g;
+    }
+    void leaves(const shared_ptr<Value> **out) const
+    {
+        out[0] = v;
+    }
+
+    // Only read while the node is recorded
+    const shared_ptr<Value> *v;
+};
+
+struct ExprConst : Expr<ExprConst>
+{
+    static constexpr int size = 0;
+    static constexpr bool stateless = false;
+
+    explicit ExprConst(float c) : c{c} {}
+    float eval(const float *) const
+    {
+        return c;
+    }
+    void grad(const float *, float, float *) const {}
+    void leaves(const shared_ptr<Value> **) const {}
+
+    float c;
+};
+
+// Rules: f(a, b) and its derivatives with respect to a and b
+struct ExprAdd
+{
+    static float f(float a, float b) { return a + b; }
+    static float da(float, float) { return 1; }
+    static float db(float, float) { return 1; }
+};
+struct ExprSub
+{
+    static float f(float a, float b) { return a - b; }
+    static float da(float, float) { return 1; }
+    static float db(float, float) { return -1; }
+};
+struct ExprMul
+{
+    static float f(float a, float b) { return a * b; }
+    static float da(float, float b) { return b; }
+    static float db(float a, float) { return a; }
+};
+struct ExprDiv
+{
+    static float f(float a, float b) { return a / b; }
+    static float da(float, float b) { return 1 / b; }
+    static float db(float a, float b) { return -a / (b * b); }
+};
+
+template <class Rule, class L, class R>
+struct ExprBinary : Expr<ExprBinary<Rule, L, R>>
+{
+    static constexpr int size = L::size + R::size;
+    static constexpr bool stateless = L::stateless && R::stateless;
+
+    ExprBinary(const L &l, const R &r) : l{l}, r{r} {}
+    float eval(const float *x) const
+    {
+        return Rule::f(l.eval(x), r.eval(x + L::size));
+    }
+    void grad(const float *x, float g, float *gx) const
+    {
+        float a = l.eval(x), b = r.eval(x + L::size);
+        l.grad(x, g * Rule::da(a, b), gx);
+        r.grad(x + L::size, g * Rule::db(a, b), gx + L::size);
+    }
+    void leaves(const shared_ptr<Value> **out) const
+    {
+        l.leaves(out);
+        r.leaves(out + L::size);
+    }
+
+    L l;
+    R r;
+};
+
+// Rules of one operand: f(a) and its derivative
+struct ExprNeg
+{
+    static float f(float a) { return -a; }
+    static float d(float) { return -1; }
+};
+struct ExprSquare
+{
+    static float f(float a) { return a * a; }
+    static float d(float a) { return 2 * a; }
+};
+
+template <class Rule, class A>
+struct ExprUnary : Expr<ExprUnary<Rule, A>>
+{
+    static constexpr int size = A::size;
+    static constexpr bool stateless = A::stateless;
+
+    explicit ExprUnary(const A &a) : a{a} {}
+    float eval(const float *x) const
+    {
+        return Rule::f(a.eval(x));
+    }
+    void grad(const float *x, float g, float *gx) const
+    {
+        a.grad(x, g * Rule::d(a.eval(x)), gx);
+    }
+    void leaves(const shared_ptr<Value> **out) const
+    {
+        a.leaves(out);
+    }
+
+    A a;
+};
+
+// a ^ p for a float p, which is kept in the node
+template <class A>
+struct ExprPow : Expr<ExprPow<A>>
+{
+    static constexpr int size = A::size;
+    static constexpr bool stateless = false;
+
+    ExprPow(const A &a, float p) : a{a}, p{p} {}
+    float eval(const float *x) const
+    {
+        return pow(a.eval(x), p);
+    }
+    void grad(const float *x, float g, float *gx) const
+    {
+        a.grad(x, g * p * pow(a.eval(x), p - 1), gx);
+    }
+    void leaves(const shared_ptr<Value> **out) const
+    {
+        a.leaves(out);
+    }
+
+    A a;
+    float p;
+};
+
+template <class E>
+class ExprNode : public ExprRule
+{
+public:
+    explicit ExprNode(const E &e) : e{e} {}
+    float forward(const float *x) const override
+    {
+        return e.eval(x);
+    }
+    void gradient(const float *x, float *gx) const override
+    {
+        fill(gx, gx + E::size, 0.0f);
+        e.grad(x, 1, gx);
+    }
+
+private:
+    E e;
+};
+
+template <class E>
+shared_ptr<Value> fuse(const Expr<E> &expression)
+{
+    static_assert(E::size > 0, "An expression needs at least one Value");
+    const E &e = expression.self();
+    array<const shared_ptr<Value> *, E::size> x;
+    e.leaves(x.data());
+    shared_ptr<ExprRule> rule;
+    if (E::stateless)
+    {
+        // The shape is all the rule uses, so the first expression serves
+        static const shared_ptr<ExprRule> shared = make_shared<ExprNode<E>>(e);
+        rule = shared;
+    }
+    else
+    {
+        rule = allocate_shared<ExprNode<E>>(ArenaAllocator<ExprNode<E>>(GraphArena::current()), e);
+    }
+    return record(rule, x.data(), E::size);
+}
+
+inline ExprLeaf expr(const shared_ptr<Value> &v)
+{
+    return ExprLeaf(v);
+}
+
+// An operand of a binary operator: an expression, a Value or a float
+template <class E>
+const E &operand(const Expr<E> &e)
+{
+    return e.self();
+}
+inline ExprLeaf operand(const shared_ptr<Value> &v)
+{
+    return ExprLeaf(v);
+}
+inline ExprConst operand(float c)
+{
+    return ExprConst(c);
+}
+
+template <class T>
+using Operand = decay_t<decltype(operand(declval<const T &>()))>;
+
+// At least one side must be an expression, so Value op Value keeps
+// building the built-in nodes
+template <class L, class R>
+using EnableExpr = enable_if_t<is_base_of<Expr<L>, L>::value || is_base_of<Expr<R>, R>::value>;
+
+template <class L, class R, class = EnableExpr<L, R>>
+ExprBinary<ExprAdd, Operand<L>, Operand<R>> operator+(const L &l, const R &r)
+{
+    return ExprBinary<ExprAdd, Operand<L>, Operand<R>>(operand(l), operand(r));
+}
+template <class L, class R, class = EnableExpr<L, R>>
+ExprBinary<ExprSub, Operand<L>, Operand<R>> operator-(const L &l, const R &r)
+{
+    return ExprBinary<ExprSub, Operand<L>, Operand<R>>(operand(l), operand(r));
+}
+template <class L, class R, class = EnableExpr<L, R>>
+ExprBinary<ExprMul, Operand<L>, Operand<R>> operator*(const L &l, const R &r)
+{
+    return ExprBinary<ExprMul, Operand<L>, Operand<R>>(operand(l), operand(r));
+}
+template <class L, class R, class = EnableExpr<L, R>>
+ExprBinary<ExprDiv, Operand<L>, Operand<R>> operator/(const L &l, const R &r)
+{
+    return ExprBinary<ExprDiv, Operand<L>, Operand<R>>(operand(l), operand(r));
+}
+
+template <class E>
+ExprUnary<ExprNeg, E> operator-(const Expr<E> &e)
+{
+    return ExprUnary<ExprNeg, E>(e.self());
+}
+template <class E>
+ExprUnary<ExprSquare, E> square(const Expr<E> &e)
+{
+    return ExprUnary<ExprSquare, E>(e.self());
+}
+template <class E>
+ExprPow<E> operator^(const Expr<E> &e, float p)
+{
+    return ExprPow<E>(e.self(), p);
+}
+
+#endif
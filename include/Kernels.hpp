@@ -0,0 +1,91 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+#include <cstdint>
+
+// Dense float kernels used by the tensor engine. Matrices are row-major.
+// Each primitive has a portable scalar version plus AVX2 and AVX-512
+// versions; the widest one the CPU supports is picked at startup.
+
+enum class isa
+{
+    scalar,
+    avx2,
+    avx512
+};
+
+// Instruction set the kernels currently run on
+isa kernelIsa();
+// Force an instruction set, e.g. to compare against the scalar reference.
+// Returns false (and changes nothing) if the CPU does not support it.
+bool setKernelIsa(isa target);
+
+float dot(const float *a, const float *b, int n);
+// y += a * x
+void axpy(float a, const float *x, float *y, int n);
+
+// Activations in place, and their gradients gz = gy * f'(y) from the outputs y
+void tanh_forward(float *y, int n);
+void relu_forward(float *y, int n);
+void tanh_backward(const float *y, const float *gy, float *gz, int n);
+void relu_backward(const float *y, const float *gy, float *gz, int n);
+
+// y = W x + b, W is rows x cols (b may be null)
+void gemv(const float *W, const float *x, const float *b, float *y, int rows, int cols);
+// x += W^T g
+void gemv_t_acc(const float *W, const float *g, float *x, int rows, int cols);
+// W += g x^T
+void ger_acc(const float *g, const float *x, float *W, int rows, int cols);
+
+// Batched versions over n samples stored as rows.
+// Y = X W^T + b, X is n x cols, W is rows x cols, Y is n x rows
+void gemm_nt(const float *X, const float *W, const float *b, float *Y, int n, int rows, int cols);
+// W += G^T X, G is n x rows
+void gemm_tn_acc(const float *G, const float *X, float *W, int n, int rows, int cols);
+// X += G W
+void gemm_nn_acc(const float *G, const float *W, float *X, int n, int rows, int cols);
+
+// Optimizer updates. Both also clear the gradient g, so a step needs no
+// separate zero_grad pass. l2 is a penalty added to the gradient.
+// v = momentum * v + g, w -= lr * v
+void sgd_update(float *w, float *g, float *v, int n, float lr, float momentum, float l2);
+
+// One Adam step: c1 and c2 are the bias corrections 1 / (1 - beta^t) of
+// step t, decay shrinks the weights directly (decoupled, as in AdamW)
+struct AdamStep
+{
+    float lr;
+    float beta1;
+    float beta2;
+    float eps;
+    float c1;
+    float c2;
+    float l2;
+    float decay;
+};
+// m and v are the moving averages of g and g^2
+void adam_update(float *w, float *g, float *m, float *v, int n, const AdamStep &s);
+
+// Storage formats for reduced precision. bf16 keeps the range of a float
+// with 8 bits of mantissa; fp16 has 11 bits of mantissa but overflows
+// above 65504 and flushes below 2^-24 (hence loss scaling).
+enum class precision
+{
+    fp32,
+    bf16,
+    fp16
+};
+// Conversions, rounding to nearest even. p must be bf16 or fp16.
+void to_half(precision p, const float *x, uint16_t *y, long n);
+void from_half(precision p, const uint16_t *x, float *y, long n);
+// gemm_nt with W stored as 16-bit values, widened in registers and
+// accumulated in float
+void gemm_nt_half(precision p, const float *X, const uint16_t *W, const float *b, float *Y, int n, int rows, int cols);
+
+// int8 inference. Quantized values are kept in [-127, 127].
+int32_t dot_i8(const int8_t *a, const int8_t *b, int n);
+// Y = X W^T in int32, X is n x cols, W is rows x cols
+void gemm_nt_i8(const int8_t *X, const int8_t *W, int32_t *Y, int n, int rows, int cols);
+// q = x * inv rounded to nearest even, saturated to [-127, 127]
+void quantize_i8(const float *x, int8_t *q, float inv, int n);
+
+#endif
@@ -7,7 +7,13 @@
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
 #include "ValueStruct.hpp"
+#include "Kernels.hpp"
+#include "Checkpoint.hpp"
 
 using namespace std;
 
@@ -18,11 +24,50 @@ enum class activation
     relu
 };
 
+enum class engine
+{
+    scalar, // a parameter Value per weight, one fused graph node per neuron
+    tensor  // contiguous weight matrix, one fused graph node per layer
+};
+
+struct HalfWeights;
+
+// Contiguous parameter values and their gradients. The values are owned,
+// used in place from a mapped checkpoint, or a slice of another storage;
+// keep holds whatever they live in alive.
+struct ParameterStorage
+{
+    ParameterStorage(long n) : owned(n, 0), grads(n, 0), data{owned.data()}, grad{grads.data()}, n{n} {}
+    ParameterStorage(float *mapped, long n, shared_ptr<void> mapping) : grads(n, 0), data{mapped}, grad{grads.data()}, n{n}, keep{mapping} {}
+    ParameterStorage(const shared_ptr<ParameterStorage> &parent, long offset, long n)
+        : data{parent->data + offset}, grad{parent->grad + offset}, n{n}, keep{parent} {}
+
+    vector<float> owned;
+    vector<float> grads;
+    float *data;
+    float *grad;
+    long n;
+    shared_ptr<void> keep;
+};
+
+// A run of n parameters stored contiguously, with their gradients
+struct ParameterBlock
+{
+    float *data;
+    float *grad;
+    long n;
+};
+
 class Module
 {
 public:
+    // Clears the gradients block by block
     void zero_grad();
-    virtual std::vector<std::shared_ptr<Value>> parameters() = 0;
+    // The same vector on every call, so iterating it does not allocate
+    virtual const vector<shared_ptr<Value>> &parameters() = 0;
+    // The parameters as contiguous blocks, in parameters() order where
+    // they are separate Values (one block each, merged when adjacent)
+    virtual vector<ParameterBlock> blocks();
 };
 
 // Class Neuron
@@ -31,48 +76,163 @@ class Neuron : public Module
 public:
     Neuron(int nin, activation act);
     Neuron(vector<float> params);
-    vector<shared_ptr<Value>> parameters();
-    shared_ptr<Value> operator()(vector<shared_ptr<Value>> x);
+    const vector<shared_ptr<Value>> &parameters();
+    shared_ptr<Value> operator()(const vector<shared_ptr<Value>> &x);
+    // Output for plain floats, without building a graph
+    float predict(const float *x);
     void save(ostream &out);
+    activation getActivation();
+    // Move the weights to w (contiguous) and the bias to b, see Value::bind
+    void bind(float *w, float *gw, float *b, float *gb, const shared_ptr<void> &keep);
 
 private:
     vector<shared_ptr<Value>> w;
     shared_ptr<Value> b;
     activation act;
+    vector<shared_ptr<Value>> params;
 };
 
 // Class LinearLayer
 class LinearLayer : public Module
 {
 public:
-    LinearLayer(int nin, int nout, activation act);
-    LinearLayer(istream &in);
-    vector<shared_ptr<Value>> operator()(vector<shared_ptr<Value>> x);
-    vector<shared_ptr<Value>> parameters();
+    LinearLayer(int nin, int nout, activation act, engine mode = engine::scalar);
+    LinearLayer(istream &in, engine mode = engine::scalar);
+    // From a checkpoint; the tensor engine uses the mapped weights in place
+    LinearLayer(const CheckpointLayer &layer, shared_ptr<void> mapping, engine mode = engine::scalar);
+    vector<shared_ptr<Value>> operator()(const vector<shared_ptr<Value>> &x);
+    // One output row per input row
+    vector<vector<shared_ptr<Value>>> operator()(const vector<vector<shared_ptr<Value>>> &x);
+    // n samples flattened row by row (n * nin values in, n * nout out)
+    vector<shared_ptr<Value>> forward(const vector<shared_ptr<Value>> &x, int n);
+    // Inference on n samples of plain floats (n x nin in, n x nout out), no graph
+    void predict(const float *x, float *y, int n);
+    const vector<shared_ptr<Value>> &parameters();
+    // Once the parameters are in one buffer (tensor engine, or bound by an
+    // MLP) they are a single block: W followed by b
+    vector<ParameterBlock> blocks();
+    // Move the parameters to flat at offset, laid out as one block, and
+    // keep using them there
+    void bind(const shared_ptr<ParameterStorage> &flat, long offset);
+    // Number of parameters
+    long size();
     void save(ostream &out);
+    // The layer in checkpoint layout, using acts and params as scratch if needed
+    CheckpointLayer checkpoint(vector<unsigned char> &acts, vector<float> &params);
+    int inputs();
+    int outputs();
+    engine getEngine();
+    // Name in profiles ("layer i" inside an MLP)
+    void setLabel(string l);
+    // Tensor engine only: keep a bf16 or fp16 copy of W for the forward
+    // pass (predict included), which halves the bytes read per product.
+    // The float weights remain the master copy that gradients and
+    // optimizers update, and accumulation stays in float. After changing
+    // the weights other than by training, set the precision again.
+    void setPrecision(precision p);
+    precision getPrecision();
 
 private:
+    void setRow(int r, const vector<float> &params);
+    void initTensor(float *mapped = nullptr, shared_ptr<void> mapping = nullptr);
+    void initParams();
+
     vector<Neuron> neurons;
     int nin;
     int nout;
+    engine mode;
+    string label;
+
+    // W (nout x nin, row-major) followed by b (nout): always for the tensor
+    // engine, for the scalar engine once bound
+    shared_ptr<ParameterStorage> storage;
+    vector<activation> acts;
+    vector<shared_ptr<Value>> params;
+    shared_ptr<FusedOp> op;
+    // 16-bit weights, null in full precision
+    shared_ptr<HalfWeights> half;
 };
 
-// Class MLP
+// Class MLP. All the parameters and gradients live in one flat buffer
+// owned by the model, each layer's block at a 64-byte aligned offset as in
+// a checkpoint (so a mapped checkpoint is used as the buffer directly).
+class QuantizedMLP;
+
 class MLP : public Module
 {
+    // Reads the layers as stored in a checkpoint
+    friend class QuantizedMLP;
+
 public:
-    MLP(int in, vector<int> l);
-    MLP(string path);
+    MLP(int in, vector<int> l, engine mode = engine::scalar);
+    // Text format, or a binary checkpoint (detected from its header)
+    MLP(string path, engine mode = engine::scalar);
+    MLP(istream &in, engine mode = engine::scalar);
+    // MLPs loaded from the same Checkpoint object share its mapped weights
+    MLP(const Checkpoint &checkpoint, engine mode = engine::scalar);
     void saveTo(string path);
+    void save(ostream &out);
+    // Binary checkpoint, see Checkpoint.hpp
+    void saveCheckpoint(string path);
+    MLP clone();
+    int inputs();
+    int outputs();
     vector<shared_ptr<Value>> operator()(vector<std::shared_ptr<Value>> input);
-    vector<shared_ptr<Value>> parameters();
+    // Batch of N samples (N x nin) to N x nout outputs
+    vector<vector<shared_ptr<Value>>> operator()(const vector<vector<shared_ptr<Value>>> &input);
+    // Activation checkpointing: with k > 0 every run of k layers is recorded
+    // as a single node that keeps only its outputs, and its intermediate
+    // activations are recomputed during backward. Memory for a step then
+    // grows with the number of segments instead of the number of layers, for
+    // about one extra forward pass. 0 (the default) keeps the whole graph.
+    // The model must outlive the graphs built in this mode.
+    void setActivationCheckpointing(int k);
+    int getActivationCheckpointing();
+    // Storage precision of every layer, see LinearLayer::setPrecision
+    void setPrecision(precision p);
+    // That of the first layer, fp32 without layers
+    precision getPrecision();
+    // Inference without building a graph: x is n x inputs, y is n x outputs.
+    // Scratch buffers are per thread and reused, so once warmed up a call
+    // does not allocate and concurrent calls are safe.
+    void predict(const float *x, float *y, int n = 1);
+    vector<float> predict(const vector<float> &x);
+    const vector<shared_ptr<Value>> &parameters();
+    // One block per layer
+    vector<ParameterBlock> blocks();
 
 private:
+    // n samples flattened row by row through every layer (or segment)
+    vector<shared_ptr<Value>> forward(const vector<shared_ptr<Value>> &x, int n);
+    void load(istream &in, engine mode);
+    void load(const Checkpoint &checkpoint, engine mode);
+    // Bind the layers to the flat buffer, which is mapped if the layers
+    // already sit in it as laid out
+    void initStorage(float *mapped = nullptr, shared_ptr<void> mapping = nullptr);
+
     vector<LinearLayer> layers;
     vector<int> size;
+    shared_ptr<ParameterStorage> storage;
+    vector<shared_ptr<Value>> params;
+    // Layers per recomputed segment, 0 when checkpointing is off
+    int segment = 0;
 };
 
 // Function declarations
+// Softmax of one sample as a single fused node
 vector<shared_ptr<Value>> softMax(vector<shared_ptr<Value>> x);
 shared_ptr<Value> simpleLoss(vector<shared_ptr<Value>> pred, vector<shared_ptr<Value>> y);
+vector<vector<shared_ptr<Value>>> softMax(const vector<vector<shared_ptr<Value>>> &x);
+shared_ptr<Value> simpleLoss(const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y);
+
+// Fused losses: a single graph node that computes the loss, and the
+// gradient of every input in one pass during backward. The batched
+// versions average over the samples.
+// Cross-entropy of softmax(logits) against target distributions (e.g. one-hot),
+// computed with log-sum-exp so that large logits stay finite
+shared_ptr<Value> crossEntropy(const vector<shared_ptr<Value>> &logits, const vector<shared_ptr<Value>> &y);
+shared_ptr<Value> crossEntropy(const vector<vector<shared_ptr<Value>>> &logits, const vector<vector<shared_ptr<Value>>> &y);
+// Mean squared error, equal to simpleLoss
+shared_ptr<Value> mseLoss(const vector<shared_ptr<Value>> &pred, const vector<shared_ptr<Value>> &y);
+shared_ptr<Value> mseLoss(const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y);
 #endif
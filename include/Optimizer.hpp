@@ -0,0 +1,124 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+#include <vector>
+#include "NN.hpp"
+
+using namespace std;
+
+// Updates the parameters of a model from their gradients. The parameters
+// are collected once as contiguous blocks (one per layer of an MLP), the
+// optimizer's state is kept in flat buffers laid out like them, and step()
+// makes one vectorized pass that updates every parameter and clears its
+// gradient, so there is no zero_grad between steps. Parameters that are
+// separate Values (a scalar-engine layer used on its own) are gathered
+// into chunks for the same kernels. The model must outlive the optimizer.
+class Optimizer
+{
+public:
+    Optimizer(Module &model, float lr);
+    virtual ~Optimizer() = default;
+
+    // Update from the current gradients, then zero them
+    void step();
+    // Zero the gradients without updating
+    void zero_grad();
+    // Multiply every gradient by f; false if any of them is not finite
+    bool scale_grad(float f);
+    // Number of parameters
+    long size();
+
+    float lr;
+
+protected:
+    // Called once at the start of every step
+    virtual void begin() {}
+    // Update n contiguous parameters whose state starts at offset
+    virtual void update(float *w, float *g, int n, long offset) = 0;
+
+private:
+    vector<ParameterBlock> blocks;
+    vector<pair<float *, float *>> scattered;
+    long total;
+    // Gather buffers for the scattered parameters
+    vector<float> gw;
+    vector<float> gg;
+};
+
+// Stochastic gradient descent with momentum (0 for plain SGD) and an
+// optional L2 penalty
+class SGD : public Optimizer
+{
+public:
+    SGD(Module &model, float lr, float momentum = 0, float weight_decay = 0);
+
+    float momentum;
+    float weight_decay;
+
+protected:
+    void update(float *w, float *g, int n, long offset) override;
+
+private:
+    vector<float> velocity;
+};
+
+// Adam. weight_decay is an L2 penalty added to the gradient
+class Adam : public Optimizer
+{
+public:
+    Adam(Module &model, float lr = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f, float weight_decay = 0);
+
+    float beta1;
+    float beta2;
+    float eps;
+    float weight_decay;
+
+protected:
+    void begin() override;
+    void update(float *w, float *g, int n, long offset) override;
+
+    // Weight decay applied directly to the weights instead (AdamW)
+    bool decoupled;
+
+private:
+    long t;
+    AdamStep current;
+    vector<float> m;
+    vector<float> v;
+};
+
+// Adam with decoupled weight decay: the weights shrink by lr * weight_decay
+// each step independently of the gradient statistics
+class AdamW : public Adam
+{
+public:
+    AdamW(Module &model, float lr = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f, float weight_decay = 1e-2f);
+};
+
+// Dynamic loss scaling for reduced-precision training. Gradients stored as
+// fp16 flush to zero below 2^-24, so the loss is multiplied by the scale
+// before backward and step() divides the gradients back before updating.
+// If any gradient overflowed, the step is skipped and the scale halved;
+// after interval steps in a row without overflow it doubles.
+//
+//     scaler.scale(loss)->backward();
+//     scaler.step();
+class LossScaler
+{
+public:
+    LossScaler(Optimizer &optimizer, float scale = 65536, int interval = 1000);
+
+    // loss * scale, to backpropagate instead of the loss
+    shared_ptr<Value> scale(const shared_ptr<Value> &loss);
+    // Unscale the gradients and step the optimizer. Returns false, having
+    // only cleared the gradients, if they were not finite.
+    bool step();
+    float getScale();
+
+private:
+    Optimizer &optimizer;
+    float current;
+    int interval;
+    int good;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include "ValueStruct.hpp"
+
+using namespace std;
+
+// Totals of one kind of event: how many, wall time, bytes
+struct ProfileStat
+{
+    long count;
+    double ms;
+    long bytes;
+};
+
+// Opt-in instrumentation of the library. While enabled, every graph node
+// records its op type, the time taken to make it and its footprint (the
+// node, its children list and, for fused nodes, its outputs); backward
+// records the time spent per op type; and named spans (backward,
+// build_topo, the forward and backward of every layer) are timed and kept
+// as trace events. Fused nodes are reported under "fused:" and the name of
+// their op. Counters are per thread and merged when read. When disabled,
+// the cost is one relaxed atomic load per operation.
+class Profiler
+{
+public:
+    static void enable(bool on = true);
+    static bool enabled()
+    {
+        return active.load(memory_order_relaxed);
+    }
+    // Clear everything recorded so far
+    static void reset();
+
+    // Start of a measurement: the current time, or 0 when disabled
+    static long start()
+    {
+        return enabled() ? now() : 0;
+    }
+    // Nanoseconds on a monotonic clock
+    static long now()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // Record a node made by op, or the backward of one, timed from start
+    static void node(Op op, long start, long bytes);
+    static void backward(Op op, long start);
+    static void fused(const char *name, long start, long bytes);
+    static void fusedBackward(const char *name, long start);
+    // Record a span, also kept as a trace event
+    static void span(const string &name, long start);
+
+    // Merged totals, keyed by op type or span name
+    static map<string, ProfileStat> nodes();
+    static map<string, ProfileStat> backwards();
+    static map<string, ProfileStat> spans();
+
+    // Human-readable tables of the totals
+    static string report();
+    // {"nodes": {...}, "backward": {...}, "spans": {...}}
+    static string json();
+    // Spans in the Chrome trace event format (chrome://tracing, Perfetto)
+    static string trace();
+    static void writeJson(const string &path);
+    static void writeTrace(const string &path);
+
+private:
+    static atomic<bool> active;
+};
+
+// Times the enclosing block as a span named name, or label + " " + what
+// (label must outlive the scope)
+class ProfileScope
+{
+public:
+    ProfileScope(const char *name) : name{name}, label{nullptr}, t{Profiler::start()} {}
+    ProfileScope(const string &label, const char *what) : name{what}, label{&label}, t{Profiler::start()} {}
+    ~ProfileScope()
+    {
+        if (t)
+        {
+            Profiler::span(label ? *label + " " + name : string(name), t);
+        }
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name;
+    const string *label;
+    long t;
+};
+
+#endif
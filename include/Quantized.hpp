@@ -0,0 +1,69 @@
+#ifndef QUANTIZED_HPP
+#define QUANTIZED_HPP
+#include "NN.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Post-training int8 quantization of an MLP, for inference only. Weights
+// are quantized per output channel (row) and the input of every layer with
+// one scale, both symmetric to [-127, 127]. The input scales are calibrated
+// on sample data: the largest magnitude each layer sees when the float model
+// runs on it. A layer then quantizes its input, computes the int8 x int8
+// products in int32, and dequantizes before adding the bias and applying the
+// activation in float. Inputs beyond the calibrated range saturate.
+class QuantizedMLP
+{
+public:
+    // calibration holds n samples (n x inputs), ideally representative of
+    // the data the model will see
+    QuantizedMLP(MLP &model, const float *calibration, int n);
+    QuantizedMLP(const Checkpoint &checkpoint, const float *calibration, int n);
+    // As MLP::predict: x is n x inputs, y is n x outputs. Scratch buffers are
+    // per thread, so concurrent calls are safe.
+    void predict(const float *x, float *y, int n = 1);
+    vector<float> predict(const vector<float> &x);
+    int inputs();
+    int outputs();
+    // Bytes of quantized weights, scales and biases
+    long bytes();
+
+private:
+    struct Layer
+    {
+        int nin;
+        int nout;
+        // nout x nin
+        vector<int8_t> W;
+        // Dequantization factor per row: input scale * weight scale
+        vector<float> scale;
+        vector<float> b;
+        vector<activation> acts;
+        // Whether every row has acts[0], so the activation runs over the whole output
+        bool uniform;
+        // 1 / input scale
+        float inv;
+    };
+
+    void init(const vector<CheckpointLayer> &source, const float *calibration, int n);
+
+    vector<Layer> layers;
+};
+
+// Accuracy of a quantized model against the float one on the same samples
+struct QuantizationReport
+{
+    int samples;
+    // Absolute error over every output
+    float maxError;
+    float meanError;
+    // Fraction of samples whose largest output is the same in both models
+    float agreement;
+
+    string str();
+};
+QuantizationReport compareQuantized(MLP &model, QuantizedMLP &quantized, const float *x, int n);
+
+#endif
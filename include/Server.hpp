@@ -0,0 +1,67 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "NN.hpp"
+
+using namespace std;
+
+struct ServerStats
+{
+    long requests;
+    long batches;
+    // Batches run because they were full rather than because the oldest
+    // request reached its deadline
+    long full;
+};
+
+// In-process batched inference. Any number of threads submit single
+// samples; worker threads coalesce them into micro-batches and run them
+// through a private read-only copy of the model with predict(), so callers
+// need no locking around the model. A batch runs as soon as it has
+// maxBatch requests, or when the oldest request has waited maxDelay.
+class InferenceServer
+{
+public:
+    // The model is copied; later changes to it are not seen by the server
+    InferenceServer(MLP &model, int maxBatch = 32, chrono::microseconds maxDelay = chrono::microseconds(1000), int workers = 1);
+    // Runs the requests still queued, then stops the workers
+    ~InferenceServer();
+    InferenceServer(const InferenceServer &) = delete;
+    InferenceServer &operator=(const InferenceServer &) = delete;
+
+    // One sample of inputs() values. The future holds the outputs, or the
+    // exception thrown while running its batch. Throws if x has the wrong
+    // size.
+    future<vector<float>> submit(vector<float> x);
+    int inputs();
+    int outputs();
+    ServerStats stats();
+
+private:
+    struct Request
+    {
+        vector<float> x;
+        promise<vector<float>> result;
+        chrono::steady_clock::time_point arrival;
+    };
+
+    void work();
+
+    MLP model;
+    int maxBatch;
+    chrono::microseconds maxDelay;
+    mutex m;
+    condition_variable ready;
+    deque<Request> queue;
+    vector<thread> workers;
+    ServerStats counts;
+    bool stop;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef TAPE_HPP
+#define TAPE_HPP
+#include "ValueStruct.hpp"
+
+// A graph compiled into a flat list of instructions over contiguous value
+// and gradient buffers. It is traced once from a graph built the usual way
+// and then replayed for new inputs, without building nodes, closures or a
+// topological order again and without allocating.
+//
+// Leaves that are not inputs (parameters, constants) are read from their
+// Value on every forward, and backward accumulates into their grad like
+// Value::backward does, so optimizers and zero_grad work unchanged. The
+// modules the parameters belong to must outlive the tape.
+class Tape
+{
+public:
+    // inputs must be leaves; they are fed in this order by forward.
+    // Throws if the graph has a node with a user-defined backward.
+    Tape(const vector<shared_ptr<Value>> &inputs, const vector<shared_ptr<Value>> &outputs);
+
+    // x holds one value per input
+    void forward(const float *x);
+    float output(int i) const;
+
+    // Backpropagate from the first output, or from all outputs given their gradients gy
+    void backward();
+    void backward(const float *gy);
+    // Gradient of input i after backward
+    float inputGrad(int i) const;
+
+    int inputs() const;
+    int outputs() const;
+    // Number of instructions and of value slots
+    int size() const;
+    int slots() const;
+
+private:
+    struct Instr
+    {
+        Op op;
+        // First output slot, operand slots (or offset and count into args
+        // for sum, fused and expr), exponent of pow
+        int out;
+        int a;
+        int b;
+        float aux;
+        // Fused op and its number of outputs
+        FusedOp *fused;
+        int m;
+        ExprRule *rule;
+    };
+
+    void run_backward();
+
+    vector<Instr> code;
+    vector<int> args;
+    vector<float> value;
+    vector<float> grad;
+    int nin;
+    vector<int> outs;
+    // Leaves read on every forward
+    vector<pair<int, shared_ptr<Value>>> bound;
+    vector<shared_ptr<FusedOp>> ops;
+    vector<shared_ptr<ExprRule>> rules;
+    // Gather buffers for the operands of fused and expr instructions
+    vector<float> fx;
+    vector<float> fgx;
+};
+
+#endif
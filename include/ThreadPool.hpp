@@ -0,0 +1,57 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads running parallel loops. The calling thread
+// takes part in the work, so a pool of size 1 runs everything inline.
+class ThreadPool
+{
+public:
+    ThreadPool(int threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size();
+    // Run f(0) ... f(tasks - 1) and wait for all of them to finish
+    void run(int tasks, const function<void(int)> &f);
+
+private:
+    void work();
+    void claim(const function<void(int)> &f);
+
+    vector<thread> workers;
+    mutex m;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int)> *job;
+    atomic<int> next;
+    atomic<int> pending;
+    int total;
+    int active;
+    unsigned long generation;
+    bool stop;
+};
+
+// Intra-op parallelism: the loops inside a single op (e.g. the rows of a
+// wide layer) split across one shared pool. Off (1 thread) by default.
+void setIntraOpThreads(int threads);
+int intraOpThreads();
+// Loops with less work (about one multiply-add per unit) stay serial
+void setIntraOpThreshold(long work);
+long intraOpThreshold();
+// Runs f(begin, end) over chunks of [0, n) whose boundaries are multiples
+// of grain. Chunks are claimed dynamically by the pool's threads, several
+// per thread, so a slow one does not hold the others back. Runs inline as
+// f(0, n) when the work is under the threshold, from inside another loop,
+// or while the pool is busy with another thread's loop.
+void parallelFor(int n, int grain, long work, const function<void(int, int)> &f);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRAINER_HPP
+#define TRAINER_HPP
+#include <functional>
+#include <memory>
+#include <vector>
+#include "NN.hpp"
+#include "ThreadPool.hpp"
+#include "Optimizer.hpp"
+
+using namespace std;
+
+// Batched loss used by the trainer: predictions and targets, one row per sample
+using BatchLoss = function<shared_ptr<Value>(const vector<vector<shared_ptr<Value>>> &, const vector<vector<shared_ptr<Value>>> &)>;
+
+// Data-parallel training of an MLP. A mini-batch is split into one shard per
+// thread; every worker builds and backpropagates the graph of its shard on a
+// private replica of the model, and the replicas' gradients are then summed
+// into the model's parameters. Replicas follow the model's precision and
+// activation checkpointing at every step.
+class DataParallelTrainer
+{
+public:
+    DataParallelTrainer(MLP &model, int threads, BatchLoss loss = nullptr);
+
+    // Batch of n samples, x is n x inputs and y is n x outputs (row-major).
+    // Sets the model's gradients to those of the mean loss and returns it.
+    float computeGradients(const float *x, const float *y, int n);
+    // computeGradients followed by a plain SGD update
+    float step(const float *x, const float *y, int n, float lr);
+    // computeGradients followed by an optimizer step (built on the model)
+    float step(const float *x, const float *y, int n, Optimizer &optimizer);
+
+    int threads();
+
+private:
+    MLP &model;
+    ThreadPool pool;
+    BatchLoss loss;
+    // The model's parameter blocks; replicas have the same layout
+    vector<ParameterBlock> blocks;
+    // Per worker: model replica (its grads are the worker's gradient
+    // buffer), its parameter blocks and an arena for the shard's graph
+    vector<MLP> replicas;
+    vector<vector<ParameterBlock>> replicaBlocks;
+    vector<unique_ptr<GraphArena>> arenas;
+    vector<float> losses;
+};
+
+#endif
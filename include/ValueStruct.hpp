@@ -1,21 +1,62 @@
 #ifndef VALUE_HPP
 #define VALUE_HPP
 #include <iostream>
-#include <set>
 #include <vector>
 #include <cmath>
 #include <functional>
 #include <memory>
+#include <string>
+#include "Arena.hpp"
 
 using namespace std;
+
+class Value;
+class FusedOp;
+class ExprRule;
+struct FusedNode;
+class Tape;
+// Children of a node; lives in the active GraphArena when there is one
+using ValueList = vector<shared_ptr<Value>, ArenaAllocator<shared_ptr<Value>>>;
+
+// Operation that produced a node, so a graph can be compiled into a Tape
+enum class Op : unsigned char
+{
+    leaf,
+    add,
+    mul,
+    pow,
+    exp,
+    log,
+    tanh,
+    relu,
+    sum,
+    // A FusedOp node, and one output of a fused node with several outputs
+    fused,
+    output,
+    // Elementwise expression of the children recorded as one node (see Expr.hpp)
+    expr,
+    // Backward set by the user through setBackward
+    custom
+};
+
 class Value : public enable_shared_from_this<Value>
 {
 public:
-    // Optional field, to help with debugging
-    string l;
-
     // Constructor
-    Value(float d, vector<shared_ptr<Value>> p = {}) : data{d}, grad{0}, prev{p}, _backward{[](shared_ptr<Value> &self) {}} {};
+    Value(float d, vector<shared_ptr<Value>> p = {}) : data{&storage[0]}, grad{&storage[1]}, storage{d, 0}, prev(p.begin(), p.end(), GraphArena::current()), op{Op::leaf}, aux{0}, mark{0}, level{0} {};
+    Value(const Value &) = delete;
+    Value &operator=(const Value &) = delete;
+
+    // Allocates from the current GraphArena if an ArenaScope is active, from the heap otherwise
+    static shared_ptr<Value> create(float d);
+    static shared_ptr<Value> create(float d, initializer_list<shared_ptr<Value>> p);
+    static shared_ptr<Value> create(float d, const vector<shared_ptr<Value>> &p);
+    // Leaf whose data and grad live in an external buffer (e.g. a layer's
+    // weight matrix), which keep holds alive for as long as the leaf
+    static shared_ptr<Value> view(float *d, float *g, shared_ptr<void> keep);
+    // Move data and grad to an external buffer, keeping their values, so
+    // the node becomes a view into it
+    void bind(float *d, float *g, shared_ptr<void> keep);
 
     // Getters and setters
     float getData();
@@ -23,14 +64,28 @@ public:
 
     void setData(float d);
     void setGrad(float g);
+    // Where data and grad live (inside the node, or an external buffer for views)
+    float *dataPtr();
+    float *gradPtr();
+
+    // Labels, to help with debugging. Operations only label their results
+    // in debug mode, since the labels grow with the depth of the graph.
+    static void setDebug(bool on);
+    static bool debug();
+    string getLabel();
+    void setLabel(string l);
 
-    vector<shared_ptr<Value>> *get_prev()
+    // Changing the children of a node that has already been backpropagated
+    // leaves a stale order cached on it (see backward)
+    ValueList *get_prev()
     {
         return &prev;
     };
 
     // Friend methods
-    friend void build_topo(const shared_ptr<Value> &v, vector<shared_ptr<Value>> &topo, set<shared_ptr<Value>> &visited);
+    friend void build_topo(Value *root, vector<Value *> &topo);
+    // One order over the nodes reachable from any of the roots
+    friend void build_topo(const vector<Value *> &roots, vector<Value *> &topo);
     friend shared_ptr<Value> min(const shared_ptr<Value> &a, const shared_ptr<Value> &b);
     friend shared_ptr<Value> max(const shared_ptr<Value> &a, const shared_ptr<Value> &b);
 
@@ -46,16 +101,198 @@ public:
     friend shared_ptr<Value> exp(const shared_ptr<Value> &v);
     friend shared_ptr<Value> log(const shared_ptr<Value> &v);
     friend ostream &operator<<(ostream &out, Value &v);
+    friend vector<shared_ptr<Value>> apply(const shared_ptr<FusedOp> &op, const vector<shared_ptr<Value>> &x, int m);
+    friend void backward(const vector<shared_ptr<Value>> &roots, const float *seeds, bool release);
+    friend shared_ptr<Value> record(const shared_ptr<ExprRule> &rule, const shared_ptr<Value> *const *x, int n);
+    friend class Tape;
+    friend class Derivatives;
+
+    // Functional. A node with a custom backward is slower to backpropagate
+    // than the built-in operations and cannot be compiled into a Tape.
+    void setBackward(function<void(Value *self)> funct);
+    // The topological order is cached on the node, so backpropagating the
+    // same graph again skips the sort. A release anywhere drops every cached
+    // order, since it may have freed nodes they share. With intra-op threads (see
+    // ThreadPool.hpp) a large graph is backpropagated level by level, the
+    // independent nodes of a level concurrently.
+    //
+    // With release, every node drops its children and its op's state as
+    // soon as its gradient has been passed on, so the graph is freed during
+    // the pass instead of when the last reference to the root goes. Nodes
+    // still referenced elsewhere survive as leaves, and the graph cannot be
+    // backpropagated again.
+    void backward(bool release = false);
+    // A new leaf with this node's value, outside any graph and any arena
+    // (e.g. to accumulate a metric without chaining graphs together)
+    shared_ptr<Value> detach();
+
+private:
+    // A cached topological order, valid while no backward has released
+    // nodes since it was sorted
+    struct Order
+    {
+        vector<Value *> nodes;
+        unsigned int epoch;
+    };
+    // Gradient of the children from the gradient of this node, by op.
+    // Shared: other nodes may be adding to the same children concurrently.
+    template <bool shared = false>
+    void _backward();
+    // Run the backward of every node of a topological order, last first,
+    // releasing each node after it if asked
+    static void backpropagate(const vector<Value *> &order, bool release = false);
+    // Drop the children and op state, leaving a leaf
+    void release();
+    // Node of op over p, or a plain leaf under a NoGradScope
+    static shared_ptr<Value> node(float d, Op op, initializer_list<shared_ptr<Value>> p);
+    static shared_ptr<Value> node(float d, Op op, const vector<shared_ptr<Value>> &p);
+    // Report this node to the Profiler, made in the time since start
+    void profile(long start);
+
+    // Point at storage, or into an external buffer for views
+    float *data;
+    float *grad;
+    float storage[2];
+    ValueList prev;
+    Op op;
+    union
+    {
+        // Output number of an Op::output node, exponent of an Op::pow node
+        int index;
+        float aux;
+    };
+    // Epoch of the last topological sort that visited this node
+    unsigned int mark;
+    // Longest path from the root during a parallel backward (fills padding)
+    int level;
+    // FusedNode of an Op::fused node, ExprRule of an Op::expr node, backward
+    // function of an Op::custom one, buffer of a view
+    shared_ptr<void> ctx;
+    unique_ptr<string> label;
+    unique_ptr<Order> topo;
+};
+
+// An operation that maps n inputs to m outputs in one kernel call and is
+// recorded as a single graph node, instead of one node per scalar operation.
+// Implementations may keep parameters of their own (e.g. a weight matrix)
+// and accumulate their gradients during backward.
+class FusedOp
+{
+public:
+    virtual ~FusedOp() = default;
+    virtual void forward(const float *x, int n, float *y, int m) = 0;
+    // Accumulate into gx the gradient of the inputs given gy for the outputs
+    virtual void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) = 0;
+    // As backward, but only the gradient of the inputs, for Derivatives.
+    // The default calls backward, so ops that accumulate state of their own
+    // there (e.g. weight gradients) must override it.
+    virtual void vjp(const float *x, int n, const float *y, const float *gy, int m, float *gx);
+    // Forward mode: dy = J dx, the tangent of the outputs for a tangent dx
+    // of the inputs. The default builds J from vjp, one output at a time.
+    virtual void jvp(const float *x, int n, const float *y, const float *dx, int m, float *dy);
+    // Reported by the Profiler
+    virtual const char *name()
+    {
+        return "fused";
+    }
+};
 
-    // Functional
-    void setBackward(function<void(shared_ptr<Value> &self)> funct);
-    void backward();
+// Per-node state of a fused operation: its outputs and their gradients
+struct FusedNode
+{
+    FusedNode(const shared_ptr<FusedOp> &op, int m, ArenaAllocator<float> alloc) : op{op}, y(m, 0, alloc), gy(m, 0, alloc) {}
+
+    shared_ptr<FusedOp> op;
+    vector<float, ArenaAllocator<float>> y;
+    vector<float, ArenaAllocator<float>> gy;
+};
+
+// Value and local gradient of a composite elementwise expression of n
+// inputs, recorded as a single Op::expr node. Unlike a FusedOp it has no
+// state of its own, so its nodes backpropagate like the built-in ops.
+class ExprRule
+{
+public:
+    virtual ~ExprRule() = default;
+    virtual float forward(const float *x) const = 0;
+    // gx[i] = d forward / d x[i]
+    virtual void gradient(const float *x, float *gx) const = 0;
+};
+
+// Record rule applied to the values *x[0] ... *x[n - 1] as one node
+shared_ptr<Value> record(const shared_ptr<ExprRule> &rule, const shared_ptr<Value> *const *x, int n);
+
+// Backpropagate from several roots at once, adding seeds[i] to the gradient
+// of roots[i] first (the gradient of some scalar with respect to them).
+// Unlike Value::backward the order is not cached. release as in Value::backward.
+void backward(const vector<shared_ptr<Value>> &roots, const float *seeds, bool release = false);
+
+// While one is alive, operations on this thread record plain leaves with
+// their values and no graph, for inference and metrics. Scopes nest.
+class NoGradScope
+{
+public:
+    NoGradScope();
+    ~NoGradScope();
+    NoGradScope(const NoGradScope &) = delete;
+    NoGradScope &operator=(const NoGradScope &) = delete;
 
 private:
-    float data;
-    float grad;
-    vector<shared_ptr<Value>> prev;
-    function<void(shared_ptr<Value> &self)> _backward;
+    bool previous;
 };
+// False under a NoGradScope
+bool gradEnabled();
+
+// Derivatives of the outputs of a built graph with respect to some of its
+// leaves. The graph is sorted once, and every call reuses the order, so a
+// Jacobian costs one pass over the graph per batch of k seeds instead of a
+// sort and a backward per output. Values are read from the nodes on every
+// call, so the graph must keep its shape after construction.
+class Derivatives
+{
+public:
+    Derivatives(const vector<shared_ptr<Value>> &inputs, const vector<shared_ptr<Value>> &outputs);
+
+    // Forward mode (JVP): dx holds k tangents of the inputs (k x inputs),
+    // dy gets J dx for each (k x outputs). Throws if the graph has a node
+    // with a user-defined backward, which has no forward derivative.
+    void jvp(const float *dx, int k, float *dy);
+    // Reverse mode (VJP): gy holds k cotangents of the outputs (k x
+    // outputs), gx gets gy J for each (k x inputs). Node gradients, and the
+    // weight gradients of fused layers, are left as they were.
+    void vjp(const float *gy, int k, float *gx);
+    // outputs x inputs, in forward mode if there are fewer inputs than outputs
+    vector<float> jacobian();
+
+    int inputs() const;
+    int outputs() const;
+
+private:
+    // Derivative of a built-in op's node with respect to its i-th child
+    static float partial(Value *v, int i);
+    // For an Op::expr node, all of them into gx at once (x gets its inputs)
+    static void local(Value *v, vector<float> &x, vector<float> &gx);
+
+    vector<shared_ptr<Value>> roots;
+    vector<Value *> order;
+    // Children of order[i] as positions: child[childStart[i] ... childStart[i + 1])
+    vector<int> childStart;
+    vector<int> child;
+    // Positions of the inputs (-1 for one the outputs do not depend on) and outputs
+    vector<int> in;
+    vector<int> out;
+    // Per node: offset of its fused node's outputs in the k x fusedWidth
+    // buffer (for fused nodes and their output handles), -1 otherwise
+    vector<int> fusedAt;
+    int fusedWidth;
+    bool custom;
+    // Tangents or gradients, k per node, and per fused output
+    vector<float> d;
+    vector<float> fused;
+};
+
+// Record op applied to x. With m == 1 the node itself is returned, otherwise
+// one lightweight handle per output that forwards its gradient to the node.
+vector<shared_ptr<Value>> apply(const shared_ptr<FusedOp> &op, const vector<shared_ptr<Value>> &x, int m);
 
 #endif
\ No newline at end of file
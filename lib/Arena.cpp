@@ -0,0 +1,102 @@
+#include "../include/Arena.hpp"
+#include <cassert>
+#include <stdexcept>
+
+static thread_local GraphArena *active = nullptr;
+
+GraphArena::GraphArena(size_t blockSize) : block{0}, offset{0}, blockSize{blockSize}, nlive{0}, nused{0}
+{
+}
+GraphArena::~GraphArena()
+{
+    // As in reset, but a destructor cannot throw: nodes still alive would
+    // be left pointing into freed blocks
+    assert(nlive == 0 && "GraphArena destroyed while graph nodes are still alive");
+    for (auto &b : blocks)
+    {
+        ::operator delete(b.mem);
+    }
+}
+
+void *GraphArena::allocate(size_t bytes, size_t align)
+{
+    while (block < blocks.size())
+    {
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + bytes <= blocks[block].size)
+        {
+            offset = start + bytes;
+            nlive++;
+            nused += bytes;
+            return blocks[block].mem + start;
+        }
+        block++;
+        offset = 0;
+    }
+    size_t size = bytes > blockSize ? bytes : blockSize;
+    blocks.push_back({static_cast<char *>(::operator new(size)), size});
+    block = blocks.size() - 1;
+    offset = bytes;
+    nlive++;
+    nused += bytes;
+    return blocks[block].mem;
+}
+void GraphArena::deallocate(void *p, size_t bytes)
+{
+    nlive--;
+}
+
+void GraphArena::reset()
+{
+    if (nlive != 0)
+    {
+        throw runtime_error("GraphArena reset while graph nodes are still alive");
+    }
+    // Merge a step that spilled over several blocks into one, so the
+    // steady state is a single block with no growth
+    if (blocks.size() > 1)
+    {
+        size_t total = 0;
+        for (auto &b : blocks)
+        {
+            total += b.size;
+            ::operator delete(b.mem);
+        }
+        blocks = {{static_cast<char *>(::operator new(total)), total}};
+    }
+    block = 0;
+    offset = 0;
+    nused = 0;
+}
+
+size_t GraphArena::live()
+{
+    return nlive;
+}
+size_t GraphArena::used()
+{
+    return nused;
+}
+size_t GraphArena::capacity()
+{
+    size_t total = 0;
+    for (auto &b : blocks)
+    {
+        total += b.size;
+    }
+    return total;
+}
+
+GraphArena *GraphArena::current()
+{
+    return active;
+}
+
+ArenaScope::ArenaScope(GraphArena &arena) : previous{active}
+{
+    active = &arena;
+}
+ArenaScope::~ArenaScope()
+{
+    active = previous;
+}
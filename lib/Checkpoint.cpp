@@ -0,0 +1,230 @@
+#include "../include/Checkpoint.hpp"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header must be 64 bytes");
+static_assert(sizeof(CheckpointEntry) == 16, "checkpoint table entry must be 16 bytes");
+
+static uint64_t align(uint64_t n)
+{
+    return (n + checkpointAlign - 1) / checkpointAlign * checkpointAlign;
+}
+
+// FNV-1a over 64-bit words, fed in pieces of any size. Every section of
+// the format is padded to a multiple of 8 bytes, so hashing the file in
+// one piece gives the same value.
+class Hasher
+{
+public:
+    void add(const void *p, uint64_t n)
+    {
+        const char *c = (const char *)p;
+        while (n > 0 && fill > 0 && fill < 8)
+        {
+            word[fill++] = *c++;
+            n--;
+        }
+        if (fill == 8)
+        {
+            mix(word);
+            fill = 0;
+        }
+        for (; n >= 8; n -= 8, c += 8)
+        {
+            mix(c);
+        }
+        for (; n > 0; n--)
+        {
+            word[fill++] = *c++;
+        }
+    }
+    uint64_t value() const
+    {
+        return h;
+    }
+
+private:
+    void mix(const char *c)
+    {
+        uint64_t w;
+        memcpy(&w, c, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+
+    uint64_t h = 14695981039346656037ULL;
+    char word[8];
+    int fill = 0;
+};
+
+void writeCheckpoint(const string &path, const vector<CheckpointLayer> &layers)
+{
+    // Table and activations first, with every offset known in advance
+    uint64_t rows = 0;
+    for (auto &l : layers)
+    {
+        rows += l.nout;
+    }
+    uint64_t tableSize = layers.size() * sizeof(CheckpointEntry);
+    uint64_t offset = align(sizeof(CheckpointHeader) + tableSize + rows);
+
+    vector<char> meta(offset - sizeof(CheckpointHeader), 0);
+    char *acts = meta.data() + tableSize;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        auto &l = layers[i];
+        CheckpointEntry e{uint32_t(l.nin), uint32_t(l.nout), offset};
+        memcpy(meta.data() + i * sizeof(CheckpointEntry), &e, sizeof(e));
+        memcpy(acts, l.acts, l.nout);
+        acts += l.nout;
+        offset += align(uint64_t(l.nout) * (l.nin + 1) * sizeof(float));
+    }
+
+    CheckpointHeader header{};
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.type = uint32_t(dtype::f32);
+    header.layers = layers.size();
+    header.size = offset;
+    Hasher hash;
+    hash.add(meta.data(), meta.size());
+
+    ofstream file(path, ios::out | ios::trunc | ios::binary);
+    if (!file.is_open())
+    {
+        throw runtime_error("Cannot open " + path);
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write(meta.data(), meta.size());
+
+    static const char zeros[checkpointAlign] = {};
+    for (auto &l : layers)
+    {
+        uint64_t bytes = uint64_t(l.nout) * (l.nin + 1) * sizeof(float);
+        uint64_t pad = align(bytes) - bytes;
+        file.write((const char *)l.params, bytes);
+        file.write(zeros, pad);
+        hash.add(l.params, bytes);
+        hash.add(zeros, pad);
+    }
+
+    // The checksum goes in last, over the header written with it at zero
+    header.checksum = hash.value();
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+    if (!file)
+    {
+        throw runtime_error("Error writing " + path);
+    }
+}
+
+bool Checkpoint::detect(const string &path)
+{
+    ifstream file(path, ios::binary);
+    char magic[sizeof(checkpointMagic)];
+    return file.read(magic, sizeof(magic)) && memcmp(magic, checkpointMagic, sizeof(magic)) == 0;
+}
+
+Checkpoint::Checkpoint(const string &path, bool verify)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CheckpointHeader))
+    {
+        close(fd);
+        throw runtime_error("Not a checkpoint: " + path);
+    }
+    uint64_t size = st.st_size;
+    // Private and writable, so in-place training copies the pages it touches
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        throw runtime_error("Cannot map " + path);
+    }
+    map = shared_ptr<void>(p, [size](void *p)
+                           { munmap(p, size); });
+
+    char *base = (char *)p;
+    CheckpointHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0)
+    {
+        throw runtime_error("Not a checkpoint: " + path);
+    }
+    if (header.version != checkpointVersion)
+    {
+        throw runtime_error("Unsupported checkpoint version " + to_string(header.version));
+    }
+    if (header.type != uint32_t(dtype::f32))
+    {
+        throw runtime_error("Unsupported checkpoint dtype " + to_string(header.type));
+    }
+    if (header.size != size || sizeof(CheckpointHeader) + uint64_t(header.layers) * sizeof(CheckpointEntry) > size)
+    {
+        throw runtime_error("Truncated checkpoint: " + path);
+    }
+    if (verify)
+    {
+        Hasher hash;
+        hash.add(base + sizeof(header), size - sizeof(header));
+        if (hash.value() != header.checksum)
+        {
+            throw runtime_error("Checkpoint checksum mismatch: " + path);
+        }
+    }
+
+    const char *entries = base + sizeof(header);
+    const unsigned char *acts = (const unsigned char *)(entries + header.layers * sizeof(CheckpointEntry));
+    // Weight blocks follow the header, table and activations in order, and
+    // every layer takes the previous one's outputs as inputs
+    uint64_t next = (const char *)acts - base;
+    for (uint32_t i = 0; i < header.layers; i++)
+    {
+        CheckpointEntry e;
+        memcpy(&e, entries + i * sizeof(e), sizeof(e));
+        next += e.nout;
+    }
+    for (uint32_t i = 0; i < header.layers; i++)
+    {
+        CheckpointEntry e;
+        memcpy(&e, entries + i * sizeof(e), sizeof(e));
+        uint64_t bytes = uint64_t(e.nout) * (e.nin + 1) * sizeof(float);
+        if (e.offset % checkpointAlign != 0 || e.offset < next || bytes > size || e.offset > size - bytes ||
+            (const char *)acts + e.nout > base + size)
+        {
+            throw runtime_error("Corrupt checkpoint layer table: " + path);
+        }
+        if (i > 0 && e.nin != uint32_t(table.back().nout))
+        {
+            throw runtime_error("Checkpoint layer " + to_string(i) + " does not take the previous layer's outputs: " + path);
+        }
+        table.push_back({int(e.nin), int(e.nout), acts, (float *)(base + e.offset)});
+        acts += e.nout;
+        next = e.offset + bytes;
+    }
+}
+
+int Checkpoint::layers() const
+{
+    return table.size();
+}
+
+CheckpointLayer Checkpoint::layer(int i) const
+{
+    return table.at(i);
+}
+
+shared_ptr<void> Checkpoint::memory() const
+{
+    return map;
+}
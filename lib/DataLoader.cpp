@@ -0,0 +1,313 @@
+#include "../include/DataLoader.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// Map a whole file read-only; an empty file has no mapping
+static shared_ptr<void> mapFile(const string &path, long &bytes)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw runtime_error("Cannot read " + path);
+    }
+    bytes = st.st_size;
+    if (bytes == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        throw runtime_error("Cannot map " + path);
+    }
+    long size = bytes;
+    return shared_ptr<void>(p, [size](void *p)
+                            { munmap(p, size); });
+}
+
+Dataset::Dataset(int nin, int nout) : nin{nin}, nout{nout} {}
+
+int Dataset::inputs()
+{
+    return nin;
+}
+int Dataset::outputs()
+{
+    return nout;
+}
+
+MemoryDataset::MemoryDataset(vector<float> x, vector<float> y, int nin, int nout) : Dataset(nin, nout), x{move(x)}, y{move(y)}
+{
+    if ((long)this->x.size() * nout != (long)this->y.size() * nin)
+    {
+        throw runtime_error("Inputs and outputs hold a different number of samples");
+    }
+}
+long MemoryDataset::size()
+{
+    return nin ? x.size() / nin : y.size() / nout;
+}
+void MemoryDataset::read(long i, float *xs, float *ys)
+{
+    copy(x.begin() + i * nin, x.begin() + (i + 1) * nin, xs);
+    copy(y.begin() + i * nout, y.begin() + (i + 1) * nout, ys);
+}
+
+BinaryDataset::BinaryDataset(const string &path, int nin, int nout) : Dataset(nin, nout), records{nullptr}, n{0}
+{
+    long bytes;
+    map = mapFile(path, bytes);
+    long record = (long)(nin + nout) * sizeof(float);
+    if (bytes % record != 0)
+    {
+        throw runtime_error("Size of " + path + " is not a whole number of samples");
+    }
+    records = (const float *)map.get();
+    n = bytes / record;
+}
+long BinaryDataset::size()
+{
+    return n;
+}
+void BinaryDataset::read(long i, float *x, float *y)
+{
+    const float *r = records + i * (nin + nout);
+    memcpy(x, r, nin * sizeof(float));
+    memcpy(y, r + nin, nout * sizeof(float));
+}
+void BinaryDataset::write(const string &path, const float *x, const float *y, long n, int nin, int nout)
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    for (long i = 0; i < n; i++)
+    {
+        file.write((const char *)(x + i * nin), nin * sizeof(float));
+        file.write((const char *)(y + i * nout), nout * sizeof(float));
+    }
+    if (!file)
+    {
+        throw runtime_error("Error writing " + path);
+    }
+}
+
+static bool blank(const char *begin, const char *end)
+{
+    return all_of(begin, end, [](char c)
+                  { return c == ' ' || c == '\t' || c == '\r'; });
+}
+
+CsvDataset::CsvDataset(const string &path, int nin, int nout, bool header) : Dataset(nin, nout), text{nullptr}, bytes{0}
+{
+    map = mapFile(path, bytes);
+    text = (const char *)map.get();
+    bool skip = header;
+    for (long pos = 0; pos < bytes;)
+    {
+        const char *nl = (const char *)memchr(text + pos, '\n', bytes - pos);
+        long end = nl ? nl - text : bytes;
+        if (skip)
+        {
+            skip = false;
+        }
+        else if (!blank(text + pos, text + end))
+        {
+            lines.push_back(pos);
+        }
+        pos = end + 1;
+    }
+}
+long CsvDataset::size()
+{
+    return lines.size();
+}
+// Parsed straight from the mapping, from_chars needs no terminated string
+void CsvDataset::read(long i, float *x, float *y)
+{
+    const char *p = text + lines[i];
+    const char *nl = (const char *)memchr(p, '\n', bytes - lines[i]);
+    const char *end = nl ? nl : text + bytes;
+    auto space = [&]()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+    };
+    for (int k = 0; k < nin + nout; k++)
+    {
+        space();
+        float v;
+        auto r = from_chars(p, end, v);
+        if (r.ec != errc())
+        {
+            throw runtime_error("Malformed CSV sample " + to_string(i));
+        }
+        (k < nin ? x[k] : y[k - nin]) = v;
+        p = r.ptr;
+        space();
+        if (k + 1 < nin + nout && (p == end || *p++ != ','))
+        {
+            throw runtime_error("Malformed CSV sample " + to_string(i));
+        }
+    }
+    if (p != end)
+    {
+        throw runtime_error("Malformed CSV sample " + to_string(i));
+    }
+}
+
+DataLoader::DataLoader(Dataset &data, int batch, bool shuffle, unsigned seed, int prefetch)
+    : data{data}, batch{batch}, shuffle{shuffle}, seed{seed}, total{data.size()}, position{0}, producing{0}, consuming{0},
+      slots(max(prefetch, 0) + 1), head{0}, tail{0}, holding{false}, stop{false}
+{
+    if (batch <= 0)
+    {
+        throw runtime_error("Batch size must be positive");
+    }
+    for (auto &s : slots)
+    {
+        s.x.resize((long)batch * data.inputs());
+        s.y.resize((long)batch * data.outputs());
+        s.n = 0;
+    }
+    reorder();
+    if (prefetch > 0)
+    {
+        worker = thread([this]()
+                        { work(); });
+    }
+}
+DataLoader::~DataLoader()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stop = true;
+    }
+    freed.notify_all();
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+long DataLoader::batches()
+{
+    return (total + batch - 1) / batch;
+}
+int DataLoader::epoch()
+{
+    return consuming;
+}
+
+// The order of an epoch is seeded by the seed and the epoch number alone,
+// so it does not depend on how far ahead batches are prefetched
+void DataLoader::reorder()
+{
+    if (!shuffle)
+    {
+        return;
+    }
+    order.resize(total);
+    iota(order.begin(), order.end(), 0L);
+    seed_seq s{seed, unsigned(producing)};
+    mt19937 rng(s);
+    std::shuffle(order.begin(), order.end(), rng);
+}
+
+void DataLoader::produce(Slot &slot)
+{
+    slot.n = 0;
+    slot.error = nullptr;
+    if (position == total)
+    {
+        producing++;
+        position = 0;
+        reorder();
+        return;
+    }
+    int n = min<long>(batch, total - position);
+    try
+    {
+        for (int k = 0; k < n; k++)
+        {
+            long i = shuffle ? order[position + k] : position + k;
+            data.read(i, slot.x.data() + (long)k * data.inputs(), slot.y.data() + (long)k * data.outputs());
+        }
+        slot.n = n;
+    }
+    catch (...)
+    {
+        slot.error = current_exception();
+    }
+    position += n;
+}
+
+void DataLoader::work()
+{
+    unique_lock<mutex> lock(m);
+    while (true)
+    {
+        freed.wait(lock, [this]()
+                   { return stop || tail - head < (long)slots.size(); });
+        if (stop)
+        {
+            return;
+        }
+        Slot &slot = slots[tail % slots.size()];
+        lock.unlock();
+        produce(slot);
+        lock.lock();
+        tail++;
+        filled.notify_one();
+    }
+}
+
+bool DataLoader::next(Batch &out)
+{
+    Slot *slot = &slots[0];
+    if (!worker.joinable())
+    {
+        produce(*slot);
+    }
+    else
+    {
+        unique_lock<mutex> lock(m);
+        if (holding)
+        {
+            head++;
+            holding = false;
+            freed.notify_one();
+        }
+        filled.wait(lock, [this]()
+                    { return tail > head; });
+        slot = &slots[head % slots.size()];
+        holding = true;
+    }
+    if (slot->error)
+    {
+        rethrow_exception(slot->error);
+    }
+    if (slot->n == 0)
+    {
+        consuming++;
+        out = {nullptr, nullptr, 0};
+        return false;
+    }
+    out = {slot->x.data(), slot->y.data(), slot->n};
+    return true;
+}
@@ -0,0 +1,1143 @@
+#include "../include/Kernels.hpp"
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Portable reference versions
+
+static float dot_scalar(const float *a, const float *b, int n)
+{
+    float s = 0;
+    for (int i = 0; i < n; i++)
+    {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+// Four dot products sharing b, so b is read once
+static void dot4_scalar(const float *a0, const float *a1, const float *a2, const float *a3, const float *b, int n, float *out)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < n; i++)
+    {
+        s0 += a0[i] * b[i];
+        s1 += a1[i] * b[i];
+        s2 += a2[i] * b[i];
+        s3 += a3[i] * b[i];
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+static void axpy_scalar(float a, const float *x, float *y, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        y[i] += a * x[i];
+    }
+}
+static void tanh_scalar(float *y, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        y[i] = std::tanh(y[i]);
+    }
+}
+static void relu_scalar(float *y, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        y[i] = (y[i] + std::abs(y[i])) / 2;
+    }
+}
+static void tanh_grad_scalar(const float *y, const float *gy, float *gz, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        gz[i] = gy[i] * (1 - y[i] * y[i]);
+    }
+}
+static void relu_grad_scalar(const float *y, const float *gy, float *gz, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        gz[i] = y[i] > 0 ? gy[i] : 0;
+    }
+}
+
+static void sgd_scalar(float *w, float *g, float *v, int n, float lr, float momentum, float l2)
+{
+    for (int i = 0; i < n; i++)
+    {
+        v[i] = momentum * v[i] + (g[i] + l2 * w[i]);
+        w[i] -= lr * v[i];
+        g[i] = 0;
+    }
+}
+static void adam_scalar(float *w, float *g, float *m, float *v, int n, const AdamStep &s)
+{
+    for (int i = 0; i < n; i++)
+    {
+        float d = g[i] + s.l2 * w[i];
+        m[i] = s.beta1 * m[i] + (1 - s.beta1) * d;
+        v[i] = s.beta2 * v[i] + (1 - s.beta2) * d * d;
+        w[i] -= s.lr * (s.c1 * m[i] / (std::sqrt(s.c2 * v[i]) + s.eps) + s.decay * w[i]);
+        g[i] = 0;
+    }
+}
+
+// 16-bit formats. bf16 is the upper half of a float, rounded to nearest
+// even with NaNs kept quiet; fp16 is IEEE half precision, which overflows
+// to infinity above 65504 and has subnormals down to 2^-24.
+static float bf16_to_float(uint16_t h)
+{
+    uint32_t bits = uint32_t(h) << 16;
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+static uint16_t float_to_bf16(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    if ((bits & 0x7FFFFFFF) > 0x7F800000)
+    {
+        return (bits >> 16) | 0x40;
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+static float fp16_to_float(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t bits;
+    if (exp == 0x1F)
+    {
+        bits = sign | 0x7F800000 | (mant << 13);
+    }
+    else if (exp)
+    {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    else
+    {
+        // Zero or subnormal: mant * 2^-24
+        float f = mant * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+static uint16_t float_to_fp16(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7FFFFFFF;
+    if (abs >= 0x7F800000)
+    {
+        return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+    }
+    // 65520 and up round to infinity
+    if (abs >= 0x477FF000)
+    {
+        return sign | 0x7C00;
+    }
+    // Below 2^-14: a multiple of 2^-24, exact after the scaling
+    if (abs < 0x38800000)
+    {
+        float a;
+        memcpy(&a, &abs, 4);
+        return sign | uint16_t(std::nearbyint(a * 16777216.0f));
+    }
+    // Rebias the exponent, round the mantissa from 23 to 10 bits (a carry
+    // moves into the exponent)
+    uint32_t h = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    {
+        h++;
+    }
+    return sign | h;
+}
+static float half_to_float(precision p, uint16_t h)
+{
+    return p == precision::fp16 ? fp16_to_float(h) : bf16_to_float(h);
+}
+
+static void to_half_scalar(precision p, const float *x, uint16_t *y, long n)
+{
+    for (long i = 0; i < n; i++)
+    {
+        y[i] = p == precision::fp16 ? float_to_fp16(x[i]) : float_to_bf16(x[i]);
+    }
+}
+static void from_half_scalar(precision p, const uint16_t *x, float *y, long n)
+{
+    for (long i = 0; i < n; i++)
+    {
+        y[i] = half_to_float(p, x[i]);
+    }
+}
+static float dot_half_scalar(precision p, const uint16_t *w, const float *x, int n)
+{
+    float s = 0;
+    for (int i = 0; i < n; i++)
+    {
+        s += half_to_float(p, w[i]) * x[i];
+    }
+    return s;
+}
+static void dot4_half_scalar(precision p, const float *x0, const float *x1, const float *x2, const float *x3, const uint16_t *w, int n, float *out)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < n; i++)
+    {
+        float v = half_to_float(p, w[i]);
+        s0 += x0[i] * v;
+        s1 += x1[i] * v;
+        s2 += x2[i] * v;
+        s3 += x3[i] * v;
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+// int8 values are kept in [-127, 127] so that a product and its negation
+// are both representable
+static int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int n)
+{
+    int32_t s = 0;
+    for (int i = 0; i < n; i++)
+    {
+        s += int32_t(a[i]) * b[i];
+    }
+    return s;
+}
+// out[k] = w . xk, so one weight row serves four samples
+static void dot4_i8_scalar(const int8_t *x0, const int8_t *x1, const int8_t *x2, const int8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    out[0] = dot_i8_scalar(w, x0, n);
+    out[1] = dot_i8_scalar(w, x1, n);
+    out[2] = dot_i8_scalar(w, x2, n);
+    out[3] = dot_i8_scalar(w, x3, n);
+}
+static void quantize_i8_scalar(const float *x, int8_t *q, float inv, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        float v = std::nearbyint(x[i] * inv);
+        q[i] = int8_t(v > 127 ? 127 : v < -127 ? -127 : v);
+    }
+}
+
+#ifdef KERNELS_X86
+
+// Cephes-style exp: range reduction to [-ln2/2, ln2/2] and a degree 5
+// polynomial, accurate to a couple of ulp over the clamped range
+__attribute__((target("avx2,fma"))) static __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f)), _mm256_set1_ps(88.3762626647949f));
+    __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma"))) static float hsum_avx2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma"))) static float dot_avx2(const float *a, const float *b, int n)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    }
+    float s = hsum_avx2(_mm256_add_ps(s0, s1));
+    for (; i < n; i++)
+    {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+__attribute__((target("avx2,fma"))) static void dot4_avx2(const float *a0, const float *a1, const float *a2, const float *a3, const float *b, int n, float *out)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(b + i);
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + i), v, s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + i), v, s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + i), v, s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + i), v, s3);
+    }
+    out[0] = hsum_avx2(s0);
+    out[1] = hsum_avx2(s1);
+    out[2] = hsum_avx2(s2);
+    out[3] = hsum_avx2(s3);
+    for (; i < n; i++)
+    {
+        out[0] += a0[i] * b[i];
+        out[1] += a1[i] * b[i];
+        out[2] += a2[i] * b[i];
+        out[3] += a3[i] * b[i];
+    }
+}
+__attribute__((target("avx2,fma"))) static void axpy_avx2(float a, const float *x, float *y, int n)
+{
+    __m256 va = _mm256_set1_ps(a);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; i++)
+    {
+        y[i] += a * x[i];
+    }
+}
+// tanh(x) = 1 - 2 / (exp(2x) + 1), clamped where tanh is 1 in float
+__attribute__((target("avx2,fma"))) static void tanh_avx2(float *y, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(y + i);
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-9.0f)), _mm256_set1_ps(9.0f));
+        __m256 e = exp_avx2(_mm256_add_ps(x, x));
+        __m256 t = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, _mm256_set1_ps(1.0f))));
+        _mm256_storeu_ps(y + i, t);
+    }
+    tanh_scalar(y + i, n - i);
+}
+__attribute__((target("avx2,fma"))) static void relu_avx2(float *y, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_max_ps(_mm256_loadu_ps(y + i), _mm256_setzero_ps()));
+    }
+    relu_scalar(y + i, n - i);
+}
+__attribute__((target("avx2,fma"))) static void tanh_grad_avx2(const float *y, const float *gy, float *gz, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(y + i);
+        __m256 d = _mm256_fnmadd_ps(v, v, _mm256_set1_ps(1.0f));
+        _mm256_storeu_ps(gz + i, _mm256_mul_ps(_mm256_loadu_ps(gy + i), d));
+    }
+    tanh_grad_scalar(y + i, gy + i, gz + i, n - i);
+}
+__attribute__((target("avx2,fma"))) static void relu_grad_avx2(const float *y, const float *gy, float *gz, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 mask = _mm256_cmp_ps(_mm256_loadu_ps(y + i), _mm256_setzero_ps(), _CMP_GT_OQ);
+        _mm256_storeu_ps(gz + i, _mm256_and_ps(mask, _mm256_loadu_ps(gy + i)));
+    }
+    relu_grad_scalar(y + i, gy + i, gz + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static void sgd_avx2(float *w, float *g, float *v, int n, float lr, float momentum, float l2)
+{
+    __m256 vlr = _mm256_set1_ps(lr), vmom = _mm256_set1_ps(momentum), vl2 = _mm256_set1_ps(l2);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 wi = _mm256_loadu_ps(w + i);
+        __m256 vi = _mm256_fmadd_ps(vmom, _mm256_loadu_ps(v + i), _mm256_fmadd_ps(vl2, wi, _mm256_loadu_ps(g + i)));
+        _mm256_storeu_ps(v + i, vi);
+        _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(vlr, vi, wi));
+        _mm256_storeu_ps(g + i, _mm256_setzero_ps());
+    }
+    sgd_scalar(w + i, g + i, v + i, n - i, lr, momentum, l2);
+}
+__attribute__((target("avx2,fma"))) static void adam_avx2(float *w, float *g, float *m, float *v, int n, const AdamStep &s)
+{
+    __m256 lr = _mm256_set1_ps(s.lr), b1 = _mm256_set1_ps(s.beta1), b2 = _mm256_set1_ps(s.beta2);
+    __m256 nb1 = _mm256_set1_ps(1 - s.beta1), nb2 = _mm256_set1_ps(1 - s.beta2), eps = _mm256_set1_ps(s.eps);
+    __m256 c1 = _mm256_set1_ps(s.c1), c2 = _mm256_set1_ps(s.c2), l2 = _mm256_set1_ps(s.l2), decay = _mm256_set1_ps(s.decay);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 wi = _mm256_loadu_ps(w + i);
+        __m256 d = _mm256_fmadd_ps(l2, wi, _mm256_loadu_ps(g + i));
+        __m256 mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), _mm256_mul_ps(nb1, d));
+        __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), _mm256_mul_ps(_mm256_mul_ps(nb2, d), d));
+        __m256 u = _mm256_div_ps(_mm256_mul_ps(c1, mi), _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(c2, vi)), eps));
+        u = _mm256_fmadd_ps(decay, wi, u);
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(lr, u, wi));
+        _mm256_storeu_ps(g + i, _mm256_setzero_ps());
+    }
+    adam_scalar(w + i, g + i, m + i, v + i, n - i, s);
+}
+
+__attribute__((target("avx512f"))) static __m512 exp_avx512(__m512 x)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f)), _mm512_set1_ps(88.3762626647949f));
+    __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(0.693359375f), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(-2.12194440e-4f), x);
+    __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.3981999507E-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(8.3334519073E-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(4.1665795894E-2f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.6666665459E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(5.0000001201E-1f));
+    y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+    __m512i e = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(y, _mm512_castsi512_ps(e));
+}
+
+// 16-bit weights are widened to floats in registers, so a dot product reads
+// half the bytes of its float version. fp16 conversions use F16C.
+template <precision P>
+__attribute__((target("avx2,fma,f16c"))) static inline __m256 load_half_avx2(const uint16_t *w)
+{
+    __m128i h = _mm_loadu_si128((const __m128i *)w);
+    if (P == precision::fp16)
+        return _mm256_cvtph_ps(h);
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+template <precision P>
+__attribute__((target("avx2,fma,f16c"))) static float dot_half_avx2(const uint16_t *w, const float *x, int n)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = _mm256_fmadd_ps(load_half_avx2<P>(w + i), _mm256_loadu_ps(x + i), s0);
+        s1 = _mm256_fmadd_ps(load_half_avx2<P>(w + i + 8), _mm256_loadu_ps(x + i + 8), s1);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = _mm256_fmadd_ps(load_half_avx2<P>(w + i), _mm256_loadu_ps(x + i), s0);
+    }
+    return hsum_avx2(_mm256_add_ps(s0, s1)) + dot_half_scalar(P, w + i, x + i, n - i);
+}
+template <precision P>
+__attribute__((target("avx2,fma,f16c"))) static void dot4_half_avx2(const float *x0, const float *x1, const float *x2, const float *x3, const uint16_t *w, int n, float *out)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = load_half_avx2<P>(w + i);
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x0 + i), v, s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x1 + i), v, s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(x2 + i), v, s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(x3 + i), v, s3);
+    }
+    float tail[4];
+    dot4_half_scalar(P, x0 + i, x1 + i, x2 + i, x3 + i, w + i, n - i, tail);
+    out[0] = hsum_avx2(s0) + tail[0];
+    out[1] = hsum_avx2(s1) + tail[1];
+    out[2] = hsum_avx2(s2) + tail[2];
+    out[3] = hsum_avx2(s3) + tail[3];
+}
+__attribute__((target("avx2,fma,f16c"))) static void to_half_avx2(precision p, const float *x, uint16_t *y, long n)
+{
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m128i h;
+        if (p == precision::fp16)
+        {
+            h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        }
+        else
+        {
+            // Round to nearest even on the integer bits, NaNs made quiet
+            __m256i bits = _mm256_castps_si256(v);
+            __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+            __m256i r = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF))), 16);
+            __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+            r = _mm256_blendv_epi8(r, nan, _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+            // Pack the 32-bit lanes to 16 bits, then gather both halves
+            r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+            h = _mm256_castsi256_si128(r);
+        }
+        _mm_storeu_si128((__m128i *)(y + i), h);
+    }
+    to_half_scalar(p, x + i, y + i, n - i);
+}
+__attribute__((target("avx2,fma,f16c"))) static void from_half_avx2(precision p, const uint16_t *x, float *y, long n)
+{
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, p == precision::fp16 ? load_half_avx2<precision::fp16>(x + i) : load_half_avx2<precision::bf16>(x + i));
+    }
+    from_half_scalar(p, x + i, y + i, n - i);
+}
+static float dot_half_avx2(precision p, const uint16_t *w, const float *x, int n)
+{
+    return p == precision::fp16 ? dot_half_avx2<precision::fp16>(w, x, n) : dot_half_avx2<precision::bf16>(w, x, n);
+}
+static void dot4_half_avx2(precision p, const float *x0, const float *x1, const float *x2, const float *x3, const uint16_t *w, int n, float *out)
+{
+    if (p == precision::fp16)
+        dot4_half_avx2<precision::fp16>(x0, x1, x2, x3, w, n, out);
+    else
+        dot4_half_avx2<precision::bf16>(x0, x1, x2, x3, w, n, out);
+}
+
+// maddubs multiplies unsigned by signed bytes, so a's sign moves onto b:
+// |a| * (b * sign(a)). With values in [-127, 127] the pairwise int16 sums
+// cannot saturate.
+__attribute__((target("avx2,fma"))) static int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m256i ones = _mm256_set1_epi16(1);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i p = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s) + dot_i8_scalar(a + i, b + i, n - i);
+}
+__attribute__((target("avx2,fma"))) static void dot4_i8_avx2(const int8_t *x0, const int8_t *x1, const int8_t *x2, const int8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    const int8_t *x[4] = {x0, x1, x2, x3};
+    __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+    __m256i ones = _mm256_set1_epi16(1);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i vw = _mm256_loadu_si256((const __m256i *)(w + i));
+        __m256i aw = _mm256_sign_epi8(vw, vw);
+        for (int k = 0; k < 4; k++)
+        {
+            __m256i vx = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(x[k] + i)), vw);
+            acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(_mm256_maddubs_epi16(aw, vx), ones));
+        }
+    }
+    // Lanes 0-3 of each half hold the partial sums of x0..x3
+    __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+    __m128i r = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    int32_t tail[4];
+    dot4_i8_scalar(x0 + i, x1 + i, x2 + i, x3 + i, w + i, n - i, tail);
+    _mm_storeu_si128((__m128i *)out, _mm_add_epi32(r, _mm_loadu_si128((const __m128i *)tail)));
+}
+__attribute__((target("avx2,fma"))) static void quantize_i8_avx2(const float *x, int8_t *q, float inv, int n)
+{
+    __m256 vinv = _mm256_set1_ps(inv);
+    __m256 lo = _mm256_set1_ps(-127), hi = _mm256_set1_ps(127);
+    // Lane order after the two packs, undone by one permute
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v[4];
+        for (int k = 0; k < 4; k++)
+        {
+            // Saturates in float first, since the conversion turns anything
+            // beyond the int32 range into INT_MIN. Converts with the current
+            // rounding mode, nearest even by default.
+            __m256 r = _mm256_mul_ps(_mm256_loadu_ps(x + i + 8 * k), vinv);
+            v[k] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(r, lo), hi));
+        }
+        __m256i w = _mm256_packs_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        _mm256_storeu_si256((__m256i *)(q + i), _mm256_permutevar8x32_epi32(w, order));
+    }
+    quantize_i8_scalar(x + i, q + i, inv, n - i);
+}
+
+// The AVX-512 versions handle the tail with a masked iteration
+__attribute__((target("avx512f"))) static __mmask16 tail_mask(int left)
+{
+    return left >= 16 ? 0xFFFF : __mmask16((1u << left) - 1);
+}
+
+__attribute__((target("avx512f"))) static float dot_avx512(const float *a, const float *b, int n)
+{
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    for (; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+__attribute__((target("avx512f"))) static void dot4_avx512(const float *a0, const float *a1, const float *a2, const float *a3, const float *b, int n, float *out)
+{
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        __m512 v = _mm512_maskz_loadu_ps(m, b + i);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a0 + i), v, s0);
+        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a1 + i), v, s1);
+        s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a2 + i), v, s2);
+        s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a3 + i), v, s3);
+    }
+    out[0] = _mm512_reduce_add_ps(s0);
+    out[1] = _mm512_reduce_add_ps(s1);
+    out[2] = _mm512_reduce_add_ps(s2);
+    out[3] = _mm512_reduce_add_ps(s3);
+}
+__attribute__((target("avx512f"))) static void axpy_avx512(float a, const float *x, float *y, int n)
+{
+    __m512 va = _mm512_set1_ps(a);
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        __m512 r = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+        _mm512_mask_storeu_ps(y + i, m, r);
+    }
+}
+__attribute__((target("avx512f"))) static void tanh_avx512(float *y, int n)
+{
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        __m512 x = _mm512_maskz_loadu_ps(m, y + i);
+        x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-9.0f)), _mm512_set1_ps(9.0f));
+        __m512 e = exp_avx512(_mm512_add_ps(x, x));
+        __m512 t = _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, _mm512_set1_ps(1.0f))));
+        _mm512_mask_storeu_ps(y + i, m, t);
+    }
+}
+__attribute__((target("avx512f"))) static void relu_avx512(float *y, int n)
+{
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        _mm512_mask_storeu_ps(y + i, m, _mm512_max_ps(_mm512_maskz_loadu_ps(m, y + i), _mm512_setzero_ps()));
+    }
+}
+__attribute__((target("avx512f"))) static void tanh_grad_avx512(const float *y, const float *gy, float *gz, int n)
+{
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        __m512 v = _mm512_maskz_loadu_ps(m, y + i);
+        __m512 d = _mm512_fnmadd_ps(v, v, _mm512_set1_ps(1.0f));
+        _mm512_mask_storeu_ps(gz + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, gy + i), d));
+    }
+}
+__attribute__((target("avx512f"))) static void relu_grad_avx512(const float *y, const float *gy, float *gz, int n)
+{
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 m = tail_mask(n - i);
+        __mmask16 pos = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, y + i), _mm512_setzero_ps(), _CMP_GT_OQ);
+        _mm512_mask_storeu_ps(gz + i, m, _mm512_maskz_loadu_ps(pos, gy + i));
+    }
+}
+
+__attribute__((target("avx512f"))) static void sgd_avx512(float *w, float *g, float *v, int n, float lr, float momentum, float l2)
+{
+    __m512 vlr = _mm512_set1_ps(lr), vmom = _mm512_set1_ps(momentum), vl2 = _mm512_set1_ps(l2);
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 k = tail_mask(n - i);
+        __m512 wi = _mm512_maskz_loadu_ps(k, w + i);
+        __m512 vi = _mm512_fmadd_ps(vmom, _mm512_maskz_loadu_ps(k, v + i), _mm512_fmadd_ps(vl2, wi, _mm512_maskz_loadu_ps(k, g + i)));
+        _mm512_mask_storeu_ps(v + i, k, vi);
+        _mm512_mask_storeu_ps(w + i, k, _mm512_fnmadd_ps(vlr, vi, wi));
+        _mm512_mask_storeu_ps(g + i, k, _mm512_setzero_ps());
+    }
+}
+__attribute__((target("avx512f"))) static void adam_avx512(float *w, float *g, float *m, float *v, int n, const AdamStep &s)
+{
+    __m512 lr = _mm512_set1_ps(s.lr), b1 = _mm512_set1_ps(s.beta1), b2 = _mm512_set1_ps(s.beta2);
+    __m512 nb1 = _mm512_set1_ps(1 - s.beta1), nb2 = _mm512_set1_ps(1 - s.beta2), eps = _mm512_set1_ps(s.eps);
+    __m512 c1 = _mm512_set1_ps(s.c1), c2 = _mm512_set1_ps(s.c2), l2 = _mm512_set1_ps(s.l2), decay = _mm512_set1_ps(s.decay);
+    for (int i = 0; i < n; i += 16)
+    {
+        __mmask16 k = tail_mask(n - i);
+        __m512 wi = _mm512_maskz_loadu_ps(k, w + i);
+        __m512 d = _mm512_fmadd_ps(l2, wi, _mm512_maskz_loadu_ps(k, g + i));
+        __m512 mi = _mm512_fmadd_ps(b1, _mm512_maskz_loadu_ps(k, m + i), _mm512_mul_ps(nb1, d));
+        __m512 vi = _mm512_fmadd_ps(b2, _mm512_maskz_loadu_ps(k, v + i), _mm512_mul_ps(_mm512_mul_ps(nb2, d), d));
+        __m512 u = _mm512_div_ps(_mm512_mul_ps(c1, mi), _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(c2, vi)), eps));
+        u = _mm512_fmadd_ps(decay, wi, u);
+        _mm512_mask_storeu_ps(m + i, k, mi);
+        _mm512_mask_storeu_ps(v + i, k, vi);
+        _mm512_mask_storeu_ps(w + i, k, _mm512_fnmadd_ps(lr, u, wi));
+        _mm512_mask_storeu_ps(g + i, k, _mm512_setzero_ps());
+    }
+}
+
+
+template <precision P>
+__attribute__((target("avx512f"))) static inline __m512 load_half_avx512(const uint16_t *w)
+{
+    __m256i h = _mm256_loadu_si256((const __m256i *)w);
+    if (P == precision::fp16)
+        return _mm512_cvtph_ps(h);
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+}
+// Masked 16-bit loads need AVX512BW, so tails are left to the scalar version
+template <precision P>
+__attribute__((target("avx512f"))) static float dot_half_avx512(const uint16_t *w, const float *x, int n)
+{
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        s0 = _mm512_fmadd_ps(load_half_avx512<P>(w + i), _mm512_loadu_ps(x + i), s0);
+        s1 = _mm512_fmadd_ps(load_half_avx512<P>(w + i + 16), _mm512_loadu_ps(x + i + 16), s1);
+    }
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = _mm512_fmadd_ps(load_half_avx512<P>(w + i), _mm512_loadu_ps(x + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1)) + dot_half_scalar(P, w + i, x + i, n - i);
+}
+template <precision P>
+__attribute__((target("avx512f"))) static void dot4_half_avx512(const float *x0, const float *x1, const float *x2, const float *x3, const uint16_t *w, int n, float *out)
+{
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 v = load_half_avx512<P>(w + i);
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x0 + i), v, s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(x1 + i), v, s1);
+        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(x2 + i), v, s2);
+        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(x3 + i), v, s3);
+    }
+    float tail[4];
+    dot4_half_scalar(P, x0 + i, x1 + i, x2 + i, x3 + i, w + i, n - i, tail);
+    out[0] = _mm512_reduce_add_ps(s0) + tail[0];
+    out[1] = _mm512_reduce_add_ps(s1) + tail[1];
+    out[2] = _mm512_reduce_add_ps(s2) + tail[2];
+    out[3] = _mm512_reduce_add_ps(s3) + tail[3];
+}
+__attribute__((target("avx512f"))) static void to_half_avx512(precision p, const float *x, uint16_t *y, long n)
+{
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 v = _mm512_loadu_ps(x + i);
+        __m256i h;
+        if (p == precision::fp16)
+        {
+            h = _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        }
+        else
+        {
+            __m512i bits = _mm512_castps_si512(v);
+            __m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+            __m512i r = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7FFF))), 16);
+            __m512i nan = _mm512_or_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(0x40));
+            r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), r, nan);
+            h = _mm512_cvtepi32_epi16(r);
+        }
+        _mm256_storeu_si256((__m256i *)(y + i), h);
+    }
+    to_half_scalar(p, x + i, y + i, n - i);
+}
+__attribute__((target("avx512f"))) static void from_half_avx512(precision p, const uint16_t *x, float *y, long n)
+{
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, p == precision::fp16 ? load_half_avx512<precision::fp16>(x + i) : load_half_avx512<precision::bf16>(x + i));
+    }
+    from_half_scalar(p, x + i, y + i, n - i);
+}
+static float dot_half_avx512(precision p, const uint16_t *w, const float *x, int n)
+{
+    return p == precision::fp16 ? dot_half_avx512<precision::fp16>(w, x, n) : dot_half_avx512<precision::bf16>(w, x, n);
+}
+static void dot4_half_avx512(precision p, const float *x0, const float *x1, const float *x2, const float *x3, const uint16_t *w, int n, float *out)
+{
+    if (p == precision::fp16)
+        dot4_half_avx512<precision::fp16>(x0, x1, x2, x3, w, n, out);
+    else
+        dot4_half_avx512<precision::bf16>(x0, x1, x2, x3, w, n, out);
+}
+
+// With VNNI, dpbusd does the unsigned x signed byte products and their
+// int32 sums in one instruction; the sign of a moves onto b as in AVX2.
+// Without it, the AVX2 version is used.
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static int32_t dot_i8_vnni(const int8_t *a, const int8_t *b, int n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    __m512i zero = _mm512_setzero_si512();
+    for (int i = 0; i < n; i += 64)
+    {
+        __mmask64 m = n - i >= 64 ? ~__mmask64(0) : (__mmask64(1) << (n - i)) - 1;
+        __m512i va = _mm512_maskz_loadu_epi8(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(m, b + i);
+        __mmask64 negative = _mm512_movepi8_mask(va);
+        vb = _mm512_mask_sub_epi8(vb, negative, zero, vb);
+        acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(va), vb);
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static void dot4_i8_vnni(const int8_t *x0, const int8_t *x1, const int8_t *x2, const int8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    const int8_t *x[4] = {x0, x1, x2, x3};
+    __m512i acc[4] = {_mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512()};
+    __m512i zero = _mm512_setzero_si512();
+    for (int i = 0; i < n; i += 64)
+    {
+        __mmask64 m = n - i >= 64 ? ~__mmask64(0) : (__mmask64(1) << (n - i)) - 1;
+        __m512i vw = _mm512_maskz_loadu_epi8(m, w + i);
+        __m512i aw = _mm512_abs_epi8(vw);
+        __mmask64 negative = _mm512_movepi8_mask(vw);
+        for (int k = 0; k < 4; k++)
+        {
+            __m512i vx = _mm512_maskz_loadu_epi8(m, x[k] + i);
+            acc[k] = _mm512_dpbusd_epi32(acc[k], aw, _mm512_mask_sub_epi8(vx, negative, zero, vx));
+        }
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        out[k] = _mm512_reduce_add_epi32(acc[k]);
+    }
+}
+// Checked once, the AVX-512 level itself only requires avx512f
+static const bool vnni = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+static int32_t dot_i8_avx512(const int8_t *a, const int8_t *b, int n)
+{
+    return vnni ? dot_i8_vnni(a, b, n) : dot_i8_avx2(a, b, n);
+}
+static void dot4_i8_avx512(const int8_t *x0, const int8_t *x1, const int8_t *x2, const int8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    if (vnni)
+    {
+        dot4_i8_vnni(x0, x1, x2, x3, w, n, out);
+    }
+    else
+    {
+        dot4_i8_avx2(x0, x1, x2, x3, w, n, out);
+    }
+}
+__attribute__((target("avx512f"))) static void quantize_i8_avx512(const float *x, int8_t *q, float inv, int n)
+{
+    __m512 vinv = _mm512_set1_ps(inv);
+    __m512 lo = _mm512_set1_ps(-127), hi = _mm512_set1_ps(127);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        // Saturated in float, as in the AVX2 version
+        __m512 r = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(x + i), vinv), lo), hi);
+        _mm_storeu_si128((__m128i *)(q + i), _mm512_cvtepi32_epi8(_mm512_cvtps_epi32(r)));
+    }
+    quantize_i8_scalar(x + i, q + i, inv, n - i);
+}
+#endif
+
+// Dispatch table, one entry per primitive
+struct KernelTable
+{
+    isa target;
+    float (*dot)(const float *, const float *, int);
+    void (*dot4)(const float *, const float *, const float *, const float *, const float *, int, float *);
+    void (*axpy)(float, const float *, float *, int);
+    void (*tanh)(float *, int);
+    void (*relu)(float *, int);
+    void (*tanh_grad)(const float *, const float *, float *, int);
+    void (*relu_grad)(const float *, const float *, float *, int);
+    void (*sgd)(float *, float *, float *, int, float, float, float);
+    void (*adam)(float *, float *, float *, float *, int, const AdamStep &);
+    void (*to_half)(precision, const float *, uint16_t *, long);
+    void (*from_half)(precision, const uint16_t *, float *, long);
+    float (*dot_half)(precision, const uint16_t *, const float *, int);
+    void (*dot4_half)(precision, const float *, const float *, const float *, const float *, const uint16_t *, int, float *);
+    int32_t (*dot_i8)(const int8_t *, const int8_t *, int);
+    void (*dot4_i8)(const int8_t *, const int8_t *, const int8_t *, const int8_t *, const int8_t *, int, int32_t *);
+    void (*quantize_i8)(const float *, int8_t *, float, int);
+};
+
+static const KernelTable scalar_table = {isa::scalar, dot_scalar, dot4_scalar, axpy_scalar, tanh_scalar, relu_scalar, tanh_grad_scalar, relu_grad_scalar, sgd_scalar, adam_scalar,
+                                         to_half_scalar, from_half_scalar, dot_half_scalar, dot4_half_scalar,
+                                         dot_i8_scalar, dot4_i8_scalar, quantize_i8_scalar};
+#ifdef KERNELS_X86
+static const KernelTable avx2_table = {isa::avx2, dot_avx2, dot4_avx2, axpy_avx2, tanh_avx2, relu_avx2, tanh_grad_avx2, relu_grad_avx2, sgd_avx2, adam_avx2,
+                                       to_half_avx2, from_half_avx2, dot_half_avx2, dot4_half_avx2,
+                                       dot_i8_avx2, dot4_i8_avx2, quantize_i8_avx2};
+static const KernelTable avx512_table = {isa::avx512, dot_avx512, dot4_avx512, axpy_avx512, tanh_avx512, relu_avx512, tanh_grad_avx512, relu_grad_avx512, sgd_avx512, adam_avx512,
+                                         to_half_avx512, from_half_avx512, dot_half_avx512, dot4_half_avx512,
+                                         dot_i8_avx512, dot4_i8_avx512, quantize_i8_avx512};
+#endif
+
+static bool supported(isa target)
+{
+#ifdef KERNELS_X86
+    // Needed because the first call happens during static initialization
+    __builtin_cpu_init();
+    switch (target)
+    {
+    case isa::avx512:
+        return __builtin_cpu_supports("avx512f");
+    case isa::avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    default:
+        return true;
+    }
+#else
+    return target == isa::scalar;
+#endif
+}
+
+static const KernelTable *table_for(isa target)
+{
+#ifdef KERNELS_X86
+    if (target == isa::avx512)
+        return &avx512_table;
+    if (target == isa::avx2)
+        return &avx2_table;
+#endif
+    return &scalar_table;
+}
+
+static const KernelTable *best()
+{
+    for (isa target : {isa::avx512, isa::avx2})
+    {
+        if (supported(target))
+            return table_for(target);
+    }
+    return &scalar_table;
+}
+
+static const KernelTable *kernels = best();
+
+isa kernelIsa()
+{
+    return kernels->target;
+}
+bool setKernelIsa(isa target)
+{
+    if (!supported(target))
+        return false;
+    kernels = table_for(target);
+    return true;
+}
+
+float dot(const float *a, const float *b, int n)
+{
+    return kernels->dot(a, b, n);
+}
+void axpy(float a, const float *x, float *y, int n)
+{
+    kernels->axpy(a, x, y, n);
+}
+void tanh_forward(float *y, int n)
+{
+    kernels->tanh(y, n);
+}
+void relu_forward(float *y, int n)
+{
+    kernels->relu(y, n);
+}
+void tanh_backward(const float *y, const float *gy, float *gz, int n)
+{
+    kernels->tanh_grad(y, gy, gz, n);
+}
+void relu_backward(const float *y, const float *gy, float *gz, int n)
+{
+    kernels->relu_grad(y, gy, gz, n);
+}
+
+void gemv(const float *W, const float *x, const float *b, float *y, int rows, int cols)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        y[r] = kernels->dot(W + (long)r * cols, x, cols) + (b ? b[r] : 0);
+    }
+}
+
+void gemv_t_acc(const float *W, const float *g, float *x, int rows, int cols)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        kernels->axpy(g[r], W + (long)r * cols, x, cols);
+    }
+}
+
+void ger_acc(const float *g, const float *x, float *W, int rows, int cols)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        kernels->axpy(g[r], x, W + (long)r * cols, cols);
+    }
+}
+
+void gemm_nt(const float *X, const float *W, const float *b, float *Y, int n, int rows, int cols)
+{
+    // Four samples per pass so every weight row is loaded once per block
+    int s = 0;
+    float acc[4];
+    for (; s + 4 <= n; s += 4)
+    {
+        const float *x0 = X + (long)s * cols;
+        for (int r = 0; r < rows; r++)
+        {
+            kernels->dot4(x0, x0 + cols, x0 + 2 * cols, x0 + 3 * cols, W + (long)r * cols, cols, acc);
+            float bias = b ? b[r] : 0;
+            for (int k = 0; k < 4; k++)
+            {
+                Y[(long)(s + k) * rows + r] = acc[k] + bias;
+            }
+        }
+    }
+    for (; s < n; s++)
+    {
+        gemv(W, X + (long)s * cols, b, Y + (long)s * rows, rows, cols);
+    }
+}
+
+void gemm_tn_acc(const float *G, const float *X, float *W, int n, int rows, int cols)
+{
+    for (int r = 0; r < rows; r++)
+    {
+        float *w = W + (long)r * cols;
+        for (int s = 0; s < n; s++)
+        {
+            kernels->axpy(G[(long)s * rows + r], X + (long)s * cols, w, cols);
+        }
+    }
+}
+
+void gemm_nn_acc(const float *G, const float *W, float *X, int n, int rows, int cols)
+{
+    for (int s = 0; s < n; s++)
+    {
+        gemv_t_acc(W, G + (long)s * rows, X + (long)s * cols, rows, cols);
+    }
+}
+
+void sgd_update(float *w, float *g, float *v, int n, float lr, float momentum, float l2)
+{
+    kernels->sgd(w, g, v, n, lr, momentum, l2);
+}
+void adam_update(float *w, float *g, float *m, float *v, int n, const AdamStep &s)
+{
+    kernels->adam(w, g, m, v, n, s);
+}
+
+void to_half(precision p, const float *x, uint16_t *y, long n)
+{
+    kernels->to_half(p, x, y, n);
+}
+void from_half(precision p, const uint16_t *x, float *y, long n)
+{
+    kernels->from_half(p, x, y, n);
+}
+void gemm_nt_half(precision p, const float *X, const uint16_t *W, const float *b, float *Y, int n, int rows, int cols)
+{
+    // As gemm_nt: four samples per pass over every weight row
+    int s = 0;
+    float acc[4];
+    for (; s + 4 <= n; s += 4)
+    {
+        const float *x0 = X + (long)s * cols;
+        for (int r = 0; r < rows; r++)
+        {
+            kernels->dot4_half(p, x0, x0 + cols, x0 + 2 * cols, x0 + 3 * cols, W + (long)r * cols, cols, acc);
+            float bias = b ? b[r] : 0;
+            for (int k = 0; k < 4; k++)
+            {
+                Y[(long)(s + k) * rows + r] = acc[k] + bias;
+            }
+        }
+    }
+    for (; s < n; s++)
+    {
+        const float *x = X + (long)s * cols;
+        float *y = Y + (long)s * rows;
+        for (int r = 0; r < rows; r++)
+        {
+            y[r] = kernels->dot_half(p, W + (long)r * cols, x, cols) + (b ? b[r] : 0);
+        }
+    }
+}
+
+int32_t dot_i8(const int8_t *a, const int8_t *b, int n)
+{
+    return kernels->dot_i8(a, b, n);
+}
+void gemm_nt_i8(const int8_t *X, const int8_t *W, int32_t *Y, int n, int rows, int cols)
+{
+    // As gemm_nt_half: four samples per pass over every weight row
+    int s = 0;
+    for (; s + 4 <= n; s += 4)
+    {
+        const int8_t *x0 = X + (long)s * cols;
+        int32_t acc[4];
+        for (int r = 0; r < rows; r++)
+        {
+            kernels->dot4_i8(x0, x0 + cols, x0 + 2 * cols, x0 + 3 * cols, W + (long)r * cols, cols, acc);
+            for (int k = 0; k < 4; k++)
+            {
+                Y[(long)(s + k) * rows + r] = acc[k];
+            }
+        }
+    }
+    for (; s < n; s++)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            Y[(long)s * rows + r] = kernels->dot_i8(W + (long)r * cols, X + (long)s * cols, cols);
+        }
+    }
+}
+void quantize_i8(const float *x, int8_t *q, float inv, int n)
+{
+    kernels->quantize_i8(x, q, inv, n);
+}
@@ -1,13 +1,31 @@
 #include "../include/NN.hpp"
+#include "../include/Expr.hpp"
+#include "../include/Profiler.hpp"
+#include "../include/ThreadPool.hpp"
+#include <atomic>
+#include <cstring>
+#include <mutex>
 
 void Module::zero_grad()
 {
+    for (auto &b : blocks())
     {
-        for (auto p : parameters())
+        memset(b.grad, 0, b.n * sizeof(float));
+    }
+}
+vector<ParameterBlock> Module::blocks()
+{
+    vector<ParameterBlock> out;
+    for (auto &p : parameters())
+    {
+        if (!out.empty() && out.back().data + out.back().n == p->dataPtr() && out.back().grad + out.back().n == p->gradPtr())
         {
-            p->setGrad(0);
+            out.back().n++;
+            continue;
         }
+        out.push_back({p->dataPtr(), p->gradPtr(), 1});
     }
+    return out;
 }
 // Neuron class definition
 Neuron::Neuron(int nin, activation act) : act{act}
@@ -33,58 +51,381 @@ Neuron::Neuron(vector<float> params)
 
 void Neuron::save(ostream &file)
 {
-    file << int(act) << endl;
+    file << int(act) << '\n';
     for (auto &weight : w)
     {
-        file << weight->getData() << endl;
+        file << weight->getData() << '\n';
     }
-    file << b->getData() << endl;
+    file << b->getData() << '\n';
+}
+activation Neuron::getActivation()
+{
+    return act;
 }
 
-vector<shared_ptr<Value>> Neuron::parameters()
+const vector<shared_ptr<Value>> &Neuron::parameters()
 {
-    auto c(w);
-    c.push_back(b);
-    return c;
+    if (params.empty())
+    {
+        params = w;
+        params.push_back(b);
+    }
+    return params;
 }
-shared_ptr<Value> Neuron::operator()(vector<shared_ptr<Value>> x)
+void Neuron::bind(float *weights, float *gw, float *bias, float *gb, const shared_ptr<void> &keep)
 {
-    if (x.size() != w.size())
+    for (int i = 0; i < w.size(); i++)
     {
-        throw runtime_error("Input size does not match");
+        w[i]->bind(weights + i, gw + i, keep);
     }
-
-    vector<shared_ptr<Value>> ws{};
-    for (int i = 0; i < x.size(); i++)
+    b->bind(bias, gb, keep);
+}
+// Activation of n values in place
+static void activate(activation act, float *y, int n)
+{
+    switch (act)
     {
-        ws.push_back(x[i] * w[i]);
+    case activation::relu:
+        relu_forward(y, n);
+        break;
+    case activation::tanh:
+        tanh_forward(y, n);
+        break;
+    default:
+        break;
     }
-    ws.push_back(b);
-    auto k = sum(ws);
-
+}
+// Gradient at the pre-activation, expressed through the outputs y
+static void activate_grad(activation act, const float *y, const float *gy, float *gz, int n)
+{
     switch (act)
     {
     case activation::relu:
-        return relu(k);
+        relu_backward(y, gy, gz, n);
+        break;
     case activation::tanh:
-        return tanh(k);
+        tanh_backward(y, gy, gz, n);
+        break;
     default:
-        return k;
+        copy(gy, gy + n, gz);
+        break;
     }
 }
 
+// Fused neuron: y = act(x . w + b), with x, w and b passed one after the
+// other as the inputs so the whole neuron is a single graph node
+class NeuronOp : public FusedOp
+{
+public:
+    NeuronOp(activation act) : act{act} {}
+
+    void forward(const float *x, int n, float *y, int m) override
+    {
+        int nin = (n - 1) / 2;
+        y[0] = dot(x, x + nin, nin) + x[n - 1];
+        activate(act, y, 1);
+    }
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        int nin = (n - 1) / 2;
+        float gz;
+        activate_grad(act, y, gy, &gz, 1);
+        axpy(gz, x + nin, gx, nin);
+        axpy(gz, x, gx + nin, nin);
+        gx[n - 1] += gz;
+    }
+    const char *name() override
+    {
+        return "neuron";
+    }
+
+private:
+    activation act;
+};
+
+shared_ptr<Value> Neuron::operator()(const vector<shared_ptr<Value>> &x)
+{
+    // NeuronOp holds no state, one instance per activation is shared
+    static const shared_ptr<FusedOp> ops[] = {make_shared<NeuronOp>(activation::none),
+                                              make_shared<NeuronOp>(activation::tanh),
+                                              make_shared<NeuronOp>(activation::relu)};
+    if (x.size() != w.size())
+    {
+        throw runtime_error("Input size does not match");
+    }
+
+    vector<shared_ptr<Value>> in{};
+    in.reserve(2 * x.size() + 1);
+    in.insert(in.end(), x.begin(), x.end());
+    in.insert(in.end(), w.begin(), w.end());
+    in.push_back(b);
+    return apply(ops[int(act)], in, 1)[0];
+}
+
+float Neuron::predict(const float *x)
+{
+    float z = b->getData();
+    for (int i = 0; i < w.size(); i++)
+    {
+        z += x[i] * w[i]->getData();
+    }
+    activate(act, &z, 1);
+    return z;
+}
+
+// 16-bit copy of a tensor layer's weight matrix (the biases stay float).
+// The float weights are the master copy: the 16-bit one is converted from
+// them again on the first forward after a backward, since an optimizer
+// step may have changed them.
+struct HalfWeights
+{
+    HalfWeights(precision p, long n) : p{p}, w(n), stale{true} {}
+
+    // The converted weights, converting W first if stale. Concurrent
+    // callers wait for a single conversion.
+    const uint16_t *get(const float *W)
+    {
+        if (stale.load(memory_order_acquire))
+        {
+            lock_guard<mutex> lock(m);
+            if (stale.load(memory_order_relaxed))
+            {
+                to_half(p, W, w.data(), w.size());
+                stale.store(false, memory_order_release);
+            }
+        }
+        return w.data();
+    }
+
+    precision p;
+    vector<uint16_t> w;
+    atomic<bool> stale;
+    mutex m;
+};
+
+// Whole-layer kernel of the tensor engine: y = act(W x + b), applied to
+// every sample of a batch stored as consecutive rows of x
+class LinearOp : public FusedOp
+{
+public:
+    LinearOp(shared_ptr<ParameterStorage> storage, vector<activation> acts, int nin, int nout, string label, shared_ptr<HalfWeights> half)
+        : storage{storage}, acts{acts}, nin{nin}, nout{nout}, label{label}, half{half}, uniform{true}
+    {
+        for (auto a : acts)
+        {
+            uniform = uniform && a == acts[0];
+        }
+    }
+
+    void forward(const float *x, int n, float *y, int m) override
+    {
+        int batch = n / nin;
+        const float *W = storage->data;
+        const float *b = W + (long)nout * nin;
+        const uint16_t *W16 = half ? half->get(W) : nullptr;
+        // Y = X W^T + b over samples [s0, s1) and rows [r0, r1)
+        auto product = [&](int s0, int s1, int r0, int r1)
+        {
+            // Every row: the samples as one block. Some rows: one sample at a time.
+            int count = r1 - r0 == nout ? s1 - s0 : 1;
+            for (int s = s0; s < s1; s += count)
+            {
+                const float *xs = x + (long)s * nin;
+                float *ys = y + (long)s * nout + r0;
+                if (half)
+                {
+                    gemm_nt_half(half->p, xs, W16 + (long)r0 * nin, b + r0, ys, count, r1 - r0, nin);
+                }
+                else
+                {
+                    gemm_nt(xs, W + (long)r0 * nin, b + r0, ys, count, r1 - r0, nin);
+                }
+            }
+        };
+        // Wide layers split across the intra-op pool: by blocks of four
+        // samples when there are enough to keep every thread busy, otherwise
+        // by rows
+        long work = (long)batch * nout * nin;
+        if (batch >= 4 * intraOpThreads())
+        {
+            parallelFor(batch, 4, work, [&](int s0, int s1)
+                        { product(s0, s1, 0, nout); });
+        }
+        else
+        {
+            parallelFor(nout, 1, work, [&](int r0, int r1)
+                        { product(0, batch, r0, r1); });
+        }
+        if (uniform)
+        {
+            activate(acts[0], y, m);
+            return;
+        }
+        for (int i = 0; i < m; i++)
+        {
+            activate(acts[i % nout], y + i, 1);
+        }
+    }
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        ProfileScope scope(label, "backward");
+        propagate(x, n, y, gy, m, gx, true);
+    }
+    // Only the input gradient, for Derivatives
+    void vjp(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        propagate(x, n, y, gy, m, gx, false);
+    }
+    // Forward mode: the tangent of W x, then through the activation. The
+    // default would go through vjp once per output.
+    void jvp(const float *x, int n, const float *y, const float *dx, int m, float *dy) override
+    {
+        int batch = n / nin;
+        const float *W = storage->data;
+        static thread_local vector<float> dz, zero;
+        dz.resize(m);
+        zero.assign(nout, 0);
+        if (half)
+        {
+            gemm_nt_half(half->p, dx, half->get(W), zero.data(), dz.data(), batch, nout, nin);
+        }
+        else
+        {
+            gemm_nt(dx, W, zero.data(), dz.data(), batch, nout, nin);
+        }
+        if (uniform)
+        {
+            activate_grad(acts[0], y, dz.data(), dy, m);
+            return;
+        }
+        for (int i = 0; i < m; i++)
+        {
+            activate_grad(acts[i % nout], y + i, dz.data() + i, dy + i, 1);
+        }
+    }
+    const char *name() override
+    {
+        return "linear";
+    }
+
+private:
+    // Gradient of the inputs into gx, and of the weights and biases too if
+    // asked
+    void propagate(const float *x, int n, const float *y, const float *gy, int m, float *gx, bool weights)
+    {
+        int batch = n / nin;
+        // Gradient at the pre-activation
+        static thread_local vector<float> gz;
+        gz.resize(m);
+        if (uniform)
+        {
+            activate_grad(acts[0], y, gy, gz.data(), m);
+        }
+        else
+        {
+            for (int i = 0; i < m; i++)
+            {
+                activate_grad(acts[i % nout], y + i, gy + i, gz.data() + i, 1);
+            }
+        }
+        if (half)
+        {
+            // The gradient passes through the storage format, so values
+            // out of fp16's range are lost unless the loss is scaled
+            static thread_local vector<uint16_t> gz16;
+            gz16.resize(m);
+            to_half(half->p, gz.data(), gz16.data(), m);
+            from_half(half->p, gz16.data(), gz.data(), m);
+            if (weights)
+            {
+                half->stale.store(true, memory_order_release);
+            }
+        }
+        const float *W = storage->data;
+        // gz is per thread, so the pool's threads get its address
+        const float *g = gz.data();
+        long work = (long)batch * nout * nin;
+        if (weights)
+        {
+            float *dW = storage->grad;
+            float *db = dW + (long)nout * nin;
+            for (int i = 0; i < m; i++)
+            {
+                db[i % nout] += gz[i];
+            }
+            // dW split by rows and dx by columns, so no two chunks write the
+            // same gradient
+            parallelFor(nout, 1, work, [&](int r0, int r1)
+                        {
+                if (r1 - r0 == nout)
+                {
+                    gemm_tn_acc(g, x, dW, batch, nout, nin);
+                    return;
+                }
+                for (int s = 0; s < batch; s++)
+                {
+                    ger_acc(g + (long)s * nout + r0, x + (long)s * nin, dW + (long)r0 * nin, r1 - r0, nin);
+                } });
+        }
+        parallelFor(nin, 16, work, [&](int c0, int c1)
+                    {
+            if (c1 - c0 == nin)
+            {
+                gemm_nn_acc(g, W, gx, batch, nout, nin);
+                return;
+            }
+            for (int s = 0; s < batch; s++)
+            {
+                for (int r = 0; r < nout; r++)
+                {
+                    axpy(g[(long)s * nout + r], W + (long)r * nin + c0, gx + (long)s * nin + c0, c1 - c0);
+                }
+            } });
+    }
+
+    shared_ptr<ParameterStorage> storage;
+    vector<activation> acts;
+    int nin;
+    int nout;
+    // Of the layer, for the Profiler
+    string label;
+    // Null in full precision
+    shared_ptr<HalfWeights> half;
+    // All rows share one activation, so it runs as one vector kernel
+    bool uniform;
+};
+
 // LinearLayer class definition
-LinearLayer::LinearLayer(int nin, int nout, activation act) : nin{nin}, nout{nout}
+LinearLayer::LinearLayer(int nin, int nout, activation act, engine mode) : nin{nin}, nout{nout}, mode{mode}, label{"linear"}
 {
+    if (mode == engine::tensor)
+    {
+        std::random_device rd;
+        std::mt19937 generator(rd());
+        std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+        initTensor();
+        for (long i = 0; i < (long)nout * (nin + 1); i++)
+        {
+            storage->data[i] = distribution(generator);
+        }
+        acts.assign(nout, act);
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+        return;
+    }
     for (int i = 0; i < nout; i++)
     {
         Neuron n = Neuron(nin, act);
         neurons.push_back(n);
     }
 }
-LinearLayer::LinearLayer(istream &in)
+LinearLayer::LinearLayer(istream &in, engine mode) : mode{mode}, label{"linear"}
 {
     in >> nin >> nout;
+    if (mode == engine::tensor)
+    {
+        initTensor();
+        acts.resize(nout);
+    }
 
     for (int i = 0; i < nout; i++)
     {
@@ -93,62 +434,349 @@ LinearLayer::LinearLayer(istream &in)
         {
             in >> v[j];
         }
+        if (mode == engine::tensor)
+        {
+            setRow(i, v);
+        }
+        else
+        {
+            neurons.push_back(Neuron(v));
+        }
+    }
+    if (mode == engine::tensor)
+    {
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+    }
+}
+
+LinearLayer::LinearLayer(const CheckpointLayer &layer, shared_ptr<void> mapping, engine mode) : nin{layer.nin}, nout{layer.nout}, mode{mode}, label{"linear"}
+{
+    for (int r = 0; r < nout; r++)
+    {
+        if (layer.acts[r] > int(activation::relu))
+        {
+            throw runtime_error("Unknown activation in checkpoint");
+        }
+    }
+    if (mode == engine::tensor)
+    {
+        initTensor(layer.params, mapping);
+        for (int r = 0; r < nout; r++)
+        {
+            acts.push_back(activation(layer.acts[r]));
+        }
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+        return;
+    }
+    const float *W = layer.params;
+    vector<float> v(nin + 2);
+    for (int r = 0; r < nout; r++)
+    {
+        v[0] = layer.acts[r];
+        copy(W + (long)r * nin, W + (long)(r + 1) * nin, v.begin() + 1);
+        v.back() = W[(long)nout * nin + r];
         neurons.push_back(Neuron(v));
     }
 }
 
+// Allocate the weight buffers, unless they are mapped from a checkpoint
+void LinearLayer::initTensor(float *mapped, shared_ptr<void> mapping)
+{
+    long n = (long)nout * (nin + 1);
+    storage = mapped ? make_shared<ParameterStorage>(mapped, n, mapping) : make_shared<ParameterStorage>(n);
+}
+// The parameters in neuron order: each neuron's weights followed by its
+// bias (views into the weight buffers for the tensor engine). Only made
+// when first asked for, so a model loaded for inference never pays for them.
+void LinearLayer::initParams()
+{
+    if (mode != engine::tensor)
+    {
+        for (auto &n : neurons)
+        {
+            auto &p = n.parameters();
+            params.insert(params.end(), p.begin(), p.end());
+        }
+        return;
+    }
+    float *W = storage->data;
+    float *dW = storage->grad;
+    long bias = (long)nout * nin;
+    for (int r = 0; r < nout; r++)
+    {
+        for (int c = 0; c < nin; c++)
+        {
+            params.push_back(Value::view(W + (long)r * nin + c, dW + (long)r * nin + c, storage));
+        }
+        params.push_back(Value::view(W + bias + r, dW + bias + r, storage));
+    }
+}
+void LinearLayer::bind(const shared_ptr<ParameterStorage> &flat, long offset)
+{
+    float *W = flat->data + offset;
+    float *dW = flat->grad + offset;
+    long n = size();
+    long bias = (long)nout * nin;
+    if (mode == engine::tensor)
+    {
+        // Views made so far follow their parameter
+        for (auto &p : params)
+        {
+            long i = p->dataPtr() - storage->data;
+            p->bind(W + i, dW + i, flat);
+        }
+        if (storage->data != W)
+        {
+            copy(storage->data, storage->data + n, W);
+        }
+        copy(storage->grad, storage->grad + n, dW);
+    }
+    else
+    {
+        for (int r = 0; r < nout; r++)
+        {
+            neurons[r].bind(W + (long)r * nin, dW + (long)r * nin, W + bias + r, dW + bias + r, flat);
+        }
+    }
+    storage = make_shared<ParameterStorage>(flat, offset, n);
+    if (mode == engine::tensor)
+    {
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+    }
+}
+// Row r from the saved neuron layout: activation, weights, bias
+void LinearLayer::setRow(int r, const vector<float> &params)
+{
+    float *W = storage->data;
+    acts[r] = activation(int(params[0]));
+    for (int c = 0; c < nin; c++)
+    {
+        W[(long)r * nin + c] = params[c + 1];
+    }
+    W[(long)nout * nin + r] = params.back();
+}
+
 void LinearLayer::save(ostream &file)
 {
-    file << nin << endl
-         << nout << endl;
+    file << nin << '\n'
+         << nout << '\n';
+    if (mode == engine::tensor)
+    {
+        const float *W = storage->data;
+        for (int r = 0; r < nout; r++)
+        {
+            file << int(acts[r]) << '\n';
+            for (int c = 0; c < nin; c++)
+            {
+                file << W[(long)r * nin + c] << '\n';
+            }
+            file << W[(long)nout * nin + r] << '\n';
+        }
+        return;
+    }
     for (auto &n : neurons)
     {
         n.save(file);
     }
 }
+CheckpointLayer LinearLayer::checkpoint(vector<unsigned char> &a, vector<float> &scratch)
+{
+    a.resize(nout);
+    for (int r = 0; r < nout; r++)
+    {
+        a[r] = (unsigned char)(mode == engine::tensor ? acts[r] : neurons[r].getActivation());
+    }
+    if (storage)
+    {
+        return {nin, nout, a.data(), storage->data};
+    }
+    scratch.resize(size());
+    for (int r = 0; r < nout; r++)
+    {
+        auto &p = neurons[r].parameters();
+        for (int c = 0; c < nin; c++)
+        {
+            scratch[(long)r * nin + c] = p[c]->getData();
+        }
+        scratch[(long)nout * nin + r] = p.back()->getData();
+    }
+    return {nin, nout, a.data(), scratch.data()};
+}
 
-vector<shared_ptr<Value>> LinearLayer::operator()(vector<shared_ptr<Value>> x)
+vector<shared_ptr<Value>> LinearLayer::operator()(const vector<shared_ptr<Value>> &x)
 {
+    if (x.size() != nin)
+    {
+        throw runtime_error("Input size does not match");
+    }
+    return forward(x, 1);
+}
+vector<vector<shared_ptr<Value>>> LinearLayer::operator()(const vector<vector<shared_ptr<Value>>> &x)
+{
+    vector<shared_ptr<Value>> flat;
+    flat.reserve(x.size() * nin);
+    for (auto &row : x)
+    {
+        if (row.size() != nin)
+        {
+            throw runtime_error("Input size does not match");
+        }
+        flat.insert(flat.end(), row.begin(), row.end());
+    }
+    auto y = forward(flat, x.size());
+
+    vector<vector<shared_ptr<Value>>> out;
+    for (int s = 0; s < x.size(); s++)
+    {
+        out.emplace_back(y.begin() + s * nout, y.begin() + (s + 1) * nout);
+    }
+    return out;
+}
+vector<shared_ptr<Value>> LinearLayer::forward(const vector<shared_ptr<Value>> &x, int n)
+{
+    ProfileScope scope(label, "forward");
+    if (x.size() != (long)n * nin)
+    {
+        throw runtime_error("Input size does not match");
+    }
+    if (mode == engine::tensor)
+    {
+        return apply(op, x, n * nout);
+    }
 
     vector<shared_ptr<Value>> out{};
-    for (int i = 0; i < nout; i++)
+    out.reserve((long)n * nout);
+    vector<shared_ptr<Value>> row;
+    for (int s = 0; s < n; s++)
     {
+        row.assign(x.begin() + (long)s * nin, x.begin() + (long)(s + 1) * nin);
+        for (int i = 0; i < nout; i++)
+        {
 
-        out.push_back(neurons[i](x));
+            out.push_back(neurons[i](row));
+        }
     }
 
     return out;
 }
-vector<shared_ptr<Value>> LinearLayer::parameters()
+void LinearLayer::predict(const float *x, float *y, int n)
+{
+    ProfileScope scope(label, "predict");
+    if (mode == engine::tensor)
+    {
+        op->forward(x, n * nin, y, n * nout);
+        return;
+    }
+    parallelFor(nout, 1, (long)n * nout * nin, [&](int r0, int r1)
+                {
+        for (int s = 0; s < n; s++)
+        {
+            for (int i = r0; i < r1; i++)
+            {
+                y[(long)s * nout + i] = neurons[i].predict(x + (long)s * nin);
+            }
+        } });
+}
+
+int LinearLayer::inputs()
+{
+    return nin;
+}
+int LinearLayer::outputs()
+{
+    return nout;
+}
+engine LinearLayer::getEngine()
+{
+    return mode;
+}
+void LinearLayer::setLabel(string l)
+{
+    label = move(l);
+    if (mode == engine::tensor)
+    {
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+    }
+}
+void LinearLayer::setPrecision(precision p)
 {
-    vector<shared_ptr<Value>> p{};
-    for (int i = 0; i < neurons.size(); i++)
+    if (p != precision::fp32 && mode != engine::tensor)
     {
-        auto np = neurons[i].parameters();
-        p.insert(p.end(), np.begin(), np.end());
+        throw runtime_error("Reduced precision needs the tensor engine");
     }
-    return p;
+    half = p == precision::fp32 ? nullptr : make_shared<HalfWeights>(p, (long)nout * nin);
+    if (mode == engine::tensor)
+    {
+        op = make_shared<LinearOp>(storage, acts, nin, nout, label, half);
+    }
+}
+precision LinearLayer::getPrecision()
+{
+    return half ? half->p : precision::fp32;
+}
+long LinearLayer::size()
+{
+    return (long)nout * (nin + 1);
+}
+const vector<shared_ptr<Value>> &LinearLayer::parameters()
+{
+    if (params.empty())
+    {
+        initParams();
+    }
+    return params;
+}
+
+vector<ParameterBlock> LinearLayer::blocks()
+{
+    if (storage)
+    {
+        return {{storage->data, storage->grad, storage->n}};
+    }
+    return Module::blocks();
+}
+
+// Room taken by a block of n parameters in the flat buffer
+static long padded(long n)
+{
+    const long align = checkpointAlign / sizeof(float);
+    return (n + align - 1) / align * align;
 }
 
 // MLP class definition
-MLP::MLP(int in, vector<int> l) : layers{{}}
+MLP::MLP(int in, vector<int> l, engine mode) : layers{{}}
 {
-    layers.push_back(LinearLayer(in, l[0], activation::tanh));
+    layers.push_back(LinearLayer(in, l[0], activation::tanh, mode));
     for (int i = 0; i < l.size() - 1; i++)
     {
-        LinearLayer layer = LinearLayer(l[i], l[i + 1], activation::tanh);
+        LinearLayer layer = LinearLayer(l[i], l[i + 1], activation::tanh, mode);
 
         layers.push_back(layer);
     }
+    initStorage();
 }
-MLP::MLP(string path)
+MLP::MLP(string path, engine mode)
 {
+    if (Checkpoint::detect(path))
+    {
+        load(Checkpoint(path), mode);
+        return;
+    }
     ifstream file(path);
     if (!file.is_open())
     {
         cerr << "Error opening file!" << endl;
         return;
     }
+    load(file, mode);
+    file.close();
+}
+MLP::MLP(istream &in, engine mode)
+{
+    load(in, mode);
+}
+void MLP::load(istream &file, engine mode)
+{
     string s;
     file >> s;
     int n;
@@ -157,78 +785,552 @@ MLP::MLP(string path)
     for (int i = 0; i < n; i++)
     {
 
-        layers.push_back(LinearLayer(file));
+        layers.push_back(LinearLayer(file, mode));
+    }
+    initStorage();
+}
+MLP::MLP(const Checkpoint &checkpoint, engine mode)
+{
+    load(checkpoint, mode);
+}
+void MLP::load(const Checkpoint &checkpoint, engine mode)
+{
+    // Tensor layers use the mapped weights in place, and the mapping is the
+    // flat buffer as long as the blocks follow each other as laid out there
+    bool inPlace = mode == engine::tensor && checkpoint.layers() > 0;
+    float *base = inPlace ? checkpoint.layer(0).params : nullptr;
+    long offset = 0;
+    for (int i = 0; i < checkpoint.layers(); i++)
+    {
+        layers.push_back(LinearLayer(checkpoint.layer(i), checkpoint.memory(), mode));
+        inPlace = inPlace && checkpoint.layer(i).params == base + offset;
+        offset += padded(layers.back().size());
+    }
+    initStorage(inPlace ? base : nullptr, checkpoint.memory());
+}
+void MLP::initStorage(float *mapped, shared_ptr<void> mapping)
+{
+    vector<long> offsets;
+    long total = 0;
+    for (auto &layer : layers)
+    {
+        offsets.push_back(total);
+        total += padded(layer.size());
+    }
+    storage = mapped ? make_shared<ParameterStorage>(mapped, total, mapping) : make_shared<ParameterStorage>(total);
+    for (int i = 0; i < layers.size(); i++)
+    {
+        layers[i].setLabel("layer " + to_string(i));
+        layers[i].bind(storage, offsets[i]);
     }
-    file.close();
 }
 void MLP::saveTo(string path)
 {
     ofstream file(path, ios::out | ios::trunc);
-    file << "MLP" << endl;
-    file << layers.size() << endl;
+    // Enough digits for every float to read back exactly
+    file << setprecision(numeric_limits<float>::max_digits10);
+    save(file);
+}
+void MLP::save(ostream &file)
+{
+    file << "MLP" << '\n';
+    file << layers.size() << '\n';
     for (int i = 0; i < layers.size(); i++)
     {
         layers[i].save(file);
     }
-    // cout << layers.size() << endl;
 }
+// Independent copy with its own parameters (copying an MLP shares them)
+MLP MLP::clone()
+{
+    stringstream s;
+    s << setprecision(numeric_limits<float>::max_digits10);
+    save(s);
+    MLP copy(s, layers.empty() ? engine::scalar : layers[0].getEngine());
+    copy.segment = segment;
+    if (!layers.empty())
+    {
+        copy.setPrecision(layers[0].getPrecision());
+    }
+    return copy;
+}
+void MLP::saveCheckpoint(string path)
+{
+    vector<vector<unsigned char>> acts(layers.size());
+    vector<vector<float>> params(layers.size());
+    vector<CheckpointLayer> out;
+    for (int i = 0; i < layers.size(); i++)
+    {
+        out.push_back(layers[i].checkpoint(acts[i], params[i]));
+    }
+    writeCheckpoint(path, out);
+}
+int MLP::inputs()
+{
+    return layers.empty() ? 0 : layers.front().inputs();
+}
+int MLP::outputs()
+{
+    return layers.empty() ? 0 : layers.back().outputs();
+}
+
+// Activation checkpointing: a run of layers recorded as a single node that
+// keeps only its outputs. Forward runs the layers without building a graph;
+// backward rebuilds the segment's graph from the saved inputs, backpropagates
+// gy through it (the parameter gradients accumulate in the layers as usual)
+// and drops it again.
+class SegmentOp : public FusedOp
+{
+public:
+    SegmentOp(LinearLayer *first, int count) : first{first}, count{count} {}
 
+    void forward(const float *x, int n, float *y, int m) override
+    {
+        int batch = n / first->inputs();
+        // Activations ping-pong between two buffers kept per thread
+        static thread_local vector<float> a, b;
+        const float *in = x;
+        for (int i = 0; i < count; i++)
+        {
+            float *out = y;
+            if (i + 1 < count)
+            {
+                auto &buffer = i % 2 ? b : a;
+                buffer.resize((long)batch * first[i].outputs());
+                out = buffer.data();
+            }
+            first[i].predict(in, out, batch);
+            in = out;
+        }
+    }
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        // The recomputed nodes only live for this call
+        static thread_local GraphArena arena;
+        {
+            ArenaScope scope(arena);
+            vector<shared_ptr<Value>> in;
+            auto out = recompute(x, n, in);
+            ::backward(out, gy);
+            for (int i = 0; i < n; i++)
+            {
+                gx[i] += in[i]->getGrad();
+            }
+        }
+        arena.reset();
+    }
+    // Reverse and forward mode through the rebuilt graph, which leave the
+    // parameter gradients alone
+    void vjp(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        static thread_local GraphArena arena;
+        {
+            ArenaScope scope(arena);
+            vector<shared_ptr<Value>> in;
+            auto out = recompute(x, n, in);
+            vector<float> g(n);
+            Derivatives(in, out).vjp(gy, 1, g.data());
+            for (int i = 0; i < n; i++)
+            {
+                gx[i] += g[i];
+            }
+        }
+        arena.reset();
+    }
+    void jvp(const float *x, int n, const float *y, const float *dx, int m, float *dy) override
+    {
+        static thread_local GraphArena arena;
+        {
+            ArenaScope scope(arena);
+            vector<shared_ptr<Value>> in;
+            auto out = recompute(x, n, in);
+            Derivatives(in, out).jvp(dx, 1, dy);
+        }
+        arena.reset();
+    }
+    const char *name() override
+    {
+        return "segment";
+    }
+
+private:
+    // The segment's graph from leaves in holding x, in the current arena
+    vector<shared_ptr<Value>> recompute(const float *x, int n, vector<shared_ptr<Value>> &in)
+    {
+        int batch = n / first->inputs();
+        in.reserve(n);
+        for (int i = 0; i < n; i++)
+        {
+            in.push_back(Value::create(x[i]));
+        }
+        auto out = in;
+        for (int i = 0; i < count; i++)
+        {
+            out = first[i].forward(out, batch);
+        }
+        return out;
+    }
+
+    LinearLayer *first;
+    int count;
+};
+
+vector<shared_ptr<Value>> MLP::forward(const vector<shared_ptr<Value>> &x, int n)
+{
+    auto y = x;
+    if (segment == 0)
+    {
+        for (int i = 0; i < layers.size(); i++)
+        {
+            y = layers[i].forward(y, n);
+        }
+        return y;
+    }
+    if (x.size() != (long)n * inputs())
+    {
+        throw runtime_error("Input size does not match");
+    }
+    for (int i = 0; i < layers.size(); i += segment)
+    {
+        int count = min<int>(segment, layers.size() - i);
+        y = apply(make_shared<SegmentOp>(&layers[i], count), y, n * layers[i + count - 1].outputs());
+    }
+    return y;
+}
 vector<shared_ptr<Value>> MLP::operator()(vector<std::shared_ptr<Value>> input)
 {
-    // vector<shared_ptr<Value>> x;
-    // for (auto v : input)
-    // {
-    //     x.push_back(make_shared<Value>(v));
-    // }
-    auto x = input;
-    for (int i = 0; i < layers.size(); i++)
+    return forward(input, 1);
+}
+vector<vector<shared_ptr<Value>>> MLP::operator()(const vector<vector<shared_ptr<Value>>> &input)
+{
+    // Layers work on the batch flattened row by row, so a tensor layer
+    // records one node for the whole batch
+    vector<shared_ptr<Value>> x;
+    for (auto &row : input)
     {
+        x.insert(x.end(), row.begin(), row.end());
+    }
+    int n = input.size();
+    x = forward(x, n);
 
-        x = layers[i](x);
+    int nout = n ? x.size() / n : 0;
+    vector<vector<shared_ptr<Value>>> out;
+    for (int s = 0; s < n; s++)
+    {
+        out.emplace_back(x.begin() + s * nout, x.begin() + (s + 1) * nout);
+    }
+    return out;
+}
+void MLP::setPrecision(precision p)
+{
+    for (auto &layer : layers)
+    {
+        layer.setPrecision(p);
+    }
+}
+precision MLP::getPrecision()
+{
+    return layers.empty() ? precision::fp32 : layers[0].getPrecision();
+}
+void MLP::setActivationCheckpointing(int k)
+{
+    if (k < 0)
+    {
+        throw runtime_error("Negative checkpointing segment");
     }
-    return x;
+    segment = k;
+}
+int MLP::getActivationCheckpointing()
+{
+    return segment;
 }
-vector<shared_ptr<Value>> MLP::parameters()
+void MLP::predict(const float *x, float *y, int n)
 {
-    vector<shared_ptr<Value>> p{};
+    // Activations ping-pong between two buffers kept per thread
+    static thread_local vector<float> a, b;
+    const float *in = x;
     for (int i = 0; i < layers.size(); i++)
     {
-        auto np = layers[i].parameters();
-        p.insert(p.end(), np.begin(), np.end());
+        float *out = y;
+        if (i + 1 < layers.size())
+        {
+            auto &buffer = i % 2 ? b : a;
+            buffer.resize((long)n * layers[i].outputs());
+            out = buffer.data();
+        }
+        layers[i].predict(in, out, n);
+        in = out;
+    }
+}
+vector<float> MLP::predict(const vector<float> &x)
+{
+    if (x.size() != inputs())
+    {
+        throw runtime_error("Input size does not match");
     }
-    return p;
+    vector<float> y(outputs());
+    predict(x.data(), y.data(), 1);
+    return y;
+}
+const vector<shared_ptr<Value>> &MLP::parameters()
+{
+    if (params.empty())
+    {
+        for (auto &layer : layers)
+        {
+            auto &p = layer.parameters();
+            params.insert(params.end(), p.begin(), p.end());
+        }
+    }
+    return params;
+}
+vector<ParameterBlock> MLP::blocks()
+{
+    vector<ParameterBlock> out;
+    for (auto &layer : layers)
+    {
+        auto b = layer.blocks();
+        out.insert(out.end(), b.begin(), b.end());
+    }
+    return out;
 }
 
-// softMax function definition
-vector<shared_ptr<Value>> softMax(vector<shared_ptr<Value>> x)
+// Softmax of one sample as a single node, shifted by the maximum so that
+// large logits cannot overflow
+class SoftmaxOp : public FusedOp
 {
-    // shared_ptr<Value> s = make_shared<Value>(0);
-    vector<shared_ptr<Value>> r;
-    for (auto k : x)
+public:
+    void forward(const float *x, int n, float *y, int m) override
     {
-        r.push_back(exp(k));
-        // s = s + r.back();
+        float mx = *max_element(x, x + n);
+        float s = 0;
+        for (int i = 0; i < n; i++)
+        {
+            y[i] = std::exp(x[i] - mx);
+            s += y[i];
+        }
+        for (int i = 0; i < n; i++)
+        {
+            y[i] /= s;
+        }
     }
-    auto s = sum(r);
-    for (int i = 0; i < r.size(); i++)
+    // gx = y * (gy - gy . y)
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
     {
-        r[i] = r[i] / s;
+        float d = dot(gy, y, n);
+        for (int i = 0; i < n; i++)
+        {
+            gx[i] += y[i] * (gy[i] - d);
+        }
     }
-    return r;
+    const char *name() override
+    {
+        return "softmax";
+    }
+};
+
+// log(sum(exp(x))) of one row, shifted by its maximum
+static float logSumExp(const float *x, int k)
+{
+    float mx = *max_element(x, x + k);
+    float s = 0;
+    for (int i = 0; i < k; i++)
+    {
+        s += std::exp(x[i] - mx);
+    }
+    return mx + std::log(s);
+}
+
+// Mean over a batch of the cross-entropy between softmax(logits) and target
+// distributions. The inputs are the logits of every sample followed by the
+// targets, k per sample; the loss is the single output.
+class CrossEntropyOp : public FusedOp
+{
+public:
+    CrossEntropyOp(int k) : k{k} {}
+
+    void forward(const float *x, int n, float *y, int m) override
+    {
+        int batch = n / (2 * k);
+        const float *t = x + n / 2;
+        float loss = 0;
+        for (int s = 0; s < batch; s++, x += k, t += k)
+        {
+            // -sum t log softmax(x) = sum t (lse - x)
+            float lse = logSumExp(x, k);
+            for (int i = 0; i < k; i++)
+            {
+                loss += t[i] * (lse - x[i]);
+            }
+        }
+        y[0] = loss / batch;
+    }
+    // d/dx = (softmax(x) * sum(t) - t) / batch, d/dt = (lse - x) / batch
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        int batch = n / (2 * k);
+        const float *t = x + n / 2;
+        float *gt = gx + n / 2;
+        float g = gy[0] / batch;
+        for (int s = 0; s < batch; s++, x += k, t += k, gx += k, gt += k)
+        {
+            float lse = logSumExp(x, k);
+            float mass = 0;
+            for (int i = 0; i < k; i++)
+            {
+                mass += t[i];
+            }
+            for (int i = 0; i < k; i++)
+            {
+                gx[i] += g * (std::exp(x[i] - lse) * mass - t[i]);
+                gt[i] += g * (lse - x[i]);
+            }
+        }
+    }
+    const char *name() override
+    {
+        return "cross_entropy";
+    }
+
+private:
+    int k;
+};
+
+// Mean squared error over all the elements: the predictions followed by the
+// targets as inputs, the loss as the single output
+class MseOp : public FusedOp
+{
+public:
+    void forward(const float *x, int n, float *y, int m) override
+    {
+        int half = n / 2;
+        float loss = 0;
+        for (int i = 0; i < half; i++)
+        {
+            float d = x[i] - x[half + i];
+            loss += d * d;
+        }
+        y[0] = loss / half;
+    }
+    void backward(const float *x, int n, const float *y, const float *gy, int m, float *gx) override
+    {
+        int half = n / 2;
+        float g = 2 * gy[0] / half;
+        for (int i = 0; i < half; i++)
+        {
+            float d = g * (x[i] - x[half + i]);
+            gx[i] += d;
+            gx[half + i] -= d;
+        }
+    }
+    const char *name() override
+    {
+        return "mse";
+    }
+};
+
+vector<shared_ptr<Value>> softMax(vector<shared_ptr<Value>> x)
+{
+    static const shared_ptr<FusedOp> op = make_shared<SoftmaxOp>();
+    if (x.empty())
+    {
+        return {};
+    }
+    return apply(op, x, x.size());
 }
 
 // cross entropy loss function
 shared_ptr<Value> simpleLoss(vector<shared_ptr<Value>> pred, vector<shared_ptr<Value>> y)
 {
-    auto loss = make_shared<Value>(0);
+    auto loss = Value::create(0);
     if (pred.size() != y.size())
         throw runtime_error("pred and y different sizes");
 
+    // One expression node per element, for the running sum and the squared
+    // difference together
     for (int i = 0; i < pred.size(); i++)
     {
-        auto dif = (pred[i] - y[i]);
-        loss = loss + (dif * dif);
+        loss = loss + square(expr(pred[i]) - y[i]);
     }
-    loss = loss / make_shared<Value>(pred.size());
+    loss = expr(loss) / float(pred.size());
     return loss;
-}
\ No newline at end of file
+}
+// Softmax of every sample of a batch
+vector<vector<shared_ptr<Value>>> softMax(const vector<vector<shared_ptr<Value>>> &x)
+{
+    vector<vector<shared_ptr<Value>>> r;
+    for (auto &row : x)
+    {
+        r.push_back(softMax(row));
+    }
+    return r;
+}
+
+// Mean of the per-sample losses of a batch
+shared_ptr<Value> simpleLoss(const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y)
+{
+    if (pred.size() != y.size())
+        throw runtime_error("pred and y different batch sizes");
+    if (pred.empty())
+        throw runtime_error("Empty loss inputs");
+
+    vector<shared_ptr<Value>> losses;
+    for (int i = 0; i < pred.size(); i++)
+    {
+        losses.push_back(simpleLoss(pred[i], y[i]));
+    }
+    return sum(losses) / Value::create(pred.size());
+}
+
+// The predictions of every sample followed by the targets, checking that
+// all the samples have k elements
+static vector<shared_ptr<Value>> lossInputs(const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y, int &k)
+{
+    if (pred.size() != y.size())
+        throw runtime_error("pred and y different batch sizes");
+    if (pred.empty() || pred[0].empty())
+        throw runtime_error("Empty loss inputs");
+
+    k = pred[0].size();
+    vector<shared_ptr<Value>> in;
+    in.reserve(2 * pred.size() * k);
+    for (auto &row : pred)
+    {
+        if (row.size() != k)
+            throw runtime_error("pred rows of different sizes");
+        in.insert(in.end(), row.begin(), row.end());
+    }
+    for (auto &row : y)
+    {
+        if (row.size() != k)
+            throw runtime_error("pred and y different sizes");
+        in.insert(in.end(), row.begin(), row.end());
+    }
+    return in;
+}
+
+shared_ptr<Value> crossEntropy(const vector<shared_ptr<Value>> &logits, const vector<shared_ptr<Value>> &y)
+{
+    return crossEntropy(vector<vector<shared_ptr<Value>>>{logits}, vector<vector<shared_ptr<Value>>>{y});
+}
+
+shared_ptr<Value> crossEntropy(const vector<vector<shared_ptr<Value>>> &logits, const vector<vector<shared_ptr<Value>>> &y)
+{
+    int k;
+    auto in = lossInputs(logits, y, k);
+    return apply(make_shared<CrossEntropyOp>(k), in, 1)[0];
+}
+
+shared_ptr<Value> mseLoss(const vector<shared_ptr<Value>> &pred, const vector<shared_ptr<Value>> &y)
+{
+    return mseLoss(vector<vector<shared_ptr<Value>>>{pred}, vector<vector<shared_ptr<Value>>>{y});
+}
+
+shared_ptr<Value> mseLoss(const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y)
+{
+    // MseOp holds no state, one instance is shared
+    static const shared_ptr<FusedOp> op = make_shared<MseOp>();
+    int k;
+    auto in = lossInputs(pred, y, k);
+    return apply(op, in, 1)[0];
+}
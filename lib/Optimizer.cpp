@@ -0,0 +1,170 @@
+#include "../include/Optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+// Blocks shorter than this are cheaper to gather than to update in place
+static const long min_block = 8;
+// Largest run handed to one kernel call, and size of the gather buffers
+static const long chunk = 1 << 12;
+
+Optimizer::Optimizer(Module &model, float lr) : lr{lr}, total{0}
+{
+    for (auto &b : model.blocks())
+    {
+        if (b.n >= min_block)
+        {
+            blocks.push_back(b);
+            total += b.n;
+            continue;
+        }
+        for (long i = 0; i < b.n; i++)
+        {
+            scattered.push_back({b.data + i, b.grad + i});
+        }
+    }
+    total += scattered.size();
+    gw.resize(min<long>(chunk, scattered.size()));
+    gg.resize(gw.size());
+}
+
+long Optimizer::size()
+{
+    return total;
+}
+
+void Optimizer::step()
+{
+    begin();
+    long offset = 0;
+    for (auto &b : blocks)
+    {
+        for (long i = 0; i < b.n; i += chunk)
+        {
+            update(b.data + i, b.grad + i, min(chunk, b.n - i), offset + i);
+        }
+        offset += b.n;
+    }
+    for (long i = 0; i < (long)scattered.size(); i += chunk)
+    {
+        int n = min<long>(chunk, scattered.size() - i);
+        for (int k = 0; k < n; k++)
+        {
+            gw[k] = *scattered[i + k].first;
+            gg[k] = *scattered[i + k].second;
+        }
+        update(gw.data(), gg.data(), n, offset + i);
+        for (int k = 0; k < n; k++)
+        {
+            *scattered[i + k].first = gw[k];
+            *scattered[i + k].second = 0;
+        }
+    }
+}
+
+void Optimizer::zero_grad()
+{
+    for (auto &b : blocks)
+    {
+        memset(b.grad, 0, b.n * sizeof(float));
+    }
+    for (auto &p : scattered)
+    {
+        *p.second = 0;
+    }
+}
+
+bool Optimizer::scale_grad(float f)
+{
+    bool finite = true;
+    for (auto &b : blocks)
+    {
+        for (long i = 0; i < b.n; i++)
+        {
+            b.grad[i] *= f;
+            finite = finite && std::isfinite(b.grad[i]);
+        }
+    }
+    for (auto &p : scattered)
+    {
+        *p.second *= f;
+        finite = finite && std::isfinite(*p.second);
+    }
+    return finite;
+}
+
+SGD::SGD(Module &model, float lr, float momentum, float weight_decay) : Optimizer(model, lr), momentum{momentum}, weight_decay{weight_decay}
+{
+    velocity.assign(size(), 0);
+}
+
+void SGD::update(float *w, float *g, int n, long offset)
+{
+    sgd_update(w, g, velocity.data() + offset, n, lr, momentum, weight_decay);
+}
+
+Adam::Adam(Module &model, float lr, float beta1, float beta2, float eps, float weight_decay) : Optimizer(model, lr), beta1{beta1}, beta2{beta2}, eps{eps}, weight_decay{weight_decay}, decoupled{false}, t{0}
+{
+    m.assign(size(), 0);
+    v.assign(size(), 0);
+}
+
+void Adam::begin()
+{
+    t++;
+    current.lr = lr;
+    current.beta1 = beta1;
+    current.beta2 = beta2;
+    current.eps = eps;
+    current.c1 = 1 / (1 - pow(beta1, (double)t));
+    current.c2 = 1 / (1 - pow(beta2, (double)t));
+    current.l2 = decoupled ? 0 : weight_decay;
+    current.decay = decoupled ? weight_decay : 0;
+}
+
+void Adam::update(float *w, float *g, int n, long offset)
+{
+    adam_update(w, g, m.data() + offset, v.data() + offset, n, current);
+}
+
+AdamW::AdamW(Module &model, float lr, float beta1, float beta2, float eps, float weight_decay) : Adam(model, lr, beta1, beta2, eps, weight_decay)
+{
+    decoupled = true;
+}
+
+LossScaler::LossScaler(Optimizer &optimizer, float scale, int interval) : optimizer{optimizer}, current{scale}, interval{interval}, good{0}
+{
+    if (scale <= 0 || interval <= 0)
+    {
+        throw runtime_error("Invalid loss scaler settings");
+    }
+}
+
+shared_ptr<Value> LossScaler::scale(const shared_ptr<Value> &loss)
+{
+    return loss * Value::create(current);
+}
+
+bool LossScaler::step()
+{
+    if (!optimizer.scale_grad(1 / current))
+    {
+        optimizer.zero_grad();
+        current = max(current / 2, 1.0f);
+        good = 0;
+        return false;
+    }
+    optimizer.step();
+    if (++good == interval)
+    {
+        current *= 2;
+        good = 0;
+    }
+    return true;
+}
+
+float LossScaler::getScale()
+{
+    return current;
+}
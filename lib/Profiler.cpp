@@ -0,0 +1,306 @@
+#include "../include/Profiler.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static const int opCount = int(Op::custom) + 1;
+static const char *opNames[opCount] = {"leaf", "add", "mul", "pow", "exp", "log", "tanh", "relu", "sum", "fused", "output", "expr", "custom"};
+// Trace events kept per thread, so a long run cannot exhaust memory
+static const size_t maxEvents = 1 << 20;
+
+struct Counter
+{
+    long count = 0;
+    long ns = 0;
+    long bytes = 0;
+
+    void add(long t, long b)
+    {
+        count++;
+        ns += t;
+        bytes += b;
+    }
+};
+
+struct TraceEvent
+{
+    string name;
+    long start;
+    long ns;
+};
+
+// Counters of one thread. Its lock is only contended while they are read.
+struct ThreadProfile
+{
+    mutex m;
+    int tid;
+    Counter nodes[opCount];
+    Counter backward[opCount];
+    unordered_map<string, Counter> fusedNodes;
+    unordered_map<string, Counter> fusedBackward;
+    unordered_map<string, Counter> spans;
+    vector<TraceEvent> events;
+};
+
+atomic<bool> Profiler::active{false};
+
+// Kept after their thread exits, so nothing recorded is lost
+static mutex registry;
+static vector<shared_ptr<ThreadProfile>> threads;
+
+static ThreadProfile &local()
+{
+    static thread_local shared_ptr<ThreadProfile> p;
+    if (!p)
+    {
+        p = make_shared<ThreadProfile>();
+        lock_guard<mutex> lock(registry);
+        p->tid = threads.size();
+        threads.push_back(p);
+    }
+    return *p;
+}
+
+void Profiler::enable(bool on)
+{
+    active = on;
+}
+
+void Profiler::reset()
+{
+    lock_guard<mutex> r(registry);
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        fill(begin(p->nodes), end(p->nodes), Counter());
+        fill(begin(p->backward), end(p->backward), Counter());
+        p->fusedNodes.clear();
+        p->fusedBackward.clear();
+        p->spans.clear();
+        p->events.clear();
+    }
+}
+
+void Profiler::node(Op op, long start, long bytes)
+{
+    long t = now() - start;
+    auto &p = local();
+    lock_guard<mutex> lock(p.m);
+    p.nodes[int(op)].add(t, bytes);
+}
+void Profiler::backward(Op op, long start)
+{
+    long t = now() - start;
+    auto &p = local();
+    lock_guard<mutex> lock(p.m);
+    p.backward[int(op)].add(t, 0);
+}
+void Profiler::fused(const char *name, long start, long bytes)
+{
+    long t = now() - start;
+    auto &p = local();
+    lock_guard<mutex> lock(p.m);
+    p.fusedNodes[name].add(t, bytes);
+}
+void Profiler::fusedBackward(const char *name, long start)
+{
+    long t = now() - start;
+    auto &p = local();
+    lock_guard<mutex> lock(p.m);
+    p.fusedBackward[name].add(t, 0);
+}
+void Profiler::span(const string &name, long start)
+{
+    long t = now() - start;
+    auto &p = local();
+    lock_guard<mutex> lock(p.m);
+    p.spans[name].add(t, 0);
+    if (p.events.size() < maxEvents)
+    {
+        p.events.push_back({name, start, t});
+    }
+}
+
+static void add(map<string, ProfileStat> &out, const string &name, const Counter &c)
+{
+    if (c.count == 0)
+    {
+        return;
+    }
+    auto &s = out[name];
+    s.count += c.count;
+    s.ms += c.ns / 1e6;
+    s.bytes += c.bytes;
+}
+
+map<string, ProfileStat> Profiler::nodes()
+{
+    map<string, ProfileStat> out;
+    lock_guard<mutex> r(registry);
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        for (int i = 0; i < opCount; i++)
+        {
+            add(out, opNames[i], p->nodes[i]);
+        }
+        for (auto &f : p->fusedNodes)
+        {
+            add(out, "fused:" + f.first, f.second);
+        }
+    }
+    return out;
+}
+map<string, ProfileStat> Profiler::backwards()
+{
+    map<string, ProfileStat> out;
+    lock_guard<mutex> r(registry);
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        for (int i = 0; i < opCount; i++)
+        {
+            add(out, opNames[i], p->backward[i]);
+        }
+        for (auto &f : p->fusedBackward)
+        {
+            add(out, "fused:" + f.first, f.second);
+        }
+    }
+    return out;
+}
+map<string, ProfileStat> Profiler::spans()
+{
+    map<string, ProfileStat> out;
+    lock_guard<mutex> r(registry);
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        for (auto &s : p->spans)
+        {
+            add(out, s.first, s.second);
+        }
+    }
+    return out;
+}
+
+// Most time first
+static void table(ostream &out, const string &title, const map<string, ProfileStat> &stats)
+{
+    vector<pair<string, ProfileStat>> rows(stats.begin(), stats.end());
+    sort(rows.begin(), rows.end(), [](const pair<string, ProfileStat> &a, const pair<string, ProfileStat> &b)
+         { return a.second.ms > b.second.ms; });
+    out << left << setw(24) << title << right << setw(12) << "count" << setw(14) << "ms" << setw(14) << "bytes" << '\n';
+    for (auto &r : rows)
+    {
+        out << left << setw(24) << r.first << right << setw(12) << r.second.count << setw(14) << fixed << setprecision(3)
+            << r.second.ms << setw(14) << r.second.bytes << '\n';
+    }
+}
+
+string Profiler::report()
+{
+    ostringstream out;
+    table(out, "nodes", nodes());
+    out << '\n';
+    table(out, "backward", backwards());
+    out << '\n';
+    table(out, "spans", spans());
+    return out.str();
+}
+
+static string quote(const string &s)
+{
+    string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void section(ostream &out, const char *name, const map<string, ProfileStat> &stats)
+{
+    out << quote(name) << ": {";
+    bool first = true;
+    for (auto &s : stats)
+    {
+        out << (first ? "" : ", ") << quote(s.first) << ": {\"count\": " << s.second.count << ", \"ms\": " << s.second.ms
+            << ", \"bytes\": " << s.second.bytes << "}";
+        first = false;
+    }
+    out << "}";
+}
+
+string Profiler::json()
+{
+    ostringstream out;
+    out << setprecision(9) << "{";
+    section(out, "nodes", nodes());
+    out << ", ";
+    section(out, "backward", backwards());
+    out << ", ";
+    section(out, "spans", spans());
+    out << "}\n";
+    return out.str();
+}
+
+string Profiler::trace()
+{
+    lock_guard<mutex> r(registry);
+    // Timestamps relative to the first event
+    long origin = 0;
+    bool any = false;
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        for (auto &e : p->events)
+        {
+            origin = any ? min(origin, e.start) : e.start;
+            any = true;
+        }
+    }
+    ostringstream out;
+    out << fixed << setprecision(3) << "{\"traceEvents\": [";
+    bool first = true;
+    for (auto &p : threads)
+    {
+        lock_guard<mutex> lock(p->m);
+        for (auto &e : p->events)
+        {
+            out << (first ? "\n" : ",\n") << "{\"name\": " << quote(e.name) << ", \"ph\": \"X\", \"ts\": " << (e.start - origin) / 1e3
+                << ", \"dur\": " << e.ns / 1e3 << ", \"pid\": 0, \"tid\": " << p->tid << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+static void write(const string &path, const string &text)
+{
+    ofstream file(path, ios::trunc);
+    file << text;
+    if (!file)
+    {
+        throw runtime_error("Error writing " + path);
+    }
+}
+void Profiler::writeJson(const string &path)
+{
+    write(path, json());
+}
+void Profiler::writeTrace(const string &path)
+{
+    write(path, trace());
+}
@@ -0,0 +1,202 @@
+#include "../include/Quantized.hpp"
+#include <cmath>
+#include <sstream>
+using namespace std;
+
+QuantizedMLP::QuantizedMLP(MLP &model, const float *calibration, int n)
+{
+    vector<vector<unsigned char>> acts(model.layers.size());
+    vector<vector<float>> params(model.layers.size());
+    vector<CheckpointLayer> source;
+    for (int i = 0; i < model.layers.size(); i++)
+    {
+        source.push_back(model.layers[i].checkpoint(acts[i], params[i]));
+    }
+    init(source, calibration, n);
+}
+QuantizedMLP::QuantizedMLP(const Checkpoint &checkpoint, const float *calibration, int n)
+{
+    vector<CheckpointLayer> source;
+    for (int i = 0; i < checkpoint.layers(); i++)
+    {
+        source.push_back(checkpoint.layer(i));
+    }
+    init(source, calibration, n);
+}
+
+static void activate(activation act, float *y, int n)
+{
+    switch (act)
+    {
+    case activation::relu:
+        relu_forward(y, n);
+        break;
+    case activation::tanh:
+        tanh_forward(y, n);
+        break;
+    default:
+        break;
+    }
+}
+// n samples of nout outputs, over the whole batch at once when every row
+// has the same activation
+static void activate(const vector<activation> &acts, bool uniform, float *y, int n, int nout)
+{
+    if (uniform)
+    {
+        activate(acts[0], y, n * nout);
+        return;
+    }
+    for (long i = 0; i < (long)n * nout; i++)
+    {
+        activate(acts[i % nout], y + i, 1);
+    }
+}
+
+// Symmetric scale mapping [-m, m] to [-127, 127]
+static float scaleFor(float m)
+{
+    return m > 0 ? m / 127 : 1;
+}
+static float maxAbs(const float *x, long n)
+{
+    float m = 0;
+    for (long i = 0; i < n; i++)
+    {
+        m = max(m, fabs(x[i]));
+    }
+    return m;
+}
+
+void QuantizedMLP::init(const vector<CheckpointLayer> &source, const float *calibration, int n)
+{
+    if (n < 1)
+    {
+        throw runtime_error("Quantization needs calibration samples");
+    }
+    // The calibration data runs through the float layers, recording the
+    // range of every layer's input on the way
+    vector<float> x(calibration, calibration + (long)n * (source.empty() ? 0 : source[0].nin)), y;
+    for (auto &l : source)
+    {
+        Layer q{l.nin, l.nout};
+        const float *W = l.params;
+        const float *b = l.params + (long)l.nout * l.nin;
+        float sx = scaleFor(maxAbs(x.data(), x.size()));
+        q.inv = 1 / sx;
+        q.W.resize((long)l.nout * l.nin);
+        for (int r = 0; r < l.nout; r++)
+        {
+            const float *row = W + (long)r * l.nin;
+            float sw = scaleFor(maxAbs(row, l.nin));
+            quantize_i8(row, q.W.data() + (long)r * l.nin, 1 / sw, l.nin);
+            q.scale.push_back(sx * sw);
+            q.b.push_back(b[r]);
+            q.acts.push_back(activation(l.acts[r]));
+        }
+        q.uniform = all_of(q.acts.begin(), q.acts.end(), [&](activation a)
+                           { return a == q.acts[0]; });
+
+        y.resize((long)n * l.nout);
+        gemm_nt(x.data(), W, b, y.data(), n, l.nout, l.nin);
+        activate(q.acts, q.uniform, y.data(), n, l.nout);
+        swap(x, y);
+        layers.push_back(move(q));
+    }
+}
+
+void QuantizedMLP::predict(const float *x, float *y, int n)
+{
+    // Quantized input, int32 products and ping-pong activations, kept per thread
+    static thread_local vector<int8_t> q;
+    static thread_local vector<int32_t> acc;
+    static thread_local vector<float> a, b;
+    const float *in = x;
+    for (int i = 0; i < layers.size(); i++)
+    {
+        auto &l = layers[i];
+        float *out = y;
+        if (i + 1 < layers.size())
+        {
+            auto &buffer = i % 2 ? b : a;
+            buffer.resize((long)n * l.nout);
+            out = buffer.data();
+        }
+        q.resize((long)n * l.nin);
+        acc.resize((long)n * l.nout);
+        quantize_i8(in, q.data(), l.inv, n * l.nin);
+        gemm_nt_i8(q.data(), l.W.data(), acc.data(), n, l.nout, l.nin);
+        for (int s = 0; s < n; s++)
+        {
+            const int32_t *as = acc.data() + (long)s * l.nout;
+            float *ys = out + (long)s * l.nout;
+            for (int r = 0; r < l.nout; r++)
+            {
+                ys[r] = as[r] * l.scale[r] + l.b[r];
+            }
+        }
+        activate(l.acts, l.uniform, out, n, l.nout);
+        in = out;
+    }
+}
+vector<float> QuantizedMLP::predict(const vector<float> &x)
+{
+    if (x.size() != inputs())
+    {
+        throw runtime_error("Input size mismatch in QuantizedMLP::predict");
+    }
+    vector<float> y(outputs());
+    predict(x.data(), y.data());
+    return y;
+}
+int QuantizedMLP::inputs()
+{
+    return layers.empty() ? 0 : layers.front().nin;
+}
+int QuantizedMLP::outputs()
+{
+    return layers.empty() ? 0 : layers.back().nout;
+}
+long QuantizedMLP::bytes()
+{
+    long total = 0;
+    for (auto &l : layers)
+    {
+        total += l.W.size() + (l.scale.size() + l.b.size()) * sizeof(float);
+    }
+    return total;
+}
+
+QuantizationReport compareQuantized(MLP &model, QuantizedMLP &quantized, const float *x, int n)
+{
+    int k = model.outputs();
+    vector<float> expected((long)n * k), actual((long)n * k);
+    model.predict(x, expected.data(), n);
+    quantized.predict(x, actual.data(), n);
+    QuantizationReport r{n, 0, 0, 0};
+    double total = 0;
+    int agree = 0;
+    for (int s = 0; s < n; s++)
+    {
+        const float *e = expected.data() + (long)s * k;
+        const float *a = actual.data() + (long)s * k;
+        for (int i = 0; i < k; i++)
+        {
+            float d = fabs(e[i] - a[i]);
+            r.maxError = max(r.maxError, d);
+            total += d;
+        }
+        agree += max_element(e, e + k) - e == max_element(a, a + k) - a;
+    }
+    r.meanError = total / max(1L, (long)n * k);
+    r.agreement = n ? float(agree) / n : 1;
+    return r;
+}
+
+string QuantizationReport::str()
+{
+    ostringstream out;
+    out << samples << " samples | max error = " << maxError << " | mean error = " << meanError
+        << " | argmax agreement = " << agreement * 100 << " %";
+    return out.str();
+}
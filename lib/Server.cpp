@@ -0,0 +1,133 @@
+#include "../include/Server.hpp"
+using namespace std;
+
+InferenceServer::InferenceServer(MLP &source, int maxBatch, chrono::microseconds maxDelay, int threads)
+    : model{source.clone()}, maxBatch{maxBatch}, maxDelay{maxDelay}, counts{0, 0, 0}, stop{false}
+{
+    if (maxBatch < 1 || threads < 1)
+    {
+        throw runtime_error("InferenceServer needs a batch size and a worker count of at least 1");
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&InferenceServer::work, this);
+    }
+}
+
+InferenceServer::~InferenceServer()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stop = true;
+    }
+    ready.notify_all();
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+}
+
+future<vector<float>> InferenceServer::submit(vector<float> x)
+{
+    if (x.size() != inputs())
+    {
+        throw runtime_error("Input size mismatch in InferenceServer::submit");
+    }
+    Request r{move(x), promise<vector<float>>(), chrono::steady_clock::now()};
+    auto f = r.result.get_future();
+    bool wake;
+    {
+        lock_guard<mutex> lock(m);
+        queue.push_back(move(r));
+        counts.requests++;
+        // A waiting worker only needs waking for a new batch or a full one
+        wake = queue.size() == 1 || queue.size() >= maxBatch;
+    }
+    if (wake)
+    {
+        ready.notify_one();
+    }
+    return f;
+}
+
+void InferenceServer::work()
+{
+    vector<Request> batch;
+    vector<float> x, y;
+    int nin = inputs(), nout = outputs();
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(m);
+            ready.wait(lock, [&]()
+                       { return stop || !queue.empty(); });
+            if (queue.empty())
+            {
+                return;
+            }
+            // Wait for a full batch until the oldest request's deadline.
+            // While stopping, what is queued runs right away.
+            auto deadline = queue.front().arrival + maxDelay;
+            ready.wait_until(lock, deadline, [&]()
+                             { return stop || queue.empty() || queue.size() >= maxBatch; });
+            if (queue.empty())
+            {
+                // Taken by another worker
+                continue;
+            }
+            int n = min<int>(queue.size(), maxBatch);
+            for (int i = 0; i < n; i++)
+            {
+                batch.push_back(move(queue.front()));
+                queue.pop_front();
+            }
+            counts.batches++;
+            counts.full += n == maxBatch;
+            // Another worker can start on what is left
+            if (!queue.empty())
+            {
+                ready.notify_one();
+            }
+        }
+
+        int n = batch.size();
+        x.resize((long)n * nin);
+        y.resize((long)n * nout);
+        for (int s = 0; s < n; s++)
+        {
+            copy(batch[s].x.begin(), batch[s].x.end(), x.begin() + (long)s * nin);
+        }
+        try
+        {
+            model.predict(x.data(), y.data(), n);
+        }
+        catch (...)
+        {
+            for (auto &r : batch)
+            {
+                r.result.set_exception(current_exception());
+            }
+            batch.clear();
+            continue;
+        }
+        for (int s = 0; s < n; s++)
+        {
+            batch[s].result.set_value(vector<float>(y.begin() + (long)s * nout, y.begin() + (long)(s + 1) * nout));
+        }
+        batch.clear();
+    }
+}
+
+int InferenceServer::inputs()
+{
+    return model.inputs();
+}
+int InferenceServer::outputs()
+{
+    return model.outputs();
+}
+ServerStats InferenceServer::stats()
+{
+    lock_guard<mutex> lock(m);
+    return counts;
+}
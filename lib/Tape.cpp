@@ -0,0 +1,289 @@
+#include "../include/Tape.hpp"
+#include "../include/Profiler.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+using namespace std;
+
+Tape::Tape(const vector<shared_ptr<Value>> &inputs, const vector<shared_ptr<Value>> &outputs) : nin(inputs.size())
+{
+    // Inputs take the first slots, every other node gets its own slot (a
+    // fused node one per output) in topological order
+    unordered_map<Value *, int> slot;
+    int next = 0;
+    for (auto &x : inputs)
+    {
+        if (x->op != Op::leaf || !x->prev.empty())
+        {
+            throw runtime_error("Tape inputs must be leaves");
+        }
+        if (!slot.emplace(x.get(), next++).second)
+        {
+            throw runtime_error("Tape input given twice");
+        }
+    }
+
+    vector<Value *> roots;
+    for (auto &y : outputs)
+    {
+        roots.push_back(y.get());
+    }
+    vector<Value *> order;
+    build_topo(roots, order);
+
+    size_t width = 0;
+    for (Value *v : order)
+    {
+        if (slot.count(v))
+        {
+            continue;
+        }
+        Instr in{v->op, next, 0, 0, v->aux, nullptr, 1, nullptr};
+        switch (v->op)
+        {
+        case Op::leaf:
+            slot[v] = next;
+            bound.push_back({next++, v->shared_from_this()});
+            continue;
+        case Op::output:
+            // Aliases the slot of the fused node's output
+            slot[v] = slot.at(v->prev[0].get()) + v->index;
+            continue;
+        case Op::custom:
+            throw runtime_error("Tape cannot compile a node with a user-defined backward");
+        case Op::fused:
+        {
+            auto state = static_cast<FusedNode *>(v->ctx.get());
+            in.fused = state->op.get();
+            in.m = state->y.size();
+            ops.push_back(state->op);
+            width = max(width, v->prev.size());
+        }
+            // fall through
+        case Op::expr:
+            if (v->op == Op::expr)
+            {
+                in.rule = static_cast<ExprRule *>(v->ctx.get());
+                rules.push_back(static_pointer_cast<ExprRule>(v->ctx));
+                width = max(width, v->prev.size());
+            }
+            // fall through
+        case Op::sum:
+            in.a = args.size();
+            in.b = v->prev.size();
+            for (auto &c : v->prev)
+            {
+                args.push_back(slot.at(c.get()));
+            }
+            break;
+        default:
+            in.a = slot.at(v->prev[0].get());
+            // x * x may be recorded with a single child
+            in.b = v->prev.size() > 1 ? slot.at(v->prev[1].get()) : in.a;
+        }
+        slot[v] = next;
+        next += in.m;
+        code.push_back(in);
+    }
+
+    for (auto &y : outputs)
+    {
+        outs.push_back(slot.at(y.get()));
+    }
+    value.assign(next, 0);
+    grad.assign(next, 0);
+    fx.resize(width);
+    fgx.resize(width);
+}
+
+void Tape::forward(const float *x)
+{
+    ProfileScope scope("tape forward");
+    copy(x, x + nin, value.begin());
+    for (auto &b : bound)
+    {
+        value[b.first] = *b.second->data;
+    }
+
+    float *v = value.data();
+    const int *arg = args.data();
+    for (const Instr &in : code)
+    {
+        switch (in.op)
+        {
+        case Op::add:
+            v[in.out] = v[in.a] + v[in.b];
+            break;
+        case Op::mul:
+            v[in.out] = v[in.a] * v[in.b];
+            break;
+        case Op::pow:
+            v[in.out] = pow(v[in.a], in.aux);
+            break;
+        case Op::exp:
+            v[in.out] = exp(v[in.a]);
+            break;
+        case Op::log:
+            v[in.out] = log(v[in.a]);
+            break;
+        case Op::tanh:
+            v[in.out] = std::tanh(v[in.a]);
+            break;
+        case Op::relu:
+            v[in.out] = (v[in.a] + abs(v[in.a])) / 2;
+            break;
+        case Op::sum:
+        {
+            float s = 0;
+            for (int k = 0; k < in.b; k++)
+            {
+                s += v[arg[in.a + k]];
+            }
+            v[in.out] = s;
+            break;
+        }
+        case Op::fused:
+            for (int k = 0; k < in.b; k++)
+            {
+                fx[k] = v[arg[in.a + k]];
+            }
+            in.fused->forward(fx.data(), in.b, v + in.out, in.m);
+            break;
+        case Op::expr:
+            for (int k = 0; k < in.b; k++)
+            {
+                fx[k] = v[arg[in.a + k]];
+            }
+            v[in.out] = in.rule->forward(fx.data());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+float Tape::output(int i) const
+{
+    return value[outs[i]];
+}
+
+void Tape::backward()
+{
+    fill(grad.begin(), grad.end(), 0);
+    grad[outs[0]] = 1;
+    run_backward();
+}
+
+void Tape::backward(const float *gy)
+{
+    fill(grad.begin(), grad.end(), 0);
+    for (size_t i = 0; i < outs.size(); i++)
+    {
+        grad[outs[i]] += gy[i];
+    }
+    run_backward();
+}
+
+void Tape::run_backward()
+{
+    ProfileScope scope("tape backward");
+    const float *v = value.data();
+    float *g = grad.data();
+    const int *arg = args.data();
+    for (auto it = code.rbegin(); it != code.rend(); ++it)
+    {
+        const Instr &in = *it;
+        float go = g[in.out];
+        switch (in.op)
+        {
+        case Op::add:
+            g[in.a] += go;
+            g[in.b] += go;
+            break;
+        case Op::mul:
+            g[in.a] += v[in.b] * go;
+            g[in.b] += v[in.a] * go;
+            break;
+        case Op::pow:
+            g[in.a] += in.aux * pow(v[in.a], in.aux - 1) * go;
+            break;
+        case Op::exp:
+            g[in.a] += v[in.out] * go;
+            break;
+        case Op::log:
+            // As in backward, no gradient flows through log(0)
+            if (v[in.a] != 0)
+            {
+                g[in.a] += (1 / v[in.a]) * go;
+            }
+            break;
+        case Op::tanh:
+            g[in.a] += (1 - v[in.out] * v[in.out]) * go;
+            break;
+        case Op::relu:
+            g[in.a] += (v[in.a] > 0) * go;
+            break;
+        case Op::sum:
+            for (int k = 0; k < in.b; k++)
+            {
+                g[arg[in.a + k]] += go;
+            }
+            break;
+        case Op::fused:
+            for (int k = 0; k < in.b; k++)
+            {
+                fx[k] = v[arg[in.a + k]];
+            }
+            fill(fgx.begin(), fgx.begin() + in.b, 0);
+            in.fused->backward(fx.data(), in.b, v + in.out, g + in.out, in.m, fgx.data());
+            for (int k = 0; k < in.b; k++)
+            {
+                g[arg[in.a + k]] += fgx[k];
+            }
+            break;
+        case Op::expr:
+            for (int k = 0; k < in.b; k++)
+            {
+                fx[k] = v[arg[in.a + k]];
+            }
+            in.rule->gradient(fx.data(), fgx.data());
+            for (int k = 0; k < in.b; k++)
+            {
+                g[arg[in.a + k]] += fgx[k] * go;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (auto &b : bound)
+    {
+        *b.second->grad += grad[b.first];
+    }
+}
+
+float Tape::inputGrad(int i) const
+{
+    return grad[i];
+}
+
+int Tape::inputs() const
+{
+    return nin;
+}
+
+int Tape::outputs() const
+{
+    return outs.size();
+}
+
+int Tape::size() const
+{
+    return code.size();
+}
+
+int Tape::slots() const
+{
+    return value.size();
+}
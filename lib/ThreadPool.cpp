@@ -0,0 +1,143 @@
+#include "../include/ThreadPool.hpp"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(int threads) : job{nullptr}, next{0}, pending{0}, total{0}, active{0}, generation{0}, stop{false}
+{
+    for (int i = 1; i < threads; i++)
+    {
+        workers.emplace_back([this]()
+                             { work(); });
+    }
+}
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+}
+
+int ThreadPool::size()
+{
+    return workers.size() + 1;
+}
+
+void ThreadPool::claim(const function<void(int)> &f)
+{
+    for (int i = next++; i < total; i = next++)
+    {
+        f(i);
+        if (--pending == 0)
+        {
+            lock_guard<mutex> lock(m);
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::run(int tasks, const function<void(int)> &f)
+{
+    if (tasks <= 0)
+        return;
+    if (workers.empty() || tasks == 1)
+    {
+        for (int i = 0; i < tasks; i++)
+            f(i);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(m);
+        job = &f;
+        total = tasks;
+        next = 0;
+        pending = tasks;
+        generation++;
+    }
+    wake.notify_all();
+    claim(f);
+
+    // Also wait for late workers to leave, so none still holds this job
+    // when the next run resets the counters
+    unique_lock<mutex> lock(m);
+    done.wait(lock, [this]()
+              { return pending == 0 && active == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::work()
+{
+    unsigned long seen = 0;
+    while (true)
+    {
+        const function<void(int)> *f;
+        {
+            unique_lock<mutex> lock(m);
+            wake.wait(lock, [&]()
+                      { return stop || (job && generation != seen); });
+            if (stop)
+                return;
+            seen = generation;
+            f = job;
+            active++;
+        }
+        claim(*f);
+        {
+            lock_guard<mutex> lock(m);
+            active--;
+        }
+        done.notify_all();
+    }
+}
+
+// Held by the thread whose loop the intra-op pool is running
+static mutex intraOp;
+static unique_ptr<ThreadPool> intraPool;
+static atomic<int> intraThreads{1};
+static atomic<long> intraThreshold{1 << 18};
+// Set on the calling thread during its loop, so nested loops run inline
+static thread_local bool inLoop = false;
+
+void setIntraOpThreads(int threads)
+{
+    lock_guard<mutex> lock(intraOp);
+    threads = max(threads, 1);
+    intraPool = threads > 1 ? make_unique<ThreadPool>(threads) : nullptr;
+    intraThreads = threads;
+}
+int intraOpThreads()
+{
+    return intraThreads;
+}
+void setIntraOpThreshold(long work)
+{
+    intraThreshold = work;
+}
+long intraOpThreshold()
+{
+    return intraThreshold;
+}
+
+void parallelFor(int n, int grain, long work, const function<void(int, int)> &f)
+{
+    if (n <= 0)
+        return;
+    unique_lock<mutex> lock(intraOp, defer_lock);
+    if (work < intraThreshold || intraThreads < 2 || inLoop || !lock.try_lock())
+    {
+        f(0, n);
+        return;
+    }
+    int chunks = intraPool->size() * 4;
+    int size = (n + chunks - 1) / chunks;
+    size = (size + grain - 1) / grain * grain;
+    inLoop = true;
+    intraPool->run((n + size - 1) / size, [&](int t)
+                   { f(t * size, min(n, (t + 1) * size)); });
+    inLoop = false;
+}
@@ -0,0 +1,107 @@
+#include "../include/Trainer.hpp"
+#include <cstring>
+
+DataParallelTrainer::DataParallelTrainer(MLP &model, int threads, BatchLoss loss) : model{model}, pool{threads}, loss{loss}
+{
+    if (!this->loss)
+    {
+        this->loss = [](const vector<vector<shared_ptr<Value>>> &pred, const vector<vector<shared_ptr<Value>>> &y)
+        { return simpleLoss(pred, y); };
+    }
+    blocks = model.blocks();
+    for (int t = 0; t < pool.size(); t++)
+    {
+        replicas.push_back(model.clone());
+        replicaBlocks.push_back(replicas.back().blocks());
+        arenas.push_back(make_unique<GraphArena>());
+    }
+    losses.resize(pool.size());
+}
+
+int DataParallelTrainer::threads()
+{
+    return pool.size();
+}
+
+float DataParallelTrainer::computeGradients(const float *x, const float *y, int n)
+{
+    int nin = model.inputs();
+    int nout = model.outputs();
+    int workers = min(pool.size(), n);
+    // Settings changed on the model since the replicas were made
+    for (auto &r : replicas)
+    {
+        if (r.getPrecision() != model.getPrecision())
+        {
+            r.setPrecision(model.getPrecision());
+        }
+        r.setActivationCheckpointing(model.getActivationCheckpointing());
+    }
+
+    pool.run(workers, [&](int t)
+             {
+        // Pick up the current weights, then backpropagate this shard
+        for (int j = 0; j < blocks.size(); j++)
+        {
+            auto &b = replicaBlocks[t][j];
+            memcpy(b.data, blocks[j].data, b.n * sizeof(float));
+            memset(b.grad, 0, b.n * sizeof(float));
+        }
+        int begin = (long)n * t / workers;
+        int end = (long)n * (t + 1) / workers;
+        {
+            ArenaScope scope(*arenas[t]);
+            vector<vector<shared_ptr<Value>>> xs(end - begin), ys(end - begin);
+            for (int s = begin; s < end; s++)
+            {
+                for (int i = 0; i < nin; i++)
+                    xs[s - begin].push_back(Value::create(x[(long)s * nin + i]));
+                for (int i = 0; i < nout; i++)
+                    ys[s - begin].push_back(Value::create(y[(long)s * nout + i]));
+            }
+            // Weighted by the shard size, so the shards add up to the batch mean
+            auto l = loss(replicas[t](xs), ys) * Value::create(float(end - begin) / n);
+            l->backward();
+            losses[t] = l->getData();
+        }
+        arenas[t]->reset(); });
+
+    // Reduce the replicas' gradients, each task owning a slice of the parameters
+    int slices = pool.size();
+    pool.run(slices, [&](int k)
+             {
+        for (int j = 0; j < blocks.size(); j++)
+        {
+            long begin = blocks[j].n * k / slices;
+            long end = blocks[j].n * (k + 1) / slices;
+            float *g = blocks[j].grad + begin;
+            memset(g, 0, (end - begin) * sizeof(float));
+            for (int t = 0; t < workers; t++)
+            {
+                axpy(1, replicaBlocks[t][j].grad + begin, g, end - begin);
+            }
+        } });
+
+    float total = 0;
+    for (int t = 0; t < workers; t++)
+    {
+        total += losses[t];
+    }
+    return total;
+}
+
+float DataParallelTrainer::step(const float *x, const float *y, int n, float lr)
+{
+    float l = computeGradients(x, y, n);
+    for (auto &b : blocks)
+    {
+        axpy(-lr, b.grad, b.data, b.n);
+    }
+    return l;
+}
+float DataParallelTrainer::step(const float *x, const float *y, int n, Optimizer &optimizer)
+{
+    float l = computeGradients(x, y, n);
+    optimizer.step();
+    return l;
+}
@@ -1,33 +1,168 @@
 
 #include "include/ValueStruct.hpp"
+#include "include/Expr.hpp"
+#include "include/Profiler.hpp"
+#include "include/ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <numeric>
+#include <unordered_map>
 using namespace std;
 
 float Value::getData()
 {
-    return data;
+    return *data;
 }
 float Value::getGrad()
 {
-    return grad;
+    return *grad;
 }
 
 void Value::setData(float d)
 {
-    data = d;
+    *data = d;
 }
 void Value::setGrad(float g)
 {
+    *grad = g;
+}
+float *Value::dataPtr()
+{
+    return data;
+}
+float *Value::gradPtr()
+{
+    return grad;
+}
+
+shared_ptr<Value> Value::view(float *d, float *g, shared_ptr<void> keep)
+{
+    auto out = make_shared<Value>(0);
+    out->data = d;
+    out->grad = g;
+    out->ctx = move(keep);
+    return out;
+}
+
+void Value::bind(float *d, float *g, shared_ptr<void> keep)
+{
+    *d = *data;
+    *g = *grad;
+    data = d;
     grad = g;
+    ctx = move(keep);
+}
+
+shared_ptr<Value> Value::create(float d)
+{
+    if (GraphArena *arena = GraphArena::current())
+    {
+        return allocate_shared<Value>(ArenaAllocator<Value>(arena), d);
+    }
+    return make_shared<Value>(d);
+}
+shared_ptr<Value> Value::create(float d, initializer_list<shared_ptr<Value>> p)
+{
+    auto out = create(d);
+    out->prev.assign(p.begin(), p.end());
+    return out;
+}
+shared_ptr<Value> Value::create(float d, const vector<shared_ptr<Value>> &p)
+{
+    auto out = create(d);
+    out->prev.assign(p.begin(), p.end());
+    return out;
 }
 
-void Value::setBackward(function<void(shared_ptr<Value> &self)> funct)
+// Operations record graph nodes unless a NoGradScope is active on the thread
+static thread_local bool grad_enabled = true;
+
+shared_ptr<Value> Value::node(float d, Op op, initializer_list<shared_ptr<Value>> p)
 {
-    _backward = funct;
+    auto out = create(d);
+    if (grad_enabled)
+    {
+        out->prev.assign(p.begin(), p.end());
+        out->op = op;
+    }
+    return out;
+}
+shared_ptr<Value> Value::node(float d, Op op, const vector<shared_ptr<Value>> &p)
+{
+    auto out = create(d);
+    if (grad_enabled)
+    {
+        out->prev.assign(p.begin(), p.end());
+        out->op = op;
+    }
+    return out;
+}
+
+NoGradScope::NoGradScope() : previous{grad_enabled}
+{
+    grad_enabled = false;
+}
+NoGradScope::~NoGradScope()
+{
+    grad_enabled = previous;
+}
+bool gradEnabled()
+{
+    return grad_enabled;
+}
+
+shared_ptr<Value> Value::detach()
+{
+    // Always on the heap, so it may outlive the step's arena
+    return make_shared<Value>(*data);
+}
+
+void Value::release()
+{
+    ValueList(prev.get_allocator()).swap(prev);
+    // A leaf's ctx is the buffer it views
+    if (op != Op::leaf)
+    {
+        ctx.reset();
+    }
+    topo.reset();
+    op = Op::leaf;
+}
+
+void Value::profile(long start)
+{
+    Profiler::node(op, start, sizeof(Value) + prev.capacity() * sizeof(shared_ptr<Value>));
+}
+
+void Value::setBackward(function<void(Value *self)> funct)
+{
+    ctx = make_shared<function<void(Value *self)>>(move(funct));
+    op = Op::custom;
+}
+
+static atomic<bool> debug_labels{false};
+
+void Value::setDebug(bool on)
+{
+    debug_labels = on;
+}
+bool Value::debug()
+{
+    return debug_labels.load(memory_order_relaxed);
+}
+string Value::getLabel()
+{
+    return label ? *label : "";
+}
+void Value::setLabel(string l)
+{
+    label = make_unique<string>(move(l));
 }
 
 shared_ptr<Value> min(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    if (a->data < b->data)
+    if (*a->data < *b->data)
     {
         return a;
     }
@@ -35,7 +170,7 @@ shared_ptr<Value> min(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 }
 shared_ptr<Value> max(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    if (a->data > b->data)
+    if (*a->data > *b->data)
     {
         return a;
     }
@@ -44,168 +179,997 @@ shared_ptr<Value> max(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 
 shared_ptr<Value> sum(vector<shared_ptr<Value>> &args)
 {
+    long t = Profiler::start();
     float d = 0;
     for (auto &v : args)
     {
         d += v->getData();
     }
-    shared_ptr<Value> out = make_shared<Value>(d, args);
-    out->setBackward([](shared_ptr<Value> &self)
-                     {
-        for(auto &a: self->prev){
-            a->grad += self->grad;
-        } });
-
+    shared_ptr<Value> out = Value::node(d, Op::sum, args);
+    if (t)
+    {
+        out->profile(t);
+    }
     return out;
 }
 shared_ptr<Value> operator+(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    float d = a->data + b->data;
-    shared_ptr<Value> out = make_shared<Value>(d, vector{a, b});
-    out->l = a->l + "+" + b->l;
-    out->setBackward([](shared_ptr<Value> &self)
-                     {
-                         for(auto &a: self->prev){
-            a->grad += 1 * self->grad;
-        } });
+    long t = Profiler::start();
+    float d = *a->data + *b->data;
+    shared_ptr<Value> out = Value::node(d, Op::add, {a, b});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel(a->getLabel() + "+" + b->getLabel());
+    }
     return out;
 }
+// Negation, subtraction and division are single expression nodes rather
+// than a product with a constant, a power and a sum
 shared_ptr<Value> operator-(const shared_ptr<Value> &a)
 {
-    auto v = make_shared<Value>(-1);
-    return a * v;
+    shared_ptr<Value> out = -expr(a);
+    if (Value::debug())
+    {
+        out->setLabel("-" + a->getLabel());
+    }
+    return out;
 };
 shared_ptr<Value> operator-(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    return a + (-b);
+    shared_ptr<Value> out = expr(a) - b;
+    if (Value::debug())
+    {
+        out->setLabel(a->getLabel() + "-" + b->getLabel());
+    }
+    return out;
 };
 shared_ptr<Value> operator*(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    float d = a->data * b->data;
-    shared_ptr<Value> out = make_shared<Value>(d, vector{a, b});
-    out->l = a->l + "*" + b->l;
-
-    out->setBackward([](shared_ptr<Value> &self)
-                     {
-                        auto it = (self->prev).begin();
-                        if((self->prev).size()==1){
-                            shared_ptr<Value> v1 = *it;
-                            v1->grad += 2 * v1->data * self->grad;
-                            return;
-                        }
-                        
-                        shared_ptr<Value> v1 = *it;
-
-                        shared_ptr<Value> v2 = *(++it);
-
-                        v1->grad += v2->data * self->grad;
-                        v2->grad += v1->data * self->grad; });
+    long t = Profiler::start();
+    float d = *a->data * *b->data;
+    shared_ptr<Value> out = Value::node(d, Op::mul, {a, b});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel(a->getLabel() + "*" + b->getLabel());
+    }
     return out;
 }
 shared_ptr<Value> operator/(const shared_ptr<Value> &a, const shared_ptr<Value> &b)
 {
-    auto out = a * (b ^ (-1));
-    out->l = a->l + "/" + b->l;
+    shared_ptr<Value> out = expr(a) / b;
+    if (Value::debug())
+    {
+        out->setLabel(a->getLabel() + "/" + b->getLabel());
+    }
     return out;
 }
 shared_ptr<Value> operator^(const shared_ptr<Value> &v, float p)
 {
-    float d = pow(v->data, p);
-    shared_ptr<Value> out = make_shared<Value>(d, vector{v});
-    out->setBackward([p](shared_ptr<Value> &self)
-                     { 
-                        
-                        auto a = *(self->prev).begin();
-
-                        a->grad = (p * pow(a->data, p - 1)) * self->grad; });
-    out->l = v->l + "^" + to_string(p);
+    long t = Profiler::start();
+    float d = pow(*v->data, p);
+    shared_ptr<Value> out = Value::node(d, Op::pow, {v});
+    out->aux = p;
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel(v->getLabel() + "^" + to_string(p));
+    }
     return out;
 }
 shared_ptr<Value> exp(const shared_ptr<Value> &a)
 {
-    float d = exp(a->data);
-    auto out = make_shared<Value>(d, vector{a});
-
-    out->setBackward([d](shared_ptr<Value> &self)
-                     { 
-                        auto a = *(self->prev).begin();
-                        a->grad += d * self->grad; });
-    out->l = "exp(" + a->l + ")";
+    long t = Profiler::start();
+    float d = exp(*a->data);
+    auto out = Value::node(d, Op::exp, {a});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel("exp(" + a->getLabel() + ")");
+    }
     return out;
 }
 shared_ptr<Value> log(const shared_ptr<Value> &v)
 {
-    float d = log(v->data);
-    auto out = make_shared<Value>(d, vector{v});
-
-    out->setBackward([d](shared_ptr<Value> &self)
-                     { 
-                        auto a = *(self->prev).begin();
-                        if (a->data != 0) {
-            a->grad += (1 / a->data) * self->grad;
-        } else {
-            cerr << "Gradient computation for log with data = 0." << endl;
-        } });
-    out->l = "log(" + v->l + ")";
+    long t = Profiler::start();
+    float d = log(*v->data);
+    auto out = Value::node(d, Op::log, {v});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel("log(" + v->getLabel() + ")");
+    }
     return out;
 }
 
 shared_ptr<Value> tanh(shared_ptr<Value> v)
 {
-    float d = std::tanh(v->data);
-    shared_ptr out = make_shared<Value>(d, vector{v});
-    out->l = "tanH(" + v->l + ")";
-    out->setBackward([d](shared_ptr<Value> &self)
-                     { 
-                        auto v = *(self->prev).begin();;
-                        
-                        v->grad += (1 - d * d) * self->grad; });
+    long t = Profiler::start();
+    float d = std::tanh(*v->data);
+    shared_ptr out = Value::node(d, Op::tanh, {v});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel("tanH(" + v->getLabel() + ")");
+    }
     return out;
 }
 shared_ptr<Value> relu(shared_ptr<Value> v)
 {
-    float data = v->data;
-    auto out = make_shared<Value>((data + abs(data)) / 2, vector{v});
-    out->setBackward([data](shared_ptr<Value> &self)
-                     { 
-                        auto v = *(self->prev).begin();;
-                        
-                        v->grad += (data > 0) * self->grad; });
-    out->l = "relu(" + v->l + ")";
+    long t = Profiler::start();
+    float data = *v->data;
+    auto out = Value::node((data + abs(data)) / 2, Op::relu, {v});
+    if (t)
+    {
+        out->profile(t);
+    }
+    if (Value::debug())
+    {
+        out->setLabel("relu(" + v->getLabel() + ")");
+    }
     return out;
 }
 
-void Value::backward()
+shared_ptr<Value> record(const shared_ptr<ExprRule> &rule, const shared_ptr<Value> *const *x, int n)
 {
-    vector<shared_ptr<Value>> topo = {};
-    set<shared_ptr<Value>> visited = {};
-    grad = 1;
+    long t = Profiler::start();
+    static thread_local vector<float> values;
+    values.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        values[i] = *(*x[i])->data;
+    }
+    auto out = Value::create(rule->forward(values.data()));
+    if (grad_enabled)
+    {
+        out->prev.reserve(n);
+        for (int i = 0; i < n; i++)
+        {
+            out->prev.push_back(*x[i]);
+        }
+        out->op = Op::expr;
+        out->ctx = rule;
+    }
+    if (t)
+    {
+        out->profile(t);
+    }
+    return out;
+}
 
-    build_topo(shared_from_this(), topo, visited);
+// Gather buffers for the inputs of fused operations and their gradients,
+// reused between calls. An op may build and backpropagate a graph of its
+// own inside forward or backward (e.g. a recomputed segment), so every
+// nesting level gets its own pair.
+struct FusedBuffers
+{
+    vector<float> x;
+    vector<float> gx;
+};
+static thread_local deque<FusedBuffers> fused_levels;
+static thread_local int fused_depth = 0;
 
-    for (int i = topo.size() - 1; i >= 0; i--)
+class FusedScope
+{
+public:
+    FusedScope()
+    {
+        if (fused_levels.size() <= fused_depth)
+        {
+            fused_levels.emplace_back();
+        }
+        buffers = &fused_levels[fused_depth++];
+    }
+    ~FusedScope()
     {
+        fused_depth--;
+    }
+    FusedBuffers *buffers;
+};
 
-        topo[i]->_backward(topo[i]);
+vector<shared_ptr<Value>> apply(const shared_ptr<FusedOp> &op, const vector<shared_ptr<Value>> &x, int m)
+{
+    long t = Profiler::start();
+    int n = x.size();
+    FusedScope scope;
+    auto &fused_x = scope.buffers->x;
+    fused_x.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        fused_x[i] = *x[i]->data;
     }
+
+    ArenaAllocator<float> alloc(GraphArena::current());
+    auto state = allocate_shared<FusedNode>(ArenaAllocator<FusedNode>(alloc), op, m, alloc);
+    op->forward(fused_x.data(), n, state->y.data(), m);
+
+    auto node = Value::node(m == 1 ? state->y[0] : 0, Op::fused, x);
+    if (node->op == Op::fused)
+    {
+        node->ctx = state;
+    }
+
+    if (m == 1)
+    {
+        if (t)
+        {
+            Profiler::fused(op->name(), t, sizeof(Value) + n * sizeof(shared_ptr<Value>) + sizeof(FusedNode) + 2 * sizeof(float));
+        }
+        return {node};
+    }
+    vector<shared_ptr<Value>> out;
+    out.reserve(m);
+    for (int j = 0; j < m; j++)
+    {
+        auto h = Value::node(state->y[j], Op::output, {node});
+        h->index = j;
+        out.push_back(h);
+    }
+    if (t)
+    {
+        // The node, its outputs and gradients, and a handle per output
+        long handle = sizeof(Value) + sizeof(shared_ptr<Value>);
+        Profiler::fused(op->name(), t, sizeof(Value) + n * sizeof(shared_ptr<Value>) + sizeof(FusedNode) + 2L * m * sizeof(float) + m * handle);
+    }
+    return out;
+}
+
+// Nodes of one level run concurrently and may share children, so their
+// gradients are added with a compare-and-swap
+template <bool shared>
+static inline void accumulate(float *p, float v)
+{
+    if (!shared)
+    {
+        *p += v;
+        return;
+    }
+    float expected, desired;
+    __atomic_load(p, &expected, __ATOMIC_RELAXED);
+    do
+    {
+        desired = expected + v;
+    } while (!__atomic_compare_exchange(p, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+template <bool shared>
+void Value::_backward()
+{
+    long t = Profiler::start();
+    float g = *grad;
+    switch (op)
+    {
+    case Op::leaf:
+        break;
+    case Op::add:
+    case Op::sum:
+        for (auto &a : prev)
+        {
+            accumulate<shared>(a->grad, g);
+        }
+        break;
+    case Op::mul:
+        if (prev.size() == 1)
+        {
+            accumulate<shared>(prev[0]->grad, 2 * *prev[0]->data * g);
+            break;
+        }
+        accumulate<shared>(prev[0]->grad, *prev[1]->data * g);
+        accumulate<shared>(prev[1]->grad, *prev[0]->data * g);
+        break;
+    case Op::pow:
+        accumulate<shared>(prev[0]->grad, (aux * pow(*prev[0]->data, aux - 1)) * g);
+        break;
+    case Op::exp:
+        accumulate<shared>(prev[0]->grad, *data * g);
+        break;
+    case Op::log:
+        if (*prev[0]->data != 0)
+        {
+            accumulate<shared>(prev[0]->grad, (1 / *prev[0]->data) * g);
+        }
+        else
+        {
+            cerr << "Gradient computation for log with data = 0." << endl;
+        }
+        break;
+    case Op::tanh:
+        accumulate<shared>(prev[0]->grad, (1 - *data * *data) * g);
+        break;
+    case Op::relu:
+        accumulate<shared>(prev[0]->grad, (*prev[0]->data > 0) * g);
+        break;
+    case Op::output:
+    {
+        // Collected by the fused node, which runs next
+        auto state = static_cast<FusedNode *>(prev[0]->ctx.get());
+        state->gy[index] += g;
+        break;
+    }
+    case Op::fused:
+    {
+        auto state = static_cast<FusedNode *>(ctx.get());
+        int n = prev.size();
+        int m = state->y.size();
+        FusedScope scope;
+        auto &fused_x = scope.buffers->x;
+        auto &fused_gx = scope.buffers->gx;
+        fused_x.resize(n);
+        fused_gx.assign(n, 0);
+        for (int i = 0; i < n; i++)
+        {
+            fused_x[i] = *prev[i]->data;
+        }
+        // A single output receives its gradient directly
+        const float *gy = m == 1 ? grad : state->gy.data();
+        state->op->backward(fused_x.data(), n, state->y.data(), gy, m, fused_gx.data());
+        for (int i = 0; i < n; i++)
+        {
+            accumulate<shared>(prev[i]->grad, fused_gx[i]);
+        }
+        fill(state->gy.begin(), state->gy.end(), 0);
+        break;
+    }
+    case Op::expr:
+    {
+        // Expression rules never build nodes, so the buffers need no nesting
+        static thread_local vector<float> x, gx;
+        int n = prev.size();
+        x.resize(n);
+        gx.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            x[i] = *prev[i]->data;
+        }
+        static_cast<ExprRule *>(ctx.get())->gradient(x.data(), gx.data());
+        for (int i = 0; i < n; i++)
+        {
+            accumulate<shared>(prev[i]->grad, gx[i] * g);
+        }
+        break;
+    }
+    case Op::custom:
+        (*static_cast<function<void(Value *self)> *>(ctx.get()))(this);
+        break;
+    }
+    if (t && op != Op::leaf)
+    {
+        if (op == Op::fused)
+        {
+            Profiler::fusedBackward(static_cast<FusedNode *>(ctx.get())->op->name(), t);
+        }
+        else
+        {
+            Profiler::backward(op, t);
+        }
+    }
+}
+
+// Bumped by every releasing backward, which may free nodes that the orders
+// cached on other roots still point to
+static atomic<unsigned int> release_epoch{0};
+
+// Rough cost of one node's backward, in the units of the intra-op threshold
+static const long nodeWork = 64;
+
+// Level arrays of a level-by-level backward, reused between calls. A fused
+// node of one level may backpropagate a graph of its own (e.g. a recomputed
+// segment), so like the fused buffers every nesting level gets its own.
+struct LevelBuffers
+{
+    vector<int> start, front, back;
+    vector<Value *> sorted;
+};
+static thread_local deque<LevelBuffers> level_buffers;
+static thread_local int level_depth = 0;
+
+class LevelScope
+{
+public:
+    LevelScope()
+    {
+        if (level_buffers.size() <= level_depth)
+        {
+            level_buffers.emplace_back();
+        }
+        buffers = &level_buffers[level_depth++];
+    }
+    ~LevelScope()
+    {
+        level_depth--;
+    }
+    LevelBuffers *buffers;
+};
+
+// With intra-op threads, a large graph goes level by level: a node's level
+// is its longest path from the roots, so the nodes of one level never feed
+// each other and can run concurrently once the levels above are done.
+// Fused and custom nodes may update state of their own (e.g. a layer's
+// weight gradients), so they run one at a time after the rest of their level.
+void Value::backpropagate(const vector<Value *> &order, bool release)
+{
+    // While releasing, a node's parents no longer hold it, so it is kept
+    // alive here until it has run
+    vector<shared_ptr<Value>> owned;
+    if (release)
+    {
+        release_epoch.fetch_add(1, memory_order_acq_rel);
+    }
+    if (intraOpThreads() < 2 || (long)order.size() * nodeWork < intraOpThreshold())
+    {
+        if (release)
+        {
+            owned.reserve(order.size());
+            for (Value *v : order)
+            {
+                owned.push_back(v->shared_from_this());
+            }
+        }
+        for (int i = order.size() - 1; i >= 0; i--)
+        {
+            order[i]->_backward();
+            if (release)
+            {
+                order[i]->release();
+                owned[i].reset();
+            }
+        }
+        return;
+    }
+    ProfileScope scope("levels");
+    for (Value *v : order)
+    {
+        v->level = 0;
+    }
+    int depth = 0;
+    for (int i = order.size() - 1; i >= 0; i--)
+    {
+        Value *v = order[i];
+        depth = max(depth, v->level);
+        for (auto &c : v->prev)
+        {
+            c->level = max(c->level, v->level + 1);
+        }
+    }
+    // Counting sort by level, with the nodes that run alone at the end of
+    // their level
+    LevelScope levels;
+    auto &start = levels.buffers->start, &front = levels.buffers->front, &back = levels.buffers->back;
+    auto &sorted = levels.buffers->sorted;
+    start.assign(depth + 2, 0);
+    for (Value *v : order)
+    {
+        start[v->level + 1]++;
+    }
+    partial_sum(start.begin(), start.end(), start.begin());
+    front.assign(start.begin(), start.end() - 1);
+    back.assign(start.begin() + 1, start.end());
+    sorted.resize(order.size());
+    for (Value *v : order)
+    {
+        if (v->op == Op::fused || v->op == Op::custom)
+        {
+            sorted[--back[v->level]] = v;
+        }
+        else
+        {
+            sorted[front[v->level]++] = v;
+        }
+    }
+    Value **nodes = sorted.data();
+    if (release)
+    {
+        owned.reserve(order.size());
+        for (Value *v : sorted)
+        {
+            owned.push_back(v->shared_from_this());
+        }
+    }
+    for (int l = 0; l <= depth; l++)
+    {
+        Value **level = nodes + start[l];
+        int concurrent = front[l] - start[l];
+        parallelFor(concurrent, 1, concurrent * nodeWork, [&](int begin, int end)
+                    {
+            for (int i = begin; i < end; i++)
+            {
+                level[i]->_backward<true>();
+            } });
+        for (int i = front[l]; i < start[l + 1]; i++)
+        {
+            nodes[i]->_backward();
+        }
+        for (int i = start[l]; release && i < start[l + 1]; i++)
+        {
+            nodes[i]->release();
+            owned[i].reset();
+        }
+    }
+}
+
+void Value::backward(bool release)
+{
+    ProfileScope scope("backward");
+    unsigned int epoch = release_epoch.load(memory_order_acquire);
+    if (!topo || topo->epoch != epoch)
+    {
+        ProfileScope sort("build_topo");
+        topo = make_unique<Order>();
+        topo->epoch = epoch;
+        build_topo(this, topo->nodes);
+    }
+    *grad = 1;
+    if (release)
+    {
+        // The order outlives this node's own release
+        auto order = move(topo);
+        backpropagate(order->nodes, true);
+        return;
+    }
+    backpropagate(topo->nodes);
+}
+
+void backward(const vector<shared_ptr<Value>> &roots, const float *seeds, bool release)
+{
+    ProfileScope scope("backward");
+    vector<Value *> order;
+    {
+        vector<Value *> r;
+        r.reserve(roots.size());
+        for (auto &v : roots)
+        {
+            r.push_back(v.get());
+        }
+        ProfileScope sort("build_topo");
+        build_topo(r, order);
+    }
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        *roots[i]->grad += seeds[i];
+    }
+    Value::backpropagate(order, release);
+}
+
+void FusedOp::vjp(const float *x, int n, const float *y, const float *gy, int m, float *gx)
+{
+    backward(x, n, y, gy, m, gx);
+}
+
+void FusedOp::jvp(const float *x, int n, const float *y, const float *dx, int m, float *dy)
+{
+    vector<float> gy(m, 0), gx(n);
+    for (int j = 0; j < m; j++)
+    {
+        gy[j] = 1;
+        fill(gx.begin(), gx.end(), 0);
+        vjp(x, n, y, gy.data(), m, gx.data());
+        gy[j] = 0;
+        dy[j] = inner_product(gx.begin(), gx.end(), dx, 0.0f);
+    }
+}
+
+Derivatives::Derivatives(const vector<shared_ptr<Value>> &inputs, const vector<shared_ptr<Value>> &outputs)
+    : roots{outputs}, fusedWidth{0}, custom{false}
+{
+    ProfileScope scope("build_topo");
+    {
+        vector<Value *> r;
+        r.reserve(outputs.size());
+        for (auto &v : outputs)
+        {
+            r.push_back(v.get());
+        }
+        build_topo(r, order);
+    }
+    unordered_map<Value *, int> pos;
+    pos.reserve(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        pos[order[i]] = i;
+    }
+    childStart.reserve(order.size() + 1);
+    fusedAt.assign(order.size(), -1);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        Value *v = order[i];
+        childStart.push_back(child.size());
+        for (auto &c : v->prev)
+        {
+            child.push_back(pos[c.get()]);
+        }
+        if (v->op == Op::fused)
+        {
+            fusedAt[i] = fusedWidth;
+            fusedWidth += static_cast<FusedNode *>(v->ctx.get())->y.size();
+        }
+        else if (v->op == Op::output)
+        {
+            // The fused node comes first in the order
+            fusedAt[i] = fusedAt[child.back()];
+        }
+        custom = custom || v->op == Op::custom;
+    }
+    childStart.push_back(child.size());
+    for (auto &v : inputs)
+    {
+        if (v->op != Op::leaf)
+        {
+            throw runtime_error("Derivatives are taken with respect to leaves");
+        }
+        auto it = pos.find(v.get());
+        in.push_back(it == pos.end() ? -1 : it->second);
+    }
+    for (auto &v : outputs)
+    {
+        out.push_back(pos[v.get()]);
+    }
+}
+
+float Derivatives::partial(Value *v, int i)
+{
+    switch (v->op)
+    {
+    case Op::mul:
+        return v->prev.size() == 1 ? 2 * *v->prev[0]->data : *v->prev[1 - i]->data;
+    case Op::pow:
+        return v->aux * pow(*v->prev[0]->data, v->aux - 1);
+    case Op::exp:
+        return *v->data;
+    case Op::log:
+        // As in backward, no gradient flows through log(0)
+        return *v->prev[0]->data != 0 ? 1 / *v->prev[0]->data : 0;
+    case Op::tanh:
+        return 1 - *v->data * *v->data;
+    case Op::relu:
+        return *v->prev[0]->data > 0;
+    default:
+        // add and sum
+        return 1;
+    }
+}
+
+void Derivatives::local(Value *v, vector<float> &x, vector<float> &gx)
+{
+    if (v->op != Op::expr)
+    {
+        return;
+    }
+    int n = v->prev.size();
+    x.resize(n);
+    gx.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = *v->prev[i]->data;
+    }
+    static_cast<ExprRule *>(v->ctx.get())->gradient(x.data(), gx.data());
+}
+
+// Tangents flow from the leaves up, k per node, in dual-number fashion:
+// each node's tangent is its local derivatives times its children's
+void Derivatives::jvp(const float *dx, int k, float *dy)
+{
+    if (custom)
+    {
+        throw runtime_error("Forward mode cannot differentiate a node with a user-defined backward");
+    }
+    ProfileScope scope("jvp");
+    int ni = in.size(), no = out.size();
+    d.assign(order.size() * k, 0);
+    fused.assign((long)fusedWidth * k, 0);
+    for (int j = 0; j < ni; j++)
+    {
+        for (int r = 0; in[j] >= 0 && r < k; r++)
+        {
+            d[(long)in[j] * k + r] += dx[(long)r * ni + j];
+        }
+    }
+    FusedScope buffers;
+    auto &x = buffers.buffers->x;
+    auto &tx = buffers.buffers->gx;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        Value *v = order[i];
+        float *t = &d[i * k];
+        const int *c = &child[childStart[i]];
+        int nc = childStart[i + 1] - childStart[i];
+        switch (v->op)
+        {
+        case Op::leaf:
+            break;
+        case Op::output:
+        {
+            int m = static_cast<FusedNode *>(v->prev[0]->ctx.get())->y.size();
+            const float *f = &fused[(long)fusedAt[i] * k];
+            for (int r = 0; r < k; r++)
+            {
+                t[r] = f[(long)r * m + v->index];
+            }
+            break;
+        }
+        case Op::fused:
+        {
+            auto state = static_cast<FusedNode *>(v->ctx.get());
+            int m = state->y.size();
+            float *f = &fused[(long)fusedAt[i] * k];
+            x.resize(nc);
+            tx.resize(nc);
+            for (int a = 0; a < nc; a++)
+            {
+                x[a] = *v->prev[a]->data;
+            }
+            for (int r = 0; r < k; r++)
+            {
+                for (int a = 0; a < nc; a++)
+                {
+                    tx[a] = d[(long)c[a] * k + r];
+                }
+                state->op->jvp(x.data(), nc, state->y.data(), tx.data(), m, f + (long)r * m);
+                t[r] = m == 1 ? f[r] : 0;
+            }
+            break;
+        }
+        default:
+            local(v, x, tx);
+            for (int a = 0; a < nc; a++)
+            {
+                float p = v->op == Op::expr ? tx[a] : partial(v, a);
+                const float *tc = &d[(long)c[a] * k];
+                for (int r = 0; r < k; r++)
+                {
+                    t[r] += p * tc[r];
+                }
+            }
+        }
+    }
+    for (int j = 0; j < no; j++)
+    {
+        for (int r = 0; r < k; r++)
+        {
+            dy[(long)r * no + j] = d[(long)out[j] * k + r];
+        }
+    }
+}
+
+// The k cotangents go down the order together, so every node is visited
+// once per call rather than once per cotangent
+void Derivatives::vjp(const float *gy, int k, float *gx)
+{
+    ProfileScope scope("vjp");
+    int ni = in.size(), no = out.size();
+    d.assign(order.size() * k, 0);
+    fused.assign((long)fusedWidth * k, 0);
+    for (int j = 0; j < no; j++)
+    {
+        for (int r = 0; r < k; r++)
+        {
+            d[(long)out[j] * k + r] += gy[(long)r * no + j];
+        }
+    }
+    FusedScope buffers;
+    auto &x = buffers.buffers->x;
+    auto &g1 = buffers.buffers->gx;
+    vector<float> saved;
+    for (int i = order.size() - 1; i >= 0; i--)
+    {
+        Value *v = order[i];
+        const float *g = &d[(long)i * k];
+        const int *c = &child[childStart[i]];
+        int nc = childStart[i + 1] - childStart[i];
+        switch (v->op)
+        {
+        case Op::leaf:
+            break;
+        case Op::output:
+        {
+            int m = static_cast<FusedNode *>(v->prev[0]->ctx.get())->y.size();
+            float *f = &fused[(long)fusedAt[i] * k];
+            for (int r = 0; r < k; r++)
+            {
+                f[(long)r * m + v->index] += g[r];
+            }
+            break;
+        }
+        case Op::fused:
+        {
+            auto state = static_cast<FusedNode *>(v->ctx.get());
+            int m = state->y.size();
+            const float *f = &fused[(long)fusedAt[i] * k];
+            x.resize(nc);
+            for (int a = 0; a < nc; a++)
+            {
+                x[a] = *v->prev[a]->data;
+            }
+            for (int r = 0; r < k; r++)
+            {
+                g1.assign(nc, 0);
+                state->op->vjp(x.data(), nc, state->y.data(), m == 1 ? g + r : f + (long)r * m, m, g1.data());
+                for (int a = 0; a < nc; a++)
+                {
+                    d[(long)c[a] * k + r] += g1[a];
+                }
+            }
+            break;
+        }
+        case Op::custom:
+        {
+            // The function works on the nodes' own gradients: run it once
+            // per cotangent from cleared children, then put them back. A
+            // child listed twice is read (and cleared) once.
+            auto &f = *static_cast<function<void(Value *self)> *>(v->ctx.get());
+            float own = *v->grad;
+            saved.resize(nc);
+            for (int r = 0; r < k; r++)
+            {
+                for (int a = 0; a < nc; a++)
+                {
+                    saved[a] = *v->prev[a]->grad;
+                    *v->prev[a]->grad = 0;
+                }
+                *v->grad = g[r];
+                f(v);
+                for (int a = 0; a < nc; a++)
+                {
+                    d[(long)c[a] * k + r] += *v->prev[a]->grad;
+                    *v->prev[a]->grad = 0;
+                }
+                for (int a = nc - 1; a >= 0; a--)
+                {
+                    *v->prev[a]->grad = saved[a];
+                }
+            }
+            *v->grad = own;
+            break;
+        }
+        default:
+            local(v, x, g1);
+            for (int a = 0; a < nc; a++)
+            {
+                float p = v->op == Op::expr ? g1[a] : partial(v, a);
+                float *gc = &d[(long)c[a] * k];
+                for (int r = 0; r < k; r++)
+                {
+                    gc[r] += p * g[r];
+                }
+            }
+        }
+    }
+    for (int j = 0; j < ni; j++)
+    {
+        for (int r = 0; r < k; r++)
+        {
+            gx[(long)r * ni + j] = in[j] < 0 ? 0 : d[(long)in[j] * k + r];
+        }
+    }
+}
+
+vector<float> Derivatives::jacobian()
+{
+    int ni = in.size(), no = out.size();
+    vector<float> J((long)no * ni);
+    // Seeds go in blocks, which bounds the scratch to a block per node
+    const int block = 32;
+    vector<float> seeds, result;
+    if (ni < no)
+    {
+        for (int j0 = 0; j0 < ni; j0 += block)
+        {
+            int k = min(block, ni - j0);
+            seeds.assign((long)k * ni, 0);
+            result.resize((long)k * no);
+            for (int r = 0; r < k; r++)
+            {
+                seeds[(long)r * ni + j0 + r] = 1;
+            }
+            jvp(seeds.data(), k, result.data());
+            // Row r holds column j0 + r of J
+            for (int r = 0; r < k; r++)
+            {
+                for (int o = 0; o < no; o++)
+                {
+                    J[(long)o * ni + j0 + r] = result[(long)r * no + o];
+                }
+            }
+        }
+        return J;
+    }
+    for (int o0 = 0; o0 < no; o0 += block)
+    {
+        int k = min(block, no - o0);
+        seeds.assign((long)k * no, 0);
+        for (int r = 0; r < k; r++)
+        {
+            seeds[(long)r * no + o0 + r] = 1;
+        }
+        vjp(seeds.data(), k, J.data() + (long)o0 * ni);
+    }
+    return J;
+}
+
+int Derivatives::inputs() const
+{
+    return in.size();
+}
+int Derivatives::outputs() const
+{
+    return out.size();
 }
 
 ostream &operator<<(ostream &out, Value &v)
 {
-    out << v.l << "\t|" << v.data << "\t| grad = " << v.grad;
+    out << v.getLabel() << "\t|" << *v.data << "\t| grad = " << *v.grad;
     return out;
 }
 
-void build_topo(const shared_ptr<Value> &v, vector<shared_ptr<Value>> &topo, set<shared_ptr<Value>> &visited)
+// Every sort gets a fresh epoch, so a node is visited iff its mark differs.
+// Marks are never cleared; wrapping around after 2^32 sorts is harmless in
+// practice since a node would have to survive all of them.
+static atomic<unsigned int> topo_epoch{0};
+
+void build_topo(Value *root, vector<Value *> &topo)
 {
+    static thread_local vector<Value *> roots(1);
+    roots[0] = root;
+    build_topo(roots, topo);
+}
 
-    if (visited.find(v) == visited.end())
+void build_topo(const vector<Value *> &roots, vector<Value *> &topo)
+{
+    unsigned int epoch = ++topo_epoch;
+    if (epoch == 0)
     {
-        visited.insert(v);
-        for (auto c : v->prev)
+        epoch = ++topo_epoch;
+    }
+
+    // Explicit DFS stack of (node, index of the next child to visit),
+    // kept between calls so a sort does not allocate once warmed up
+    static thread_local vector<pair<Value *, size_t>> stack;
+    for (Value *root : roots)
+    {
+        if (root->mark == epoch)
+        {
+            continue;
+        }
+        stack.clear();
+        root->mark = epoch;
+        stack.push_back({root, 0});
+        while (!stack.empty())
         {
-            build_topo(c, topo, visited);
+            Value *v = stack.back().first;
+            size_t i = stack.back().second;
+            if (i < v->prev.size())
+            {
+                stack.back().second++;
+                Value *c = v->prev[i].get();
+                if (c->mark != epoch)
+                {
+                    c->mark = epoch;
+                    stack.push_back({c, 0});
+                }
+            }
+            else
+            {
+                topo.push_back(v);
+                stack.pop_back();
+            }
         }
-        topo.push_back(v);
     }
 }
@@ -0,0 +1,93 @@
+#include "../include/ValueStruct.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+// Helper function to compare floating point numbers
+bool is_close(double a, double b, double tol = 1e-6)
+{
+    return std::fabs(a - b) < tol;
+}
+
+void test_arena_backward()
+{
+    GraphArena arena;
+    auto x = make_shared<Value>(1.5);
+    auto y = make_shared<Value>(-2.0);
+    {
+        ArenaScope scope(arena);
+        auto z = x * y + x;
+        auto out = tanh(z);
+        out->backward();
+
+        assert(arena.live() > 0);
+        assert(arena.used() > 0);
+        double d = 1 - std::tanh(-1.5) * std::tanh(-1.5);
+        assert(is_close(x->getGrad(), d * (-2.0 + 1)));
+        assert(is_close(y->getGrad(), d * 1.5));
+    }
+    assert(arena.live() == 0);
+    arena.reset();
+    assert(arena.used() == 0);
+
+    cout << "Arena backward test passed." << endl;
+}
+
+void test_arena_reuse()
+{
+    GraphArena arena(256);
+    auto x = make_shared<Value>(0.5);
+    size_t capacity = 0;
+    for (int step = 0; step < 3; step++)
+    {
+        {
+            ArenaScope scope(arena);
+            auto out = x;
+            for (int i = 0; i < 20; i++)
+            {
+                out = out * x;
+            }
+        }
+        arena.reset();
+        // A step that spilled over several blocks is merged into one
+        if (step > 0)
+        {
+            assert(arena.capacity() == capacity);
+        }
+        capacity = arena.capacity();
+    }
+    cout << "Arena reuse test passed." << endl;
+}
+
+void test_arena_reset_live()
+{
+    GraphArena arena;
+    shared_ptr<Value> kept;
+    {
+        ArenaScope scope(arena);
+        kept = make_shared<Value>(1.0) + make_shared<Value>(2.0);
+    }
+    bool thrown = false;
+    try
+    {
+        arena.reset();
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    kept.reset();
+    arena.reset();
+    cout << "Arena reset with live nodes test passed." << endl;
+}
+
+int main()
+{
+    test_arena_backward();
+    test_arena_reuse();
+    test_arena_reset_live();
+    cout << "All Arena detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "../include/NN.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+const string ckptPath = "build/checkpoint-test.ckpt";
+const string textPath = "build/checkpoint-test.txt";
+
+vector<float> weights(MLP &model)
+{
+    vector<float> w;
+    for (auto &p : model.parameters())
+    {
+        w.push_back(p->getData());
+    }
+    return w;
+}
+
+void test_checkpoint_roundtrip()
+{
+    // Either engine can write a checkpoint and read one written by the other
+    for (engine from : {engine::scalar, engine::tensor})
+    {
+        for (engine to : {engine::scalar, engine::tensor})
+        {
+            MLP model(5, {7, 3, 2}, from);
+            model.saveCheckpoint(ckptPath);
+            assert(Checkpoint::detect(ckptPath));
+
+            MLP loaded(ckptPath, to);
+            assert(loaded.inputs() == 5 && loaded.outputs() == 2);
+            assert(weights(loaded) == weights(model));
+
+            vector<float> x{0.1, -0.4, 0.9, 0.3, -0.2};
+            auto a = model.predict(x);
+            auto b = loaded.predict(x);
+            for (int i = 0; i < 2; i++)
+            {
+                assert(std::fabs(a[i] - b[i]) < 1e-6);
+            }
+        }
+    }
+    cout << "Checkpoint roundtrip test passed." << endl;
+}
+
+void test_checkpoint_in_place()
+{
+    // Training a model mapped from a checkpoint must not change the file
+    MLP model(3, {4, 1}, engine::tensor);
+    model.saveCheckpoint(ckptPath);
+    auto original = weights(model);
+    {
+        Checkpoint checkpoint(ckptPath);
+        MLP mapped(checkpoint, engine::tensor);
+        // The mapped weights are the model's flat buffer
+        assert(mapped.blocks()[0].data == checkpoint.layer(0).params);
+        assert(mapped.blocks()[1].data == checkpoint.layer(1).params);
+        auto x = vector<shared_ptr<Value>>{make_shared<Value>(0.5), make_shared<Value>(-1), make_shared<Value>(2)};
+        auto loss = simpleLoss(mapped(x), {make_shared<Value>(1)});
+        loss->backward();
+        for (auto &p : mapped.parameters())
+        {
+            p->setData(p->getData() - 0.1f * p->getGrad());
+        }
+        assert(weights(mapped) != original);
+    }
+    MLP reloaded(ckptPath, engine::tensor);
+    assert(weights(reloaded) == original);
+    cout << "Checkpoint in place test passed." << endl;
+}
+
+void test_checkpoint_corrupt()
+{
+    MLP model(4, {8, 2});
+    model.saveCheckpoint(ckptPath);
+
+    // Flip one byte of the weights
+    {
+        fstream file(ckptPath, ios::in | ios::out | ios::binary);
+        file.seekg(-16, ios::end);
+        char c;
+        file.get(c);
+        file.seekp(-16, ios::end);
+        file.put(c ^ 1);
+    }
+    bool thrown = false;
+    try
+    {
+        Checkpoint c(ckptPath);
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    // Without verification the file is still readable
+    Checkpoint unchecked(ckptPath, false);
+    assert(unchecked.layers() == 2);
+
+    // Truncated
+    model.saveCheckpoint(ckptPath);
+    {
+        ifstream in(ckptPath, ios::binary);
+        string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        ofstream out(ckptPath, ios::binary | ios::trunc);
+        out.write(bytes.data(), bytes.size() - 64);
+    }
+    thrown = false;
+    try
+    {
+        Checkpoint c(ckptPath, false);
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Layer tables that pass the bounds checks but do not fit together:
+    // layer 1 taking 4 inputs from layer 0's 8 outputs, layer 0's weights
+    // on top of the header, and layer 1's on top of layer 0's
+    for (int edit = 0; edit < 3; edit++)
+    {
+        model.saveCheckpoint(ckptPath);
+        {
+            fstream file(ckptPath, ios::in | ios::out | ios::binary);
+            CheckpointEntry e[2];
+            file.seekg(sizeof(CheckpointHeader));
+            file.read((char *)e, sizeof(e));
+            if (edit == 0)
+                e[1].nin = 4;
+            else if (edit == 1)
+                e[0].offset = 0;
+            else
+                e[1].offset = e[0].offset;
+            file.seekp(sizeof(CheckpointHeader));
+            file.write((const char *)e, sizeof(e));
+        }
+        thrown = false;
+        try
+        {
+            Checkpoint c(ckptPath, false);
+        }
+        catch (runtime_error &e)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    cout << "Checkpoint corrupt test passed." << endl;
+}
+
+void test_text_format_exact()
+{
+    // saveTo writes enough digits for the text format to be lossless too
+    MLP model(3, {5, 2});
+    model.saveTo(textPath);
+    assert(!Checkpoint::detect(textPath));
+    MLP loaded(textPath);
+    assert(weights(loaded) == weights(model));
+    cout << "Text format exact test passed." << endl;
+}
+
+int main()
+{
+    test_checkpoint_roundtrip();
+    test_checkpoint_in_place();
+    test_checkpoint_corrupt();
+    test_text_format_exact();
+    remove(ckptPath.c_str());
+    remove(textPath.c_str());
+    cout << "All Checkpoint detailed tests passed!" << endl;
+    return 0;
+}
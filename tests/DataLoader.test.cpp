@@ -0,0 +1,175 @@
+#include "../include/DataLoader.hpp"
+#include <iostream>
+#include <cassert>
+#include <fstream>
+#include <algorithm>
+
+const string binPath = "build/dataloader-test.bin";
+const string csvPath = "build/dataloader-test.csv";
+
+// n samples with x = (i, -i) and y = i, so a sample tells its index
+MemoryDataset indexed(int n)
+{
+    vector<float> x, y;
+    for (int i = 0; i < n; i++)
+    {
+        x.push_back(i);
+        x.push_back(-i);
+        y.push_back(i);
+    }
+    return MemoryDataset(x, y, 2, 1);
+}
+
+// Indices of the samples of one epoch, in the order they came
+vector<int> epoch(DataLoader &loader, int batch)
+{
+    vector<int> seen;
+    Batch b;
+    while (loader.next(b))
+    {
+        assert(b.n > 0 && b.n <= batch);
+        for (int k = 0; k < b.n; k++)
+        {
+            assert(b.x[2 * k] == b.y[k] && b.x[2 * k + 1] == -b.y[k]);
+            seen.push_back(int(b.y[k]));
+        }
+    }
+    return seen;
+}
+
+void test_epochs()
+{
+    auto data = indexed(23);
+    DataLoader loader(data, 5, true, 7);
+    assert(loader.batches() == 5);
+
+    auto first = epoch(loader, 5);
+    assert(loader.epoch() == 1);
+    auto second = epoch(loader, 5);
+    assert(loader.epoch() == 2);
+    assert(first != second);
+    // Every sample exactly once per epoch
+    for (auto e : {first, second})
+    {
+        sort(e.begin(), e.end());
+        for (int i = 0; i < 23; i++)
+        {
+            assert(e[i] == i);
+        }
+    }
+
+    // Without shuffling, the dataset's order
+    DataLoader ordered(data, 4, false);
+    auto seen = epoch(ordered, 4);
+    for (int i = 0; i < 23; i++)
+    {
+        assert(seen[i] == i);
+    }
+    cout << "DataLoader epochs test passed." << endl;
+}
+
+void test_reproducible()
+{
+    // The order depends on the seed only, not on prefetching
+    auto data = indexed(50);
+    for (int prefetch : {0, 1, 4})
+    {
+        DataLoader a(data, 8, true, 3, 2);
+        DataLoader b(data, 8, true, 3, prefetch);
+        for (int e = 0; e < 3; e++)
+        {
+            assert(epoch(a, 8) == epoch(b, 8));
+        }
+    }
+    DataLoader c(data, 8, true, 4);
+    DataLoader d(data, 8, true, 3);
+    assert(epoch(c, 8) != epoch(d, 8));
+    cout << "DataLoader reproducible test passed." << endl;
+}
+
+void test_binary()
+{
+    vector<float> x, y;
+    for (int i = 0; i < 100; i++)
+    {
+        x.push_back(i);
+        x.push_back(-i);
+        y.push_back(i);
+    }
+    BinaryDataset::write(binPath, x.data(), y.data(), 100, 2, 1);
+    BinaryDataset data(binPath, 2, 1);
+    assert(data.size() == 100);
+    DataLoader loader(data, 16, true, 1);
+    auto seen = epoch(loader, 16);
+    sort(seen.begin(), seen.end());
+    for (int i = 0; i < 100; i++)
+    {
+        assert(seen[i] == i);
+    }
+
+    // Not a whole number of samples
+    bool thrown = false;
+    try
+    {
+        BinaryDataset wrong(binPath, 2, 5);
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    cout << "DataLoader binary test passed." << endl;
+}
+
+void test_csv()
+{
+    {
+        ofstream file(csvPath);
+        file << "a,b,y\n"
+             << "0.5, -1 ,2\r\n"
+             << "\n"
+             << "3,4e-1,-5.25\n"
+             << "7,8,9";
+    }
+    CsvDataset data(csvPath, 2, 1, true);
+    assert(data.size() == 3);
+    float x[2], y[1];
+    data.read(0, x, y);
+    assert(x[0] == 0.5f && x[1] == -1 && y[0] == 2);
+    data.read(1, x, y);
+    assert(x[0] == 3 && x[1] == 0.4f && y[0] == -5.25f);
+    data.read(2, x, y);
+    assert(x[0] == 7 && x[1] == 8 && y[0] == 9);
+
+    // A bad line surfaces in next(), even when read on the prefetch thread
+    {
+        ofstream file(csvPath);
+        file << "1,2,3\n"
+             << "1,x,3\n";
+    }
+    CsvDataset bad(csvPath, 2, 1);
+    DataLoader loader(bad, 1, false);
+    Batch b;
+    assert(loader.next(b) && b.n == 1);
+    bool thrown = false;
+    try
+    {
+        loader.next(b);
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    cout << "DataLoader CSV test passed." << endl;
+}
+
+int main()
+{
+    test_epochs();
+    test_reproducible();
+    test_binary();
+    test_csv();
+    cout << "All DataLoader detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "../include/Expr.hpp"
+#include "../include/NN.hpp"
+#include "../include/Tape.hpp"
+#include "../include/ThreadPool.hpp"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+bool is_close(double a, double b, double tol = 1e-5)
+{
+    return std::fabs(a - b) < tol * (1 + std::fabs(b));
+}
+
+using Fn = function<shared_ptr<Value>(const shared_ptr<Value> &, const shared_ptr<Value> &, const shared_ptr<Value> &)>;
+
+// Value of f and its gradients at (a, b, c) = (1.5, -0.75, 2)
+vector<float> evaluate(const Fn &f)
+{
+    auto a = make_shared<Value>(1.5);
+    auto b = make_shared<Value>(-0.75);
+    auto c = make_shared<Value>(2.0);
+    auto y = f(a, b, c);
+    y->backward();
+    return {y->getData(), a->getGrad(), b->getGrad(), c->getGrad()};
+}
+
+void test_expr_matches_nodes()
+{
+    // Each expression against the same one built from the basic nodes
+    auto minus = [](const shared_ptr<Value> &v)
+    { return v * Value::create(-1); };
+    vector<pair<Fn, Fn>> cases = {
+        {[](auto &a, auto &b, auto &) -> shared_ptr<Value>
+         { return expr(a) - b; },
+         [&](auto &a, auto &b, auto &)
+         { return a + minus(b); }},
+        {[](auto &a, auto &b, auto &) -> shared_ptr<Value>
+         { return expr(a) / b; },
+         [](auto &a, auto &b, auto &)
+         { return a * (b ^ -1); }},
+        {[](auto &a, auto &b, auto &) -> shared_ptr<Value>
+         { return square(expr(a) - b); },
+         [&](auto &a, auto &b, auto &)
+         { return (a + minus(b)) ^ 2; }},
+        {[](auto &a, auto &b, auto &) -> shared_ptr<Value>
+         { return (expr(a) - b) ^ 3; },
+         [&](auto &a, auto &b, auto &)
+         { return (a + minus(b)) ^ 3; }},
+        {[](auto &a, auto &b, auto &c) -> shared_ptr<Value>
+         { return expr(a) * b + c; },
+         [](auto &a, auto &b, auto &c)
+         { return a * b + c; }},
+        {[](auto &a, auto &, auto &) -> shared_ptr<Value>
+         { return -expr(a); },
+         [&](auto &a, auto &, auto &)
+         { return minus(a); }},
+        // Constants on either side, and a Value used twice
+        {[](auto &a, auto &b, auto &c) -> shared_ptr<Value>
+         { return 2 * expr(a) - expr(b) / 3.0f + a * c / (1 - expr(c)); },
+         [&](auto &a, auto &b, auto &c)
+         { return Value::create(2) * a + minus(b * Value::create(1.0f / 3)) + a * c * ((Value::create(1) + minus(c)) ^ -1); }},
+    };
+    for (auto &test : cases)
+    {
+        auto fused = evaluate(test.first);
+        auto nodes = evaluate(test.second);
+        for (int i = 0; i < 4; i++)
+        {
+            assert(is_close(fused[i], nodes[i]));
+        }
+    }
+    // The operators of Value themselves
+    auto sub = evaluate([](auto &a, auto &b, auto &c)
+                        { return (a - b) / c - (-a); });
+    assert(is_close(sub[0], (1.5 + 0.75) / 2 + 1.5));
+    assert(is_close(sub[1], 0.5 + 1) && is_close(sub[2], -0.5) && is_close(sub[3], -(1.5 + 0.75) / 4));
+    cout << "Expr matches nodes test passed." << endl;
+}
+
+void test_expr_single_node()
+{
+    auto a = make_shared<Value>(3.0);
+    auto b = make_shared<Value>(1.0);
+    auto c = make_shared<Value>(-2.0);
+    shared_ptr<Value> y = expr(a) * b + c;
+    vector<Value *> order;
+    build_topo(y.get(), order);
+    assert(order.size() == 4 && y->get_prev()->size() == 3);
+    assert(y->getData() == 1);
+    order.clear();
+    build_topo((a - b).get(), order);
+    assert(order.size() == 3);
+
+    // simpleLoss: the leaves, the initial zero, one node per element and the mean
+    vector<shared_ptr<Value>> pred, target;
+    for (int i = 0; i < 4; i++)
+    {
+        pred.push_back(make_shared<Value>(i * 0.5));
+        target.push_back(make_shared<Value>(1.0));
+    }
+    auto loss = simpleLoss(pred, target);
+    order.clear();
+    build_topo(loss.get(), order);
+    assert(order.size() == 8 + 1 + 4 + 1);
+    assert(is_close(loss->getData(), (1 + 0.25 + 0 + 0.25) / 4.0));
+    loss->backward();
+    assert(is_close(pred[0]->getGrad(), 2 * (0 - 1) / 4.0) && is_close(target[3]->getGrad(), -2 * (1.5 - 1) / 4.0));
+    cout << "Expr single node test passed." << endl;
+}
+
+void test_expr_engines()
+{
+    // Expression nodes compile into a Tape, differentiate in forward mode
+    // and backpropagate in parallel like the built-in ones
+    auto a = make_shared<Value>(0.5);
+    auto b = make_shared<Value>(-1.25);
+    auto w = make_shared<Value>(0.7);
+    auto f = [&](const shared_ptr<Value> &x, const shared_ptr<Value> &y)
+    {
+        shared_ptr<Value> d = square(expr(x) - y) / w;
+        return tanh(d) + (x - w) * (y / x);
+    };
+    auto y = f(a, b);
+    y->backward();
+    float ga = a->getGrad(), gb = b->getGrad(), gw = w->getGrad();
+
+    Tape tape({a, b}, {y});
+    float x[] = {0.5, -1.25};
+    tape.forward(x);
+    w->setGrad(0);
+    tape.backward();
+    assert(is_close(tape.output(0), y->getData()));
+    assert(is_close(tape.inputGrad(0), ga) && is_close(tape.inputGrad(1), gb) && is_close(w->getGrad(), gw));
+
+    Derivatives d({a, b, w}, {y});
+    float dx[] = {1, 2, -1}, dy;
+    d.jvp(dx, 1, &dy);
+    assert(is_close(dy, ga + 2 * gb - gw));
+
+    // Two copies of a wide graph, one backpropagated serially. The weights
+    // i % 7 add up to 285 * 21 + 10.
+    auto wide = [&]()
+    {
+        vector<shared_ptr<Value>> terms;
+        for (int i = 0; i < 2000; i++)
+        {
+            terms.push_back(f(a, b) * Value::create(i % 7));
+        }
+        return sum(terms);
+    };
+    auto serial = wide(), parallel = wide();
+    a->setGrad(0);
+    serial->backward();
+    float ga2 = a->getGrad();
+    a->setGrad(0);
+    setIntraOpThreads(4);
+    setIntraOpThreshold(0);
+    parallel->backward();
+    setIntraOpThreads(1);
+    setIntraOpThreshold(1 << 18);
+    assert(is_close(a->getGrad(), ga2, 1e-4) && is_close(ga2, ga * (285 * 21 + 10), 1e-4));
+    cout << "Expr engines test passed." << endl;
+}
+
+int main()
+{
+    test_expr_matches_nodes();
+    test_expr_single_node();
+    test_expr_engines();
+    cout << "All Expr detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include "../include/Kernels.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// Helper function to compare floating point numbers
+bool is_close(double a, double b, double tol = 1e-6)
+{
+    return std::fabs(a - b) < tol;
+}
+
+bool all_close(const vector<float> &a, const vector<float> &b, double tol)
+{
+    for (int i = 0; i < a.size(); i++)
+    {
+        if (!is_close(a[i], b[i], tol * (1 + std::fabs(b[i]))))
+            return false;
+    }
+    return a.size() == b.size();
+}
+
+vector<float> random_vector(int n, mt19937 &rng, float scale = 1)
+{
+    uniform_real_distribution<float> dist(-scale, scale);
+    vector<float> v(n);
+    for (auto &x : v)
+        x = dist(rng);
+    return v;
+}
+
+// Every kernel on every instruction set the CPU has must match the scalar reference
+void test_kernels_match_scalar(isa target)
+{
+    mt19937 rng(7);
+    for (int n : {1, 7, 16, 37, 100})
+    {
+        int rows = 5, batch = 6;
+        auto a = random_vector(n, rng), b = random_vector(n, rng);
+        auto W = random_vector(rows * n, rng), bias = random_vector(rows, rng);
+        auto X = random_vector(batch * n, rng), G = random_vector(batch * rows, rng);
+        auto z = random_vector(n, rng, 12);
+
+        // Runs all kernels on the current instruction set, results concatenated per kernel
+        auto run = [&]()
+        {
+            vector<vector<float>> r;
+            r.push_back({dot(a.data(), b.data(), n)});
+            auto y = b;
+            axpy(0.75f, a.data(), y.data(), n);
+            r.push_back(y);
+            vector<float> out(rows);
+            gemv(W.data(), a.data(), bias.data(), out.data(), rows, n);
+            r.push_back(out);
+            auto gx = b;
+            gemv_t_acc(W.data(), bias.data(), gx.data(), rows, n);
+            r.push_back(gx);
+            auto dW = W;
+            ger_acc(bias.data(), a.data(), dW.data(), rows, n);
+            r.push_back(dW);
+            vector<float> Y(batch * rows);
+            gemm_nt(X.data(), W.data(), bias.data(), Y.data(), batch, rows, n);
+            r.push_back(Y);
+            dW = W;
+            gemm_tn_acc(G.data(), X.data(), dW.data(), batch, rows, n);
+            r.push_back(dW);
+            auto dX = X;
+            gemm_nn_acc(G.data(), W.data(), dX.data(), batch, rows, n);
+            r.push_back(dX);
+            auto t = z, u = z, gz = z;
+            tanh_forward(t.data(), n);
+            relu_forward(u.data(), n);
+            r.push_back(t);
+            r.push_back(u);
+            tanh_backward(t.data(), b.data(), gz.data(), n);
+            r.push_back(gz);
+            relu_backward(u.data(), b.data(), gz.data(), n);
+            r.push_back(gz);
+            auto w = a, g = b, v = z;
+            sgd_update(w.data(), g.data(), v.data(), n, 0.1f, 0.9f, 0.01f);
+            r.push_back(w);
+            r.push_back(v);
+            r.push_back(g);
+            auto m = z;
+            w = a, g = b, v = b;
+            for (auto &x : v)
+                x = x * x;
+            adam_update(w.data(), g.data(), m.data(), v.data(), n, {0.01f, 0.9f, 0.999f, 1e-8f, 10, 1000, 0.01f, 0.02f});
+            r.push_back(w);
+            r.push_back(m);
+            r.push_back(v);
+            r.push_back(g);
+            return r;
+        };
+
+        assert(setKernelIsa(isa::scalar));
+        auto expected = run();
+        assert(setKernelIsa(target));
+        auto actual = run();
+        for (int k = 0; k < expected.size(); k++)
+        {
+            assert(all_close(actual[k], expected[k], 1e-5));
+        }
+    }
+    cout << "Kernels match scalar reference (isa " << int(target) << ") test passed." << endl;
+}
+
+// Conversions to and from 16-bit floats, and the product with 16-bit
+// weights, on one instruction set
+void test_half_kernels(isa target)
+{
+    assert(setKernelIsa(target));
+    // Exact values, rounding to nearest even, range limits: 17 values, so a
+    // vector block plus a tail
+    vector<float> x = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65519.0f, 65520.0f, 1e6f, 5.9604645e-8f, 1e-9f, 1.00048828125f, 1.00146484375f, 3.0f, 1.0f / 3, INFINITY, -INFINITY, NAN};
+    vector<uint16_t> h(x.size());
+    vector<float> back(x.size());
+
+    to_half(precision::fp16, x.data(), h.data(), x.size());
+    assert(h[0] == 0x0000 && h[1] == 0x8000 && h[2] == 0x3C00 && h[3] == 0xC100);
+    assert(h[4] == 0x7BFF && h[5] == 0x7BFF && h[6] == 0x7C00 && h[7] == 0x7C00);
+    assert(h[8] == 0x0001 && h[9] == 0x0000);
+    // 1 + 2^-11 is halfway, ties to even (1.0); 1 + 3 * 2^-11 rounds up
+    assert(h[10] == 0x3C00 && h[11] == 0x3C02);
+    assert(h[14] == 0x7C00 && h[15] == 0xFC00 && (h[16] & 0x7C00) == 0x7C00 && (h[16] & 0x3FF));
+    from_half(precision::fp16, h.data(), back.data(), x.size());
+    assert(back[2] == 1.0f && back[3] == -2.5f && back[4] == 65504.0f && back[8] == 5.9604645e-8f && back[12] == 3.0f);
+    assert(is_close(back[13], 1.0 / 3, 1e-3) && std::isinf(back[6]) && std::isnan(back[16]));
+
+    to_half(precision::bf16, x.data(), h.data(), x.size());
+    assert(h[2] == 0x3F80 && h[3] == 0xC020 && h[14] == 0x7F80 && (h[16] & 0x7F80) == 0x7F80 && (h[16] & 0x7F));
+    from_half(precision::bf16, h.data(), back.data(), x.size());
+    // bf16 keeps the range: no overflow at 1e6, no flush at 1e-9
+    assert(is_close(back[7], 1e6, 1e6 / 128) && back[9] > 0 && is_close(back[13], 1.0 / 3, 1e-2));
+    assert(back[12] == 3.0f && std::isnan(back[16]));
+
+    // Round trips of every 16-bit pattern that is not a NaN
+    vector<uint16_t> all(1 << 16), again(1 << 16);
+    vector<float> f(1 << 16);
+    for (int i = 0; i < (1 << 16); i++)
+        all[i] = i;
+    for (precision p : {precision::fp16, precision::bf16})
+    {
+        from_half(p, all.data(), f.data(), all.size());
+        to_half(p, f.data(), again.data(), f.size());
+        for (int i = 0; i < (1 << 16); i++)
+            assert(std::isnan(f[i]) || again[i] == all[i]);
+    }
+
+    // Products with 16-bit weights equal gemm_nt on the rounded weights
+    mt19937 rng(3);
+    for (int cols : {5, 16, 37, 100})
+    {
+        int rows = 6;
+        for (int n : {1, 3, 4, 9})
+        {
+            auto W = random_vector(rows * cols, rng);
+            auto X = random_vector(n * cols, rng);
+            auto b = random_vector(rows, rng);
+            for (precision p : {precision::fp16, precision::bf16})
+            {
+                vector<uint16_t> W16(W.size());
+                vector<float> rounded(W.size()), expected(n * rows), actual(n * rows);
+                to_half(p, W.data(), W16.data(), W.size());
+                from_half(p, W16.data(), rounded.data(), W.size());
+                gemm_nt(X.data(), rounded.data(), b.data(), expected.data(), n, rows, cols);
+                gemm_nt_half(p, X.data(), W16.data(), b.data(), actual.data(), n, rows, cols);
+                assert(all_close(actual, expected, 1e-5));
+            }
+        }
+    }
+    cout << "Half precision kernels (isa " << int(target) << ") test passed." << endl;
+}
+
+void test_int8_kernels(isa target)
+{
+    assert(setKernelIsa(target));
+    // Rounding to nearest even and saturation, over a vector block and a tail
+    vector<float> x(37);
+    for (int i = 0; i < x.size(); i++)
+    {
+        x[i] = (i - 18) * 0.5f;
+    }
+    x[0] = -1e9f;
+    x[36] = 1e9f;
+    vector<int8_t> q(x.size());
+    quantize_i8(x.data(), q.data(), 1, x.size());
+    assert(q[0] == -127 && q[36] == 127);
+    assert(q[17] == 0 && q[19] == 0 && q[20] == 1 && q[21] == 2 && q[23] == 2 && q[15] == -2);
+    // Beyond the int32 range inside the vector block, against the scalar
+    // reference
+    x[2] = 3e9f;
+    x[3] = -3e9f;
+    x[4] = INFINITY;
+    x[5] = -INFINITY;
+    x[6] = 1e30f;
+    quantize_i8(x.data(), q.data(), 1, x.size());
+    assert(q[2] == 127 && q[3] == -127 && q[4] == 127 && q[5] == -127 && q[6] == 127);
+    // And through a scale that overflows
+    vector<float> big(32, 1e30f);
+    quantize_i8(big.data(), q.data(), 1e20f, big.size());
+    for (int i = 0; i < 32; i++)
+    {
+        assert(q[i] == 127);
+    }
+
+    // Exact against the integer sum, including the extremes where the
+    // AVX2 pairwise sums come closest to saturating
+    mt19937 rng(11);
+    uniform_int_distribution<int> dist(-127, 127);
+    for (int n : {1, 31, 32, 64, 100, 257})
+    {
+        vector<int8_t> a(n), b(n);
+        for (int i = 0; i < n; i++)
+        {
+            a[i] = dist(rng);
+            b[i] = dist(rng);
+        }
+        int32_t expected = 0;
+        for (int i = 0; i < n; i++)
+        {
+            expected += a[i] * b[i];
+        }
+        assert(dot_i8(a.data(), b.data(), n) == expected);
+        fill(a.begin(), a.end(), -127);
+        fill(b.begin(), b.end(), -127);
+        assert(dot_i8(a.data(), b.data(), n) == 127 * 127 * n);
+        fill(b.begin(), b.end(), 127);
+        assert(dot_i8(a.data(), b.data(), n) == -127 * 127 * n);
+    }
+
+    // The batched product against single dot products, with a sample tail
+    for (int n : {1, 6})
+    {
+        int rows = 5, cols = 70;
+        vector<int8_t> X(n * cols), W(rows * cols);
+        for (auto &v : X)
+            v = dist(rng);
+        for (auto &v : W)
+            v = dist(rng);
+        vector<int32_t> Y(n * rows);
+        gemm_nt_i8(X.data(), W.data(), Y.data(), n, rows, cols);
+        for (int s = 0; s < n; s++)
+        {
+            for (int r = 0; r < rows; r++)
+            {
+                int32_t expected = 0;
+                for (int c = 0; c < cols; c++)
+                {
+                    expected += X[s * cols + c] * W[r * cols + c];
+                }
+                assert(Y[s * rows + r] == expected);
+            }
+        }
+    }
+    cout << "Int8 kernels (isa " << int(target) << ") test passed." << endl;
+}
+
+void test_kernel_isa_selection()
+{
+    isa initial = kernelIsa();
+    // The scalar fallback is always available
+    assert(setKernelIsa(isa::scalar));
+    assert(kernelIsa() == isa::scalar);
+    assert(setKernelIsa(initial));
+    cout << "Kernel instruction set selection test passed." << endl;
+}
+
+int main()
+{
+    isa initial = kernelIsa();
+    test_kernel_isa_selection();
+    for (isa target : {isa::scalar, isa::avx2, isa::avx512})
+    {
+        if (setKernelIsa(target))
+        {
+            test_kernels_match_scalar(target);
+            test_half_kernels(target);
+            test_int8_kernels(target);
+        }
+    }
+    setKernelIsa(initial);
+    cout << "All Kernels detailed tests passed!" << endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "../include/NN.hpp"
+#include "../include/ThreadPool.hpp"
 #include <iostream>
 #include <cassert>
 #include <sstream>
@@ -31,6 +32,45 @@ void test_neuron_forward_complex()
     cout << "Neuron forward pass (complex) test passed." << endl;
 }
 
+void test_neuron_backward_fused()
+{
+    // The fused neuron node must give the gradients of the equivalent scalar graph
+    for (activation act : {activation::none, activation::tanh, activation::relu})
+    {
+        vector<float> params = {float(int(act)), 0.4, -0.6, 0.8, 0.1};
+        Neuron n(params);
+        vector<shared_ptr<Value>> x1, x2, w;
+        for (float v : {1.0f, -0.2f, 0.5f})
+        {
+            x1.push_back(make_shared<Value>(v));
+            x2.push_back(make_shared<Value>(v));
+        }
+        for (int i = 1; i < params.size(); i++)
+        {
+            w.push_back(make_shared<Value>(params[i]));
+        }
+
+        auto out = n(x1);
+        out->backward();
+
+        auto z = x2[0] * w[0] + x2[1] * w[1] + x2[2] * w[2] + w[3];
+        auto ref = act == activation::tanh ? tanh(z) : act == activation::relu ? relu(z) : z;
+        ref->backward();
+
+        assert(is_close(out->getData(), ref->getData()));
+        auto p = n.parameters();
+        for (int i = 0; i < 3; i++)
+        {
+            assert(is_close(x1[i]->getGrad(), x2[i]->getGrad()));
+        }
+        for (int i = 0; i < p.size(); i++)
+        {
+            assert(is_close(p[i]->getGrad(), w[i]->getGrad()));
+        }
+    }
+    cout << "Neuron backward (fused) test passed." << endl;
+}
+
 void test_linear_layer_forward_complex()
 {
     // Setup test case with specific weights for LinearLayer
@@ -78,11 +118,672 @@ void test_mlp_forward_complex()
     cout << "MLP forward pass (complex) test passed." << endl;
 }
 
+void test_linear_layer_tensor_engine()
+{
+    // The same saved layer loaded into both engines must agree on outputs and gradients
+    string saved = "3 3 2 0.3 -0.5 0.7 0.2 1 0.1 0.4 -0.3 -0.1 0 0.6 -0.2 0.9 0.05";
+    istringstream s1(saved), s2(saved);
+    LinearLayer scalar(s1);
+    LinearLayer tensor(s2, engine::tensor);
+
+    vector<shared_ptr<Value>> x1, x2;
+    for (float v : {0.5f, 1.2f, -0.7f})
+    {
+        x1.push_back(make_shared<Value>(v));
+        x2.push_back(make_shared<Value>(v));
+    }
+    auto o1 = scalar(x1);
+    auto o2 = tensor(x2);
+    assert(o1.size() == o2.size());
+    for (int i = 0; i < o1.size(); i++)
+    {
+        assert(is_close(o1[i]->getData(), o2[i]->getData()));
+    }
+
+    // Weight the outputs differently so every row gets its own gradient
+    auto l1 = o1[0] + o1[1] * o1[1] + o1[2] * make_shared<Value>(-2.0);
+    auto l2 = o2[0] + o2[1] * o2[1] + o2[2] * make_shared<Value>(-2.0);
+    l1->backward();
+    l2->backward();
+    for (int i = 0; i < x1.size(); i++)
+    {
+        assert(is_close(x1[i]->getGrad(), x2[i]->getGrad(), 1e-5));
+    }
+    auto p1 = scalar.parameters();
+    auto p2 = tensor.parameters();
+    assert(p1.size() == p2.size());
+    for (int i = 0; i < p1.size(); i++)
+    {
+        assert(is_close(p1[i]->getData(), p2[i]->getData()));
+        assert(is_close(p1[i]->getGrad(), p2[i]->getGrad(), 1e-5));
+    }
+
+    // Parameter views write through to the weight buffer
+    tensor.zero_grad();
+    for (auto &p : p2)
+    {
+        assert(p->getGrad() == 0);
+    }
+    p2[0]->setData(1.0);
+    ostringstream out1, out2;
+    scalar.parameters()[0]->setData(1.0);
+    scalar.save(out1);
+    tensor.save(out2);
+    assert(out1.str() == out2.str());
+
+    cout << "Linear layer tensor engine test passed." << endl;
+}
+
+void test_mlp_batch()
+{
+    // A batched loss must give the same gradients as averaging per-sample losses
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP mlp(3, {4, 2}, mode);
+        vector<vector<float>> xs = {{0.3f, -0.5f, 0.8f}, {1.0f, 0.2f, -0.4f}, {-0.6f, 0.9f, 0.1f}};
+        vector<vector<float>> ys = {{0.5f, -0.5f}, {-1.0f, 0.25f}, {0.0f, 1.0f}};
+        vector<vector<shared_ptr<Value>>> x, y;
+        for (int s = 0; s < xs.size(); s++)
+        {
+            x.push_back({});
+            y.push_back({});
+            for (float v : xs[s])
+                x.back().push_back(make_shared<Value>(v));
+            for (float v : ys[s])
+                y.back().push_back(make_shared<Value>(v));
+        }
+
+        auto pred = mlp(x);
+        assert(pred.size() == 3 && pred[0].size() == 2);
+        for (int s = 0; s < x.size(); s++)
+        {
+            auto single = mlp(x[s]);
+            for (int j = 0; j < 2; j++)
+            {
+                assert(is_close(pred[s][j]->getData(), single[j]->getData(), 1e-5));
+            }
+        }
+
+        mlp.zero_grad();
+        simpleLoss(pred, y)->backward();
+        vector<float> batched;
+        for (auto &p : mlp.parameters())
+        {
+            batched.push_back(p->getGrad());
+        }
+
+        mlp.zero_grad();
+        for (int s = 0; s < x.size(); s++)
+        {
+            auto loss = simpleLoss(mlp(x[s]), y[s]) / make_shared<Value>(x.size());
+            loss->backward();
+        }
+        auto params = mlp.parameters();
+        for (int i = 0; i < params.size(); i++)
+        {
+            assert(is_close(params[i]->getGrad(), batched[i], 1e-5));
+        }
+    }
+    cout << "MLP batch forward/backward test passed." << endl;
+}
+
+void test_mlp_predict()
+{
+    // Graph-free inference must match the graph forward pass
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP mlp(3, {5, 4, 2}, mode);
+        vector<float> x = {0.3f, -0.5f, 0.8f, 1.0f, 0.2f, -0.4f};
+        vector<float> y(4);
+        mlp.predict(x.data(), y.data(), 2);
+
+        for (int s = 0; s < 2; s++)
+        {
+            vector<shared_ptr<Value>> inp;
+            for (int i = 0; i < 3; i++)
+            {
+                inp.push_back(make_shared<Value>(x[s * 3 + i]));
+            }
+            auto out = mlp(inp);
+            auto single = mlp.predict(vector<float>(x.begin() + s * 3, x.begin() + s * 3 + 3));
+            for (int j = 0; j < 2; j++)
+            {
+                assert(is_close(y[s * 2 + j], out[j]->getData(), 1e-5));
+                assert(is_close(single[j], out[j]->getData(), 1e-5));
+            }
+        }
+    }
+    cout << "MLP predict test passed." << endl;
+}
+
+void test_mlp_flat_storage()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP mlp(3, {5, 2}, mode);
+        // The same vector every time
+        auto &params = mlp.parameters();
+        assert(&params == &mlp.parameters());
+        assert(params.size() == 5 * 4 + 2 * 6);
+
+        // One block per layer, the second at a 64-byte aligned offset after
+        // the first, and each neuron's weights stored as a row
+        auto blocks = mlp.blocks();
+        assert(blocks.size() == 2);
+        assert(blocks[0].n == 20 && blocks[1].n == 12);
+        assert(blocks[1].data == blocks[0].data + 32);
+        assert(blocks[1].grad == blocks[0].grad + 32);
+        assert(params[0]->dataPtr() == blocks[0].data);
+        assert(params[3]->dataPtr() == blocks[0].data + 15);
+        assert(params[4]->dataPtr() == blocks[0].data + 3);
+        assert(params[20]->dataPtr() == blocks[1].data);
+
+        // Gradients reach the flat buffer, and zero_grad clears it
+        vector<shared_ptr<Value>> x = {make_shared<Value>(0.1), make_shared<Value>(-0.7), make_shared<Value>(0.4)};
+        auto y = mlp(x);
+        sum(y)->backward();
+        float total = 0;
+        for (long i = 0; i < blocks[0].n; i++)
+        {
+            total += fabs(blocks[0].grad[i]);
+        }
+        assert(total > 0);
+        assert(blocks[0].grad[15] == params[3]->getGrad());
+        mlp.zero_grad();
+        for (auto &p : params)
+        {
+            assert(p->getGrad() == 0);
+        }
+
+        // Copies share the buffer, clones do not
+        MLP copy = mlp;
+        MLP clone = mlp.clone();
+        blocks[1].data[0] += 1;
+        assert(copy.blocks()[1].data[0] == blocks[1].data[0]);
+        assert(clone.blocks()[1].data[0] != blocks[1].data[0]);
+    }
+    cout << "MLP flat storage test passed." << endl;
+}
+
+vector<vector<shared_ptr<Value>>> values(const vector<vector<float>> &v)
+{
+    vector<vector<shared_ptr<Value>>> r;
+    for (auto &row : v)
+    {
+        r.emplace_back();
+        for (float x : row)
+            r.back().push_back(make_shared<Value>(x));
+    }
+    return r;
+}
+
+void test_parameters_outlive_model()
+{
+    // Parameters and graphs keep the model's storage alive
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        vector<shared_ptr<Value>> ps;
+        vector<float> expected;
+        shared_ptr<Value> y;
+        auto x = values({{0.5, -1.0}})[0];
+        {
+            MLP m(2, {3, 1}, mode);
+            ps = m.parameters();
+            for (auto &p : ps)
+                expected.push_back(p->getData());
+            y = m(x)[0];
+        }
+        for (size_t i = 0; i < ps.size(); i++)
+        {
+            assert(ps[i]->getData() == expected[i]);
+        }
+        y->backward();
+        ps[0]->setData(1);
+        assert(ps[0]->getData() == 1 && std::isfinite(ps.back()->getGrad()));
+    }
+    cout << "Parameters outlive model test passed." << endl;
+}
+
+void test_fused_losses()
+{
+    vector<vector<float>> logits = {{1.0, -2.0, 0.5}, {0.2, 0.3, -0.1}};
+    vector<vector<float>> targets = {{0, 1, 0}, {0.2, 0.5, 0.3}};
+
+    // Softmax: one node, same values and gradients as the scalar graph
+    {
+        auto x1 = values(logits)[0], x2 = values(logits)[0];
+        auto s = softMax(x1);
+        vector<shared_ptr<Value>> e;
+        for (auto &v : x2)
+            e.push_back(exp(v));
+        auto total = sum(e);
+        vector<shared_ptr<Value>> ref;
+        for (auto &v : e)
+            ref.push_back(v / total);
+        auto w = values({{0.3, -1.0, 2.0}})[0];
+        auto y1 = s[0] * w[0] + s[1] * w[1] + s[2] * w[2];
+        auto y2 = ref[0] * w[0] + ref[1] * w[1] + ref[2] * w[2];
+        y1->backward();
+        y2->backward();
+        for (int i = 0; i < 3; i++)
+        {
+            assert(is_close(s[i]->getData(), ref[i]->getData()));
+            assert(is_close(x1[i]->getGrad(), x2[i]->getGrad(), 1e-5));
+        }
+    }
+
+    // Cross-entropy against -sum t log softmax(x), averaged over the batch
+    {
+        auto x1 = values(logits), x2 = values(logits);
+        auto t1 = values(targets), t2 = values(targets);
+        auto loss = crossEntropy(x1, t1);
+        vector<shared_ptr<Value>> terms;
+        for (int s = 0; s < 2; s++)
+        {
+            auto p = softMax(x2[s]);
+            for (int i = 0; i < 3; i++)
+                terms.push_back(t2[s][i] * log(p[i]));
+        }
+        auto ref = -sum(terms) / make_shared<Value>(2);
+        loss->backward();
+        ref->backward();
+        assert(is_close(loss->getData(), ref->getData(), 1e-5));
+        for (int s = 0; s < 2; s++)
+            for (int i = 0; i < 3; i++)
+            {
+                assert(is_close(x1[s][i]->getGrad(), x2[s][i]->getGrad(), 1e-5));
+                assert(is_close(t1[s][i]->getGrad(), t2[s][i]->getGrad(), 1e-5));
+            }
+        // One sample with a one-hot target: -log softmax(x)[1]
+        double lse = std::log(std::exp(1.0) + std::exp(-2.0) + std::exp(0.5));
+        assert(is_close(crossEntropy(x1[0], t1[0])->getData(), lse + 2.0, 1e-5));
+    }
+
+    // Stable for logits that would overflow exp
+    {
+        auto x = values({{1000, 0, -1000}});
+        auto t = values({{1, 0, 0}});
+        auto loss = crossEntropy(x, t);
+        loss->backward();
+        assert(std::isfinite(loss->getData()) && is_close(loss->getData(), 0, 1e-5));
+        assert(is_close(x[0][0]->getGrad(), 0, 1e-5) && is_close(x[0][2]->getGrad(), 0, 1e-5));
+        auto wrong = crossEntropy(x, values({{0, 0, 1}}));
+        assert(is_close(wrong->getData(), 2000, 1e-2));
+        auto s = softMax(x[0]);
+        assert(is_close(s[0]->getData(), 1) && is_close(s[2]->getData(), 0));
+    }
+
+    // MSE equals simpleLoss, gradients included
+    {
+        auto x1 = values(logits), x2 = values(logits);
+        auto t1 = values(targets), t2 = values(targets);
+        auto loss = mseLoss(x1, t1);
+        auto ref = simpleLoss(x2, t2);
+        loss->backward();
+        ref->backward();
+        assert(is_close(loss->getData(), ref->getData()));
+        for (int s = 0; s < 2; s++)
+            for (int i = 0; i < 3; i++)
+            {
+                assert(is_close(x1[s][i]->getGrad(), x2[s][i]->getGrad()));
+                assert(is_close(t1[s][i]->getGrad(), t2[s][i]->getGrad()));
+            }
+    }
+
+    // Samples of different sizes are rejected
+    bool threw = false;
+    try
+    {
+        crossEntropy(values({{1, 2}, {3}}), values({{1, 0}, {1}}));
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    // So is an empty batch, by every loss
+    using Batch = vector<vector<shared_ptr<Value>>>;
+    Batch none;
+    for (auto loss : vector<shared_ptr<Value> (*)(const Batch &, const Batch &)>{crossEntropy, mseLoss, simpleLoss})
+    {
+        threw = false;
+        try
+        {
+            loss(none, none);
+        }
+        catch (const runtime_error &)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+    cout << "Fused losses test passed." << endl;
+}
+
+void test_mlp_activation_checkpointing()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP full(3, {6, 6, 6, 6, 6, 2}, mode);
+        vector<vector<float>> xs = {{0.5, -1.0, 0.25}, {-0.3, 0.8, 1.5}, {1.0, 0.0, -0.7}};
+        vector<vector<float>> ys = {{1, 0}, {0, 1}, {0.5, 0.5}};
+
+        // Loss, parameter gradients, input gradients and arena bytes of one step
+        auto step = [&](MLP &model, vector<float> &grads, vector<float> &gx)
+        {
+            GraphArena arena;
+            size_t used;
+            float loss;
+            {
+                ArenaScope scope(arena);
+                auto x = values(xs);
+                auto out = crossEntropy(model(x), values(ys));
+                used = arena.used();
+                model.zero_grad();
+                out->backward();
+                loss = out->getData();
+                gx.clear();
+                for (auto &row : x)
+                    for (auto &v : row)
+                        gx.push_back(v->getGrad());
+            }
+            grads.clear();
+            for (auto &b : model.blocks())
+                grads.insert(grads.end(), b.grad, b.grad + b.n);
+            arena.reset();
+            return make_pair(loss, used);
+        };
+
+        vector<float> ref, refx;
+        auto base = step(full, ref, refx);
+        for (int k : {1, 2, 4, 6})
+        {
+            MLP model = full.clone();
+            model.setActivationCheckpointing(k);
+            vector<float> grads, gx;
+            auto r = step(model, grads, gx);
+            assert(is_close(r.first, base.first, 1e-5));
+            assert(grads.size() == ref.size());
+            for (int i = 0; i < ref.size(); i++)
+                assert(is_close(grads[i], ref[i], 1e-5));
+            for (int i = 0; i < refx.size(); i++)
+                assert(is_close(gx[i], refx[i], 1e-5));
+            // Only the segment boundaries are kept (a tensor layer already
+            // keeps nothing but its outputs)
+            assert(r.second <= base.second);
+            assert(k == 1 || r.second < base.second);
+            // A second backward through the same model gives the same gradients
+            auto again = step(model, grads, gx);
+            assert(is_close(again.first, r.first) && is_close(grads[0], ref[0], 1e-5));
+        }
+        // The single-sample forward goes through the segments too
+        MLP model = full.clone();
+        model.setActivationCheckpointing(3);
+        auto x1 = values(xs)[0];
+        auto y1 = model(x1);
+        auto y2 = full(values(xs)[0]);
+        assert(y1.size() == 2 && is_close(y1[1]->getData(), y2[1]->getData(), 1e-5));
+    }
+    cout << "MLP activation checkpointing test passed." << endl;
+}
+
+void test_mlp_reduced_precision()
+{
+    MLP full(32, {64, 64, 10}, engine::tensor);
+    mt19937 rng(5);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(6 * 32);
+    for (auto &v : x)
+        v = dist(rng);
+    vector<float> expected(6 * 10), actual(6 * 10);
+    full.predict(x.data(), expected.data(), 6);
+
+    for (precision p : {precision::bf16, precision::fp16})
+    {
+        MLP model = full.clone();
+        model.setPrecision(p);
+        model.predict(x.data(), actual.data(), 6);
+        // Worst case over random models, well above the typical error
+        double tol = p == precision::bf16 ? 0.15 : 0.02;
+        for (int i = 0; i < actual.size(); i++)
+            assert(is_close(actual[i], expected[i], tol));
+
+        // The graph forward uses the same weights
+        auto y = model(values({vector<float>(x.begin(), x.begin() + 32)}));
+        for (int i = 0; i < 10; i++)
+            assert(is_close(y[0][i]->getData(), actual[i], 1e-5));
+
+        // Training updates the float weights; the next forward converts them again
+        auto loss = simpleLoss(y, values({vector<float>(10, 0.5f)}));
+        loss->backward();
+        for (auto &b : model.blocks())
+            for (long i = 0; i < b.n; i++)
+                b.data[i] -= 0.1f * b.grad[i];
+        model.predict(x.data(), actual.data(), 6);
+        MLP fresh = model.clone();
+        assert(fresh.blocks()[0].data[0] == model.blocks()[0].data[0]);
+        vector<float> again(6 * 10);
+        fresh.predict(x.data(), again.data(), 6);
+        for (int i = 0; i < actual.size(); i++)
+            assert(actual[i] == again[i]);
+    }
+
+    bool threw = false;
+    try
+    {
+        MLP(2, {2}).setPrecision(precision::fp16);
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    cout << "MLP reduced precision test passed." << endl;
+}
+
+void test_intra_op_parallel()
+{
+    // Outputs and gradients with layers split across 4 threads match the
+    // serial ones, for batches split by rows and by samples
+    for (precision p : {precision::fp32, precision::bf16})
+    {
+        for (int batch : {1, 3, 20})
+        {
+            MLP serial(37, {53, 5}, engine::tensor);
+            serial.setPrecision(p);
+            MLP split = serial.clone();
+            vector<vector<float>> xs(batch, vector<float>(37)), ys(batch, vector<float>(5));
+            for (int s = 0; s < batch; s++)
+            {
+                for (int i = 0; i < 37; i++)
+                    xs[s][i] = sin(s * 37 + i);
+                for (int i = 0; i < 5; i++)
+                    ys[s][i] = cos(s * 5 + i);
+            }
+            auto x1 = values(xs), x2 = values(xs);
+            auto loss1 = mseLoss(serial(x1), values(ys));
+            loss1->backward();
+            setIntraOpThreads(4);
+            setIntraOpThreshold(0);
+            auto loss2 = mseLoss(split(x2), values(ys));
+            loss2->backward();
+            vector<float> flat, y1(batch * 5), y2(batch * 5);
+            for (auto &x : xs)
+                flat.insert(flat.end(), x.begin(), x.end());
+            split.predict(flat.data(), y2.data(), batch);
+            setIntraOpThreads(1);
+            setIntraOpThreshold(1 << 18);
+            serial.predict(flat.data(), y1.data(), batch);
+
+            assert(is_close(loss1->getData(), loss2->getData(), 1e-5));
+            for (int i = 0; i < batch * 5; i++)
+            {
+                assert(is_close(y1[i], y2[i], 1e-5));
+            }
+            for (int s = 0; s < batch; s++)
+            {
+                for (int i = 0; i < 37; i++)
+                {
+                    assert(is_close(x1[s][i]->getGrad(), x2[s][i]->getGrad(), 1e-5));
+                }
+            }
+            auto &p1 = serial.parameters();
+            auto &p2 = split.parameters();
+            for (int i = 0; i < p1.size(); i++)
+            {
+                assert(is_close(p1[i]->getGrad(), p2[i]->getGrad(), 1e-4));
+            }
+        }
+    }
+    // The scalar engine's predict splits the neurons
+    MLP scalar(20, {30, 4});
+    vector<float> x(2 * 20, 0.3f), y1(2 * 4), y2(2 * 4);
+    scalar.predict(x.data(), y1.data(), 2);
+    setIntraOpThreads(4);
+    setIntraOpThreshold(0);
+    scalar.predict(x.data(), y2.data(), 2);
+    setIntraOpThreads(1);
+    setIntraOpThreshold(1 << 18);
+    assert(y1 == y2);
+    cout << "Intra-op parallel layers test passed." << endl;
+}
+
+void test_checkpointing_intra_op()
+{
+    // A recomputed segment backpropagates its own graph from inside a level
+    // of the outer backward, which must carry on over its own levels
+    MLP serial(64, {64, 64, 64, 8}, engine::tensor);
+    vector<vector<float>> xs(16, vector<float>(64)), ys(16, vector<float>(8));
+    for (int s = 0; s < 16; s++)
+    {
+        for (int i = 0; i < 64; i++)
+            xs[s][i] = sin(s * 64 + i);
+        for (int i = 0; i < 8; i++)
+            ys[s][i] = cos(s * 8 + i);
+    }
+    auto grads = [&](MLP &model)
+    {
+        model.zero_grad();
+        mseLoss(model(values(xs)), values(ys))->backward();
+        vector<float> g;
+        for (auto &b : model.blocks())
+            g.insert(g.end(), b.grad, b.grad + b.n);
+        return g;
+    };
+    auto ref = grads(serial);
+    for (int k : {0, 1, 2})
+    {
+        MLP model = serial.clone();
+        if (k)
+            model.setActivationCheckpointing(k);
+        setIntraOpThreads(4);
+        setIntraOpThreshold(1);
+        auto g = grads(model);
+        setIntraOpThreads(1);
+        setIntraOpThreshold(1 << 18);
+        assert(g.size() == ref.size());
+        for (size_t i = 0; i < ref.size(); i++)
+            assert(is_close(g[i], ref[i], 1e-4));
+    }
+    cout << "Checkpointing with intra-op threads test passed." << endl;
+}
+
+void test_mlp_derivatives()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        for (int variant = 0; variant < 3; variant++)
+        {
+            MLP model(3, {8, 8, 4}, mode);
+            if (variant == 1)
+                model.setActivationCheckpointing(2);
+            if (variant == 2 && mode == engine::tensor)
+                model.setPrecision(precision::bf16);
+            auto x = values({{0.5, -1.0, 0.25}})[0];
+            auto y = model(x);
+            // A fused loss as one more output
+            y.push_back(mseLoss(y, values({{1, 0, 0, 1}})[0]));
+            model.zero_grad();
+
+            // Forward mode (3 inputs < 5 outputs) against one VJP per
+            // output, neither of which touches the weight gradients
+            Derivatives d(x, y);
+            auto J = d.jacobian();
+            vector<float> eye(25, 0), rows(15);
+            for (int j = 0; j < 5; j++)
+                eye[j * 5 + j] = 1;
+            d.vjp(eye.data(), 5, rows.data());
+            for (auto &b : model.blocks())
+                for (long i = 0; i < b.n; i++)
+                    assert(b.grad[i] == 0);
+            // bf16 backward rounds the gradients through the storage format
+            bool half = variant == 2 && mode == engine::tensor;
+            for (int i = 0; i < 15; i++)
+                assert(is_close(J[i], rows[i], half ? 1e-2 : 1e-4));
+            // Against central differences of predict
+            vector<float> x0 = {0.5, -1.0, 0.25};
+            for (int i = 0; i < 3; i++)
+            {
+                auto up = x0, down = x0;
+                up[i] += 1e-2;
+                down[i] -= 1e-2;
+                auto yu = model.predict(up), yd = model.predict(down);
+                for (int j = 0; j < 4; j++)
+                    assert(is_close(J[j * 3 + i], (yu[j] - yd[j]) / 2e-2, 2e-2));
+            }
+        }
+    }
+    // A Jacobian in reverse mode (4 inputs > 2 outputs) leaves them too
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(4, {3, 2}, mode);
+        model.zero_grad();
+        auto x = values({{0.5, -1.0, 0.25, 2.0}})[0];
+        Derivatives(x, model(x)).jacobian();
+        for (auto &b : model.blocks())
+            for (long i = 0; i < b.n; i++)
+                assert(b.grad[i] == 0);
+    }
+    cout << "MLP derivatives test passed." << endl;
+}
+
+void test_mlp_no_grad()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(3, {8, 2}, mode);
+        auto x = values({{0.5, -1.0, 0.25}})[0];
+        auto graph = model(x);
+        NoGradScope off;
+        auto y = model(x);
+        auto loss = crossEntropy(y, values({{1, 0}})[0]);
+        assert(loss->get_prev()->empty());
+        for (int i = 0; i < 2; i++)
+        {
+            assert(y[i]->get_prev()->empty() && is_close(y[i]->getData(), graph[i]->getData(), 1e-6));
+        }
+    }
+    cout << "MLP no-grad test passed." << endl;
+}
+
 int main()
 {
     test_neuron_forward_complex();
+    test_neuron_backward_fused();
     test_linear_layer_forward_complex();
     test_mlp_forward_complex();
+    test_linear_layer_tensor_engine();
+    test_mlp_batch();
+    test_mlp_predict();
+    test_mlp_flat_storage();
+    test_parameters_outlive_model();
+    test_fused_losses();
+    test_mlp_activation_checkpointing();
+    test_mlp_reduced_precision();
+    test_intra_op_parallel();
+    test_checkpointing_intra_op();
+    test_mlp_derivatives();
+    test_mlp_no_grad();
     cout << "All NN detailed tests passed!" << endl;
     return 0;
 }
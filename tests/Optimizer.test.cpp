@@ -0,0 +1,193 @@
+#include "../include/Optimizer.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+// Helper function to compare floating point numbers
+bool is_close(double a, double b, double tol = 1e-5)
+{
+    return std::fabs(a - b) < tol * (1 + std::fabs(b));
+}
+
+// Gives every parameter a fresh random gradient
+void random_gradients(vector<shared_ptr<Value>> &params, mt19937 &rng)
+{
+    uniform_real_distribution<float> dist(-1, 1);
+    for (auto &p : params)
+    {
+        p->setGrad(dist(rng));
+    }
+}
+
+void test_sgd_momentum()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(4, {6, 3}, mode);
+        auto params = model.parameters();
+        SGD sgd(model, 0.1f, 0.9f, 0.01f);
+        assert(sgd.size() == params.size());
+
+        vector<float> w, velocity(params.size(), 0);
+        for (auto &p : params)
+            w.push_back(p->getData());
+        mt19937 rng(1);
+        for (int step = 0; step < 4; step++)
+        {
+            random_gradients(params, rng);
+            for (int i = 0; i < params.size(); i++)
+            {
+                velocity[i] = 0.9f * velocity[i] + params[i]->getGrad() + 0.01f * w[i];
+                w[i] -= 0.1f * velocity[i];
+            }
+            sgd.step();
+            for (int i = 0; i < params.size(); i++)
+            {
+                assert(is_close(params[i]->getData(), w[i]));
+                assert(params[i]->getGrad() == 0);
+            }
+        }
+    }
+    cout << "SGD momentum test passed." << endl;
+}
+
+void test_adam(bool decoupled)
+{
+    const float lr = 0.01f, b1 = 0.9f, b2 = 0.999f, eps = 1e-8f, wd = 0.05f;
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(4, {6, 3}, mode);
+        auto params = model.parameters();
+        unique_ptr<Optimizer> opt;
+        if (decoupled)
+            opt = make_unique<AdamW>(model, lr, b1, b2, eps, wd);
+        else
+            opt = make_unique<Adam>(model, lr, b1, b2, eps, wd);
+
+        vector<double> w, m(params.size(), 0), v(params.size(), 0);
+        for (auto &p : params)
+            w.push_back(p->getData());
+        mt19937 rng(2);
+        for (int t = 1; t <= 5; t++)
+        {
+            random_gradients(params, rng);
+            for (int i = 0; i < params.size(); i++)
+            {
+                double g = params[i]->getGrad() + (decoupled ? 0 : wd * w[i]);
+                m[i] = b1 * m[i] + (1 - b1) * g;
+                v[i] = b2 * v[i] + (1 - b2) * g * g;
+                double mhat = m[i] / (1 - std::pow(b1, t));
+                double vhat = v[i] / (1 - std::pow(b2, t));
+                w[i] -= lr * (mhat / (std::sqrt(vhat) + eps) + (decoupled ? wd * w[i] : 0));
+            }
+            opt->step();
+            for (int i = 0; i < params.size(); i++)
+            {
+                assert(is_close(params[i]->getData(), w[i], 1e-4));
+                assert(params[i]->getGrad() == 0);
+            }
+        }
+    }
+    cout << (decoupled ? "AdamW" : "Adam") << " test passed." << endl;
+}
+
+void test_optimizer_trains()
+{
+    // y = x1 - 2 x2 on a few points, with the graph rebuilt every step
+    MLP model(2, {8, 1}, engine::tensor);
+    Adam adam(model, 0.01f);
+    mt19937 rng(3);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<vector<shared_ptr<Value>>> xs, ys;
+    for (int s = 0; s < 16; s++)
+    {
+        float a = dist(rng), b = dist(rng);
+        xs.push_back({make_shared<Value>(a), make_shared<Value>(b)});
+        ys.push_back({make_shared<Value>(0.3f * (a - 2 * b))});
+    }
+    float first = 0, last = 0;
+    for (int step = 0; step < 300; step++)
+    {
+        auto loss = simpleLoss(model(xs), ys);
+        loss->backward();
+        adam.step();
+        if (step == 0)
+            first = loss->getData();
+        last = loss->getData();
+    }
+    assert(last < first * 0.1f);
+    cout << "Optimizer trains test passed." << endl;
+}
+
+void test_loss_scaler()
+{
+    // A loss so small that its gradients vanish in fp16 unless scaled
+    mt19937 rng(4);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<vector<shared_ptr<Value>>> xs, ys;
+    for (int s = 0; s < 8; s++)
+    {
+        xs.push_back({make_shared<Value>(dist(rng)), make_shared<Value>(dist(rng))});
+        ys.push_back({make_shared<Value>(dist(rng))});
+    }
+    auto tiny = make_shared<Value>(1e-8f);
+    auto gradients = [&](MLP &model)
+    {
+        vector<float> g;
+        for (auto &b : model.blocks())
+            g.insert(g.end(), b.grad, b.grad + b.n);
+        return g;
+    };
+
+    MLP reference(2, {4, 1}, engine::tensor);
+    MLP fp16 = reference.clone();
+    fp16.setPrecision(precision::fp16);
+    (simpleLoss(reference(xs), ys) * tiny)->backward();
+    auto expected = gradients(reference);
+
+    (simpleLoss(fp16(xs), ys) * tiny)->backward();
+    for (float g : gradients(fp16))
+        assert(g == 0);
+    fp16.zero_grad();
+
+    // Scaled, the gradients survive and are divided back before the update
+    SGD sgd(fp16, 0);
+    LossScaler scaler(sgd, 65536, 2);
+    scaler.scale(simpleLoss(fp16(xs), ys) * tiny)->backward();
+    assert(sgd.scale_grad(1 / scaler.getScale()));
+    auto actual = gradients(fp16);
+    float largest = 0;
+    for (float g : expected)
+        largest = max(largest, std::fabs(g));
+    assert(largest > 0);
+    for (int i = 0; i < expected.size(); i++)
+        assert(std::fabs(actual[i] - expected[i]) < 1e-2 * largest);
+    assert(sgd.scale_grad(scaler.getScale()));
+
+    // Two clean steps double the scale
+    assert(scaler.step());
+    assert(scaler.getScale() == 65536);
+    scaler.scale(simpleLoss(fp16(xs), ys) * tiny)->backward();
+    assert(scaler.step() && scaler.getScale() == 131072);
+
+    // An overflow skips the update, clears the gradients and halves the scale
+    auto before = fp16.blocks()[0].data[0];
+    scaler.scale(simpleLoss(fp16(xs), ys) * make_shared<Value>(1e30f))->backward();
+    assert(!scaler.step());
+    assert(scaler.getScale() == 65536 && fp16.blocks()[0].data[0] == before);
+    for (float g : gradients(fp16))
+        assert(g == 0);
+    cout << "Loss scaler test passed." << endl;
+}
+
+int main()
+{
+    test_sgd_momentum();
+    test_adam(false);
+    test_adam(true);
+    test_optimizer_trains();
+    test_loss_scaler();
+    cout << "All Optimizer detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "../include/Profiler.hpp"
+#include "../include/NN.hpp"
+#include <iostream>
+#include <cassert>
+#include <thread>
+
+void test_disabled()
+{
+    Profiler::reset();
+    auto a = make_shared<Value>(1.0);
+    auto b = make_shared<Value>(2.0);
+    auto y = tanh(a * b + a);
+    y->backward();
+    assert(Profiler::nodes().empty());
+    assert(Profiler::backwards().empty());
+    assert(Profiler::spans().empty());
+    cout << "Profiler disabled test passed." << endl;
+}
+
+void test_ops()
+{
+    Profiler::reset();
+    Profiler::enable();
+    auto a = make_shared<Value>(1.0);
+    auto b = make_shared<Value>(2.0);
+    auto y = tanh(a * b + a);
+    y->backward();
+    y->backward();
+    Profiler::enable(false);
+
+    auto nodes = Profiler::nodes();
+    assert(nodes.size() == 3);
+    assert(nodes["add"].count == 1 && nodes["mul"].count == 1 && nodes["tanh"].count == 1);
+    assert(nodes["add"].bytes >= (long)sizeof(Value) + 2 * (long)sizeof(shared_ptr<Value>));
+    // Leaves are not reported, the other nodes once per backward
+    auto backwards = Profiler::backwards();
+    assert(backwards.size() == 3 && backwards["mul"].count == 2);
+    // The order is sorted once, then reused
+    auto spans = Profiler::spans();
+    assert(spans["backward"].count == 2 && spans["build_topo"].count == 1);
+    assert(spans["backward"].ms >= spans["build_topo"].ms);
+    cout << "Profiler ops test passed." << endl;
+}
+
+void test_layers()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(3, {4, 2}, mode);
+        vector<vector<shared_ptr<Value>>> x(5), y(5);
+        for (int s = 0; s < 5; s++)
+        {
+            for (int i = 0; i < 3; i++)
+                x[s].push_back(make_shared<Value>(0.1 * (s + i)));
+            for (int i = 0; i < 2; i++)
+                y[s].push_back(make_shared<Value>(0.5));
+        }
+        Profiler::reset();
+        Profiler::enable();
+        simpleLoss(model(x), y)->backward();
+        Profiler::enable(false);
+
+        auto nodes = Profiler::nodes();
+        auto spans = Profiler::spans();
+        assert(spans["layer 0 forward"].count == 1 && spans["layer 1 forward"].count == 1);
+        if (mode == engine::tensor)
+        {
+            assert(nodes["fused:linear"].count == 2);
+            assert(spans["layer 0 backward"].count == 1 && spans["layer 1 backward"].count == 1);
+        }
+        else
+        {
+            assert(nodes["fused:neuron"].count == 5 * (4 + 2));
+            assert(Profiler::backwards()["fused:neuron"].count == 5 * (4 + 2));
+        }
+    }
+    cout << "Profiler layers test passed." << endl;
+}
+
+void test_threads_and_export()
+{
+    Profiler::reset();
+    Profiler::enable();
+    thread worker([]()
+                  {
+        auto a = make_shared<Value>(1.0);
+        (a * a)->backward(); });
+    worker.join();
+    {
+        auto a = make_shared<Value>(1.0);
+        (a * a)->backward();
+    }
+    Profiler::enable(false);
+    // Counters of a finished thread are kept and merged
+    assert(Profiler::nodes()["mul"].count == 2);
+
+    string json = Profiler::json();
+    assert(json.find("\"nodes\": {\"mul\": {\"count\": 2") != string::npos);
+    assert(json.find("\"spans\": {") != string::npos);
+    string trace = Profiler::trace();
+    assert(trace.find("\"traceEvents\"") != string::npos);
+    assert(trace.find("\"name\": \"backward\", \"ph\": \"X\"") != string::npos);
+    assert(trace.find("\"tid\": ") != string::npos);
+    assert(Profiler::report().find("mul") != string::npos);
+
+    Profiler::reset();
+    assert(Profiler::nodes().empty() && Profiler::trace().find("name") == string::npos);
+    cout << "Profiler threads and export test passed." << endl;
+}
+
+int main()
+{
+    test_disabled();
+    test_ops();
+    test_layers();
+    test_threads_and_export();
+    cout << "All Profiler detailed tests passed!" << endl;
+    return 0;
+}
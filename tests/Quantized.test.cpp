@@ -0,0 +1,117 @@
+#include "../include/Quantized.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+vector<float> samples(int n, int width, mt19937 &rng)
+{
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x((long)n * width);
+    for (auto &v : x)
+    {
+        v = dist(rng);
+    }
+    return x;
+}
+
+void test_quantized_matches_float()
+{
+    mt19937 rng(3);
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(16, {64, 64, 10}, mode);
+        auto calibration = samples(256, 16, rng);
+        auto x = samples(512, 16, rng);
+        QuantizedMLP quantized(model, calibration.data(), 256);
+        assert(quantized.inputs() == 16 && quantized.outputs() == 10);
+
+        auto r = compareQuantized(model, quantized, x.data(), 512);
+        assert(r.samples == 512);
+        // Outputs are in [-1, 1]; the mean error is about 0.008 for this
+        // (unscaled, random) initialization
+        assert(r.maxError < 0.3f && r.meanError < 0.015f);
+        assert(r.agreement >= 0.95f);
+        assert(r.str().find("agreement") != string::npos);
+
+        // Single samples give the same outputs as a batch
+        vector<float> batch(10 * 4);
+        quantized.predict(x.data(), batch.data(), 4);
+        for (int s = 0; s < 4; s++)
+        {
+            auto y = quantized.predict(vector<float>(x.begin() + s * 16, x.begin() + (s + 1) * 16));
+            for (int i = 0; i < 10; i++)
+            {
+                assert(y[i] == batch[s * 10 + i]);
+            }
+        }
+    }
+    cout << "Quantized matches float test passed." << endl;
+}
+
+void test_quantized_from_checkpoint()
+{
+    mt19937 rng(4);
+    MLP model(8, {32, 4}, engine::tensor);
+    auto calibration = samples(64, 8, rng);
+    auto x = samples(32, 8, rng);
+    const string path = "build/quantized-test.ckpt";
+    model.saveCheckpoint(path);
+    {
+        Checkpoint checkpoint(path);
+        QuantizedMLP fromModel(model, calibration.data(), 64);
+        QuantizedMLP fromFile(checkpoint, calibration.data(), 64);
+        vector<float> a(32 * 4), b(32 * 4);
+        fromModel.predict(x.data(), a.data(), 32);
+        fromFile.predict(x.data(), b.data(), 32);
+        assert(a == b);
+        // int8 weights plus a scale and a bias per row
+        assert(fromFile.bytes() == 8 * 32 + 32 * 4 + 2 * (32 + 4) * 4);
+    }
+    remove(path.c_str());
+    cout << "Quantized from checkpoint test passed." << endl;
+}
+
+void test_quantized_saturation_and_errors()
+{
+    mt19937 rng(5);
+    MLP model(4, {8, 2});
+    auto calibration = samples(16, 4, rng);
+    QuantizedMLP quantized(model, calibration.data(), 16);
+    // Outside the calibrated range (|x| < 1) the inputs saturate, however far
+    auto y = quantized.predict({1e6f, -1e6f, 1e6f, 0});
+    assert(isfinite(y[0]) && isfinite(y[1]));
+    assert(y == quantized.predict({1.5f, -1.5f, 1.5f, 0}));
+
+    bool threw = false;
+    try
+    {
+        quantized.predict({1, 2});
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try
+    {
+        QuantizedMLP none(model, calibration.data(), 0);
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    cout << "Quantized saturation and errors test passed." << endl;
+}
+
+int main()
+{
+    test_quantized_matches_float();
+    test_quantized_from_checkpoint();
+    test_quantized_saturation_and_errors();
+    cout << "All Quantized detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "../include/Server.hpp"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Batched products may sum in another order than a single sample's
+bool close(const vector<float> &a, const vector<float> &b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (fabs(a[i] - b[i]) > 1e-5f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<float> sample(int n, int seed)
+{
+    mt19937 rng(seed);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(n);
+    for (auto &v : x)
+    {
+        v = dist(rng);
+    }
+    return x;
+}
+
+void test_server_matches_predict()
+{
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(6, {16, 3}, mode);
+        InferenceServer server(model, 8, chrono::microseconds(2000), 2);
+        assert(server.inputs() == 6 && server.outputs() == 3);
+        // Many threads submitting at once, each result checked against predict
+        const int threads = 8, requests = 50;
+        vector<thread> clients;
+        for (int t = 0; t < threads; t++)
+        {
+            clients.emplace_back([&, t]()
+                                 {
+                for (int i = 0; i < requests; i++)
+                {
+                    auto x = sample(6, t * requests + i);
+                    auto f = server.submit(x);
+                    assert(close(f.get(), model.predict(x)));
+                } });
+        }
+        for (auto &c : clients)
+        {
+            c.join();
+        }
+        auto s = server.stats();
+        assert(s.requests == threads * requests);
+        assert(s.batches >= 1 && s.batches <= s.requests);
+    }
+    cout << "Server matches predict test passed." << endl;
+}
+
+void test_server_coalesces()
+{
+    MLP model(4, {8, 2}, engine::tensor);
+    // A full batch runs right away, long before the deadline
+    {
+        InferenceServer server(model, 16, chrono::seconds(30));
+        vector<future<vector<float>>> results;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < 16; i++)
+        {
+            results.push_back(server.submit(sample(4, i)));
+        }
+        for (auto &r : results)
+        {
+            assert(r.get().size() == 2);
+        }
+        assert(chrono::steady_clock::now() - start < chrono::seconds(10));
+        auto s = server.stats();
+        assert(s.batches == 1 && s.full == 1);
+    }
+    // A lone request waits for the deadline, then runs as a batch of one
+    {
+        auto delay = chrono::milliseconds(50);
+        InferenceServer server(model, 16, delay);
+        auto start = chrono::steady_clock::now();
+        server.submit(sample(4, 0)).get();
+        assert(chrono::steady_clock::now() - start >= delay);
+        auto s = server.stats();
+        assert(s.batches == 1 && s.full == 0);
+    }
+    cout << "Server coalesces test passed." << endl;
+}
+
+void test_server_shutdown_and_errors()
+{
+    MLP model(4, {8, 2});
+    auto x = sample(4, 1);
+    auto expected = model.predict(x);
+    future<vector<float>> pending;
+    {
+        InferenceServer server(model, 16, chrono::seconds(30));
+        pending = server.submit(x);
+        // The server's copy is unaffected by changes to the model
+        model.parameters()[0]->setData(100);
+    }
+    // Queued requests are run before the server stops
+    assert(pending.wait_for(chrono::seconds(0)) == future_status::ready);
+    assert(pending.get() == expected);
+
+    InferenceServer server(model, 4);
+    bool threw = false;
+    try
+    {
+        server.submit({1, 2});
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    cout << "Server shutdown and errors test passed." << endl;
+}
+
+int main()
+{
+    test_server_matches_predict();
+    test_server_coalesces();
+    test_server_shutdown_and_errors();
+    cout << "All Server detailed tests passed!" << endl;
+    return 0;
+}
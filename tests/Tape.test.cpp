@@ -0,0 +1,184 @@
+#include "../include/Tape.hpp"
+#include "../include/NN.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+// Helper function to compare floating point numbers
+bool is_close(double a, double b, double tol = 1e-5)
+{
+    return std::fabs(a - b) < tol;
+}
+
+// Uses every scalar operation
+shared_ptr<Value> expression(const shared_ptr<Value> &a, const shared_ptr<Value> &b, const shared_ptr<Value> &w)
+{
+    vector<shared_ptr<Value>> terms{a * w, b, exp(a) / (b ^ 2)};
+    return tanh(sum(terms)) + log(a * a) + relu(b - a) * w;
+}
+
+void test_tape_expression()
+{
+    auto a = make_shared<Value>(0);
+    auto b = make_shared<Value>(0);
+    auto w = make_shared<Value>(0.7);
+    Tape tape({a, b}, {expression(a, b, w)});
+    assert(tape.inputs() == 2 && tape.outputs() == 1);
+
+    for (auto in : vector<pair<float, float>>{{0.5, 1.5}, {-1.2, 0.8}, {2.0, -0.3}})
+    {
+        float x[2] = {in.first, in.second};
+        tape.forward(x);
+        w->setGrad(0);
+        tape.backward();
+        float tapeW = w->getGrad();
+
+        auto da = make_shared<Value>(in.first);
+        auto db = make_shared<Value>(in.second);
+        w->setGrad(0);
+        auto out = expression(da, db, w);
+        out->backward();
+
+        assert(is_close(tape.output(0), out->getData()));
+        assert(is_close(tape.inputGrad(0), da->getGrad()));
+        assert(is_close(tape.inputGrad(1), db->getGrad()));
+        assert(is_close(tapeW, w->getGrad()));
+    }
+
+    // No gradient through log(0), as in the graph
+    auto c = make_shared<Value>(1);
+    Tape logTape({c}, {log(c) + c});
+    float zero = 0;
+    logTape.forward(&zero);
+    logTape.backward();
+    assert(logTape.inputGrad(0) == 1);
+    cout << "Tape expression test passed." << endl;
+}
+
+void test_tape_mlp()
+{
+    // Replaying a training step must match building the graph again, for
+    // scalar neurons, a fused layer and a batch with one handle per output
+    mt19937 rng(5);
+    uniform_real_distribution<float> dist(-1, 1);
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        for (int n : {1, 3})
+        {
+            MLP model(3, {4, 2}, mode);
+            vector<vector<shared_ptr<Value>>> xs(n), ys(n);
+            vector<shared_ptr<Value>> inputs;
+            for (int s = 0; s < n; s++)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    xs[s].push_back(make_shared<Value>(0));
+                    inputs.push_back(xs[s].back());
+                }
+                for (int i = 0; i < 2; i++)
+                {
+                    ys[s].push_back(make_shared<Value>(0));
+                    inputs.push_back(ys[s].back());
+                }
+            }
+            Tape tape(inputs, {simpleLoss(model(xs), ys)});
+
+            auto params = model.parameters();
+            for (int step = 0; step < 3; step++)
+            {
+                vector<float> x(inputs.size());
+                for (auto &v : x)
+                    v = dist(rng);
+
+                model.zero_grad();
+                tape.forward(x.data());
+                tape.backward();
+                vector<float> grads;
+                for (auto &p : params)
+                    grads.push_back(p->getGrad());
+
+                vector<vector<shared_ptr<Value>>> dx(n), dy(n);
+                for (int s = 0; s < n; s++)
+                {
+                    for (int i = 0; i < 3; i++)
+                        dx[s].push_back(make_shared<Value>(x[s * 5 + i]));
+                    for (int i = 0; i < 2; i++)
+                        dy[s].push_back(make_shared<Value>(x[s * 5 + 3 + i]));
+                }
+                model.zero_grad();
+                auto loss = simpleLoss(model(dx), dy);
+                loss->backward();
+
+                assert(is_close(tape.output(0), loss->getData()));
+                for (size_t i = 0; i < params.size(); i++)
+                {
+                    assert(is_close(grads[i], params[i]->getGrad()));
+                }
+                assert(is_close(tape.inputGrad(0), dx[0][0]->getGrad()));
+
+                // The tape reads the parameters on every forward
+                for (auto &p : params)
+                    p->setData(p->getData() - 0.1f * p->getGrad());
+            }
+        }
+    }
+    cout << "Tape MLP test passed." << endl;
+}
+
+void test_tape_output_gradients()
+{
+    auto a = make_shared<Value>(0);
+    auto b = make_shared<Value>(0);
+    auto y1 = a * b;
+    auto y2 = a + b;
+    Tape tape({a, b}, {y1, y2});
+    float x[2] = {2, 3};
+    float gy[2] = {1, 10};
+    tape.forward(x);
+    tape.backward(gy);
+    assert(is_close(tape.output(0), 6) && is_close(tape.output(1), 5));
+    assert(is_close(tape.inputGrad(0), 3 + 10));
+    assert(is_close(tape.inputGrad(1), 2 + 10));
+    cout << "Tape output gradients test passed." << endl;
+}
+
+void test_tape_rejects()
+{
+    auto a = make_shared<Value>(1);
+    auto custom = Value::create(2, {a});
+    custom->setBackward([](Value *self) {});
+    bool thrown = false;
+    try
+    {
+        Tape tape({a}, {custom});
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    thrown = false;
+    try
+    {
+        Tape tape({a * a}, {a});
+    }
+    catch (runtime_error &e)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    cout << "Tape rejects test passed." << endl;
+}
+
+int main()
+{
+    test_tape_expression();
+    test_tape_mlp();
+    test_tape_output_gradients();
+    test_tape_rejects();
+    cout << "All Tape detailed tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../include/ThreadPool.hpp"
+#include <iostream>
+#include <cassert>
+
+void test_thread_pool_run()
+{
+    // Every task runs exactly once, across many consecutive runs
+    ThreadPool pool(4);
+    assert(pool.size() == 4);
+    for (int round = 0; round < 200; round++)
+    {
+        int tasks = 1 + round % 37;
+        vector<atomic<int>> hits(tasks);
+        pool.run(tasks, [&](int i)
+                 { hits[i]++; });
+        for (auto &h : hits)
+        {
+            assert(h == 1);
+        }
+    }
+    cout << "Thread pool run test passed." << endl;
+}
+
+void test_thread_pool_inline()
+{
+    // A pool of one runs the tasks on the calling thread
+    ThreadPool pool(1);
+    auto caller = this_thread::get_id();
+    int count = 0;
+    pool.run(10, [&](int i)
+             {
+        assert(this_thread::get_id() == caller);
+        count++; });
+    assert(count == 10);
+    cout << "Thread pool inline test passed." << endl;
+}
+
+void test_parallel_for()
+{
+    setIntraOpThreads(4);
+    setIntraOpThreshold(0);
+    assert(intraOpThreads() == 4);
+    for (int n : {1, 5, 64, 1000})
+    {
+        for (int grain : {1, 16})
+        {
+            // Chunks cover the range exactly once, on grain boundaries
+            vector<atomic<int>> hits(n);
+            parallelFor(n, grain, 1, [&](int begin, int end)
+                        {
+                assert(begin % grain == 0 && (end == n || end % grain == 0));
+                for (int i = begin; i < end; i++)
+                    hits[i]++; });
+            for (auto &h : hits)
+            {
+                assert(h == 1);
+            }
+        }
+    }
+    // Nested loops run inline, as one chunk
+    atomic<int> nested{0};
+    parallelFor(8, 1, 1, [&](int begin, int end)
+                { parallelFor(100, 1, 1, [&](int b, int e)
+                              { nested += b == 0 && e == 100; }); });
+    assert(nested == 8);
+    // So does a loop under the threshold
+    setIntraOpThreshold(1000);
+    int calls = 0;
+    parallelFor(100, 1, 999, [&](int begin, int end)
+                { calls += begin == 0 && end == 100; });
+    assert(calls == 1);
+    setIntraOpThreshold(1 << 18);
+    setIntraOpThreads(1);
+    assert(intraOpThreads() == 1);
+    cout << "Parallel for test passed." << endl;
+}
+
+int main()
+{
+    test_thread_pool_run();
+    test_thread_pool_inline();
+    test_parallel_for();
+    cout << "All ThreadPool detailed tests passed!" << endl;
+    return 0;
+}
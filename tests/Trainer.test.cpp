@@ -0,0 +1,128 @@
+#include "../include/Trainer.hpp"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+// Helper function to compare floating point numbers
+bool is_close(double a, double b, double tol = 1e-6)
+{
+    return std::fabs(a - b) < tol;
+}
+
+void test_trainer_matches_single_thread()
+{
+    // Sharded gradients must add up to the gradients of the whole batch
+    for (engine mode : {engine::scalar, engine::tensor})
+    {
+        MLP model(3, {6, 2}, mode);
+        const int n = 10;
+        mt19937 rng(3);
+        uniform_real_distribution<float> dist(-1, 1);
+        vector<float> x(n * 3), y(n * 2);
+        for (auto &v : x)
+            v = dist(rng);
+        for (auto &v : y)
+            v = dist(rng);
+
+        vector<vector<shared_ptr<Value>>> xs(n), ys(n);
+        for (int s = 0; s < n; s++)
+        {
+            for (int i = 0; i < 3; i++)
+                xs[s].push_back(make_shared<Value>(x[s * 3 + i]));
+            for (int i = 0; i < 2; i++)
+                ys[s].push_back(make_shared<Value>(y[s * 2 + i]));
+        }
+        model.zero_grad();
+        auto loss = simpleLoss(model(xs), ys);
+        loss->backward();
+        vector<float> expected;
+        for (auto &p : model.parameters())
+        {
+            expected.push_back(p->getGrad());
+        }
+
+        DataParallelTrainer trainer(model, 3);
+        assert(trainer.threads() == 3);
+        model.zero_grad();
+        float l = trainer.computeGradients(x.data(), y.data(), n);
+        assert(is_close(l, loss->getData(), 1e-5));
+        auto params = model.parameters();
+        for (int i = 0; i < params.size(); i++)
+        {
+            assert(is_close(params[i]->getGrad(), expected[i], 1e-5));
+        }
+    }
+    cout << "Trainer matches single thread test passed." << endl;
+}
+
+void test_trainer_step()
+{
+    // Training reduces the loss, and replicas follow the updated weights
+    MLP model(2, {8, 1}, engine::tensor);
+    const int n = 32;
+    mt19937 rng(5);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(n * 2), y(n);
+    for (int s = 0; s < n; s++)
+    {
+        x[2 * s] = dist(rng);
+        x[2 * s + 1] = dist(rng);
+        y[s] = 0.3f * x[2 * s] - 0.2f * x[2 * s + 1];
+    }
+    DataParallelTrainer trainer(model, 4);
+    float first = trainer.step(x.data(), y.data(), n, 0.05f);
+    float last = first;
+    for (int i = 0; i < 200; i++)
+    {
+        last = trainer.step(x.data(), y.data(), n, 0.05f);
+    }
+    assert(last < first);
+    cout << "Trainer step test passed." << endl;
+}
+
+void test_trainer_follows_model()
+{
+    // Precision and checkpointing set on the model after the trainer was
+    // built reach the replicas
+    MLP model(8, {32, 32, 2}, engine::tensor);
+    const int n = 12;
+    mt19937 rng(7);
+    uniform_real_distribution<float> dist(-1, 1);
+    vector<float> x(n * 8), y(n * 2);
+    for (auto &v : x)
+        v = dist(rng);
+    for (auto &v : y)
+        v = dist(rng);
+    vector<vector<float>> rows(n);
+    for (int s = 0; s < n; s++)
+        rows[s].assign(x.begin() + s * 8, x.begin() + (s + 1) * 8);
+    // simpleLoss of the predictions: the mean over samples and outputs
+    auto reference = [&]()
+    {
+        vector<float> out(n * 2);
+        model.predict(x.data(), out.data(), n);
+        float l = 0;
+        for (int i = 0; i < n * 2; i++)
+            l += (out[i] - y[i]) * (out[i] - y[i]);
+        return l / (n * 2);
+    };
+    DataParallelTrainer trainer(model, 3);
+    float full = reference();
+    assert(is_close(trainer.computeGradients(x.data(), y.data(), n), full, 1e-4));
+    model.setPrecision(precision::bf16);
+    model.setActivationCheckpointing(1);
+    float half = reference();
+    assert(!is_close(half, full, 1e-4));
+    assert(is_close(trainer.computeGradients(x.data(), y.data(), n), half, 1e-4));
+    cout << "Trainer follows model settings test passed." << endl;
+}
+
+int main()
+{
+    test_trainer_matches_single_thread();
+    test_trainer_step();
+    test_trainer_follows_model();
+    cout << "All Trainer detailed tests passed!" << endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "../include/ValueStruct.hpp"
+#include "../include/ThreadPool.hpp"
 #include <iostream>
 #include <cassert>
 #include <cmath>
@@ -82,12 +83,389 @@ void test_value_chain_rule()
     cout << "Value chain rule test passed." << endl;
 }
 
+void test_value_backward_deep_chain()
+{
+    // Deep enough to overflow the stack with a recursive sort
+    const int depth = 200000;
+    auto x = make_shared<Value>(1.0);
+    auto out = x;
+    for (int i = 0; i < depth; i++)
+    {
+        // Labels are off outside debug mode, so the chain does not build huge strings
+        out = out + make_shared<Value>(0.0);
+    }
+    out->backward();
+    assert(is_close(x->getGrad(), 1.0));
+
+    // Unlink the chain iteratively, its destructors would recurse as well
+    for (auto v = out; v;)
+    {
+        auto next = v->get_prev()->empty() ? nullptr : v->get_prev()->front();
+        v->get_prev()->clear();
+        v = next;
+    }
+    cout << "Value backward (deep chain) test passed." << endl;
+}
+
+void test_value_backward_repeated()
+{
+    // Shared subexpression must be visited once per sort
+    auto a = make_shared<Value>(2.0);
+    auto b = a * a;
+    auto c = b + b;
+
+    c->backward();
+    assert(is_close(a->getGrad(), 8.0));
+
+    // Second pass reuses the cached order and accumulates again
+    b->setGrad(0);
+    c->backward();
+    assert(is_close(a->getGrad(), 16.0));
+
+    cout << "Value backward (repeated) test passed." << endl;
+}
+
+void test_value_pow_accumulates()
+{
+    // x is used twice, both uses must contribute
+    auto x = make_shared<Value>(3.0);
+    auto out = (x ^ 2) + x;
+    out->backward();
+    assert(is_close(x->getGrad(), 2 * 3.0 + 1));
+    cout << "Value pow gradient test passed." << endl;
+}
+
+void test_value_custom_backward()
+{
+    auto a = make_shared<Value>(2.0);
+    auto b = Value::create(a->getData() * 10, {a});
+    b->setBackward([](Value *self)
+                   { auto a = self->get_prev()->front();
+                     a->setGrad(a->getGrad() + 10 * self->getGrad()); });
+    auto out = b * b;
+    out->backward();
+    assert(is_close(a->getGrad(), 2 * 20.0 * 10));
+    cout << "Value custom backward test passed." << endl;
+}
+
+void test_value_labels()
+{
+    auto a = make_shared<Value>(1.0);
+    auto b = make_shared<Value>(2.0);
+    a->setLabel("a");
+    b->setLabel("b");
+    assert((a + b)->getLabel() == "");
+
+    Value::setDebug(true);
+    assert((tanh(a * b) + b)->getLabel() == "tanH(a*b)+b");
+    Value::setDebug(false);
+    cout << "Value labels test passed." << endl;
+}
+
+void test_value_backward_seeded()
+{
+    // y1 = a * b, y2 = y1 + a: d(2 y1 + 3 y2)/da = 2b + 3(b + 1), /db = 2a + 3a
+    auto a = make_shared<Value>(2.0);
+    auto b = make_shared<Value>(-1.5);
+    auto y1 = a * b;
+    auto y2 = y1 + a;
+    float seeds[] = {2, 3};
+    backward({y1, y2}, seeds);
+    assert(std::fabs(a->getGrad() - (2 * -1.5 + 3 * (-1.5 + 1))) < 1e-6);
+    assert(std::fabs(b->getGrad() - 5 * 2.0) < 1e-6);
+    cout << "Value seeded backward test passed." << endl;
+}
+
+// Every op, children shared by many parents, a custom node, and levels of
+// very different widths. Returns the loss; the leaves are set in x.
+shared_ptr<Value> wide_graph(vector<shared_ptr<Value>> &x, int n)
+{
+    x.clear();
+    for (int i = 0; i < n; i++)
+    {
+        x.push_back(make_shared<Value>(std::sin(i + 1) * 0.9));
+    }
+    auto shared = x[0] * x[1];
+    auto scaled = Value::create(shared->getData() * 3, {shared});
+    scaled->setBackward([](Value *self)
+                        { auto c = self->get_prev()->front();
+                          c->setGrad(c->getGrad() + 3 * self->getGrad()); });
+    vector<shared_ptr<Value>> terms;
+    for (int i = 0; i < n; i++)
+    {
+        auto a = x[i];
+        auto b = x[(i * 7 + 3) % n];
+        auto t = tanh(a * b + shared) + exp(a) * relu(b) - log((a ^ 2) + make_shared<Value>(1.0));
+        terms.push_back(t / (scaled ^ 2) + make_shared<Value>(2.0));
+    }
+    return sum(terms);
+}
+
+void test_value_parallel_backward()
+{
+    const int n = 500;
+    vector<shared_ptr<Value>> x1, x2;
+    auto serial = wide_graph(x1, n);
+    auto parallel = wide_graph(x2, n);
+    // A second pass reuses the cached orders, and accumulates
+    for (int pass = 0; pass < 2; pass++)
+    {
+        serial->backward();
+        setIntraOpThreads(4);
+        setIntraOpThreshold(0);
+        parallel->backward();
+        setIntraOpThreads(1);
+        for (int i = 0; i < n; i++)
+        {
+            assert(std::fabs(x1[i]->getGrad() - x2[i]->getGrad()) < 1e-4 * (1 + std::fabs(x1[i]->getGrad())));
+        }
+    }
+    setIntraOpThreads(4);
+    // Several seeded roots, one of them below the other
+    auto a = make_shared<Value>(2.0);
+    auto b = make_shared<Value>(-1.5);
+    auto y1 = a * b;
+    auto y2 = y1 + a;
+    float seeds[] = {2, 3};
+    backward({y1, y2}, seeds);
+    assert(std::fabs(a->getGrad() - (2 * -1.5 + 3 * (-1.5 + 1))) < 1e-6);
+    assert(std::fabs(b->getGrad() - 5 * 2.0) < 1e-6);
+    setIntraOpThreads(1);
+    setIntraOpThreshold(1 << 18);
+    cout << "Value parallel backward test passed." << endl;
+}
+
+void test_value_derivatives()
+{
+    // Five outputs of four inputs, every built-in op
+    vector<shared_ptr<Value>> x;
+    for (int i = 0; i < 4; i++)
+    {
+        x.push_back(make_shared<Value>(std::sin(i + 1) * 0.9));
+    }
+    auto outputs = [&]()
+    {
+        auto shared = x[0] * x[1];
+        vector<shared_ptr<Value>> y;
+        for (int j = 0; j < 5; j++)
+        {
+            auto a = x[j % 4];
+            auto b = x[(j + 1) % 4];
+            y.push_back(tanh(a * b + shared) + exp(a) * relu(b) - log((a ^ 2) + make_shared<Value>(1.0)) / b);
+        }
+        return y;
+    };
+    // Rows of the Jacobian, one graph and backward per output
+    vector<float> ref;
+    for (int j = 0; j < 5; j++)
+    {
+        for (auto &v : x)
+            v->setGrad(0);
+        outputs()[j]->backward();
+        for (auto &v : x)
+            ref.push_back(v->getGrad());
+    }
+    auto y = outputs();
+    x[0]->setGrad(7);
+
+    // Fewer inputs than outputs: forward mode; the reverse mode by hand
+    Derivatives d(x, y);
+    assert(d.inputs() == 4 && d.outputs() == 5);
+    auto J = d.jacobian();
+    vector<float> eye(25, 0), rows(20);
+    for (int j = 0; j < 5; j++)
+        eye[j * 5 + j] = 1;
+    d.vjp(eye.data(), 5, rows.data());
+    for (int i = 0; i < 20; i++)
+    {
+        assert(is_close(J[i], ref[i], 1e-5));
+        assert(is_close(rows[i], ref[i], 1e-5));
+    }
+    // Node gradients are left alone
+    assert(x[0]->getGrad() == 7);
+
+    // A batch of two tangents, and an input no output depends on
+    auto unused = make_shared<Value>(3.0);
+    Derivatives partial({x[2], unused, x[0]}, y);
+    float dx[] = {1, 5, 0, 0.5, 0, -2};
+    vector<float> dy(10), gx(6);
+    partial.jvp(dx, 2, dy.data());
+    for (int j = 0; j < 5; j++)
+    {
+        assert(is_close(dy[j], ref[j * 4 + 2], 1e-5));
+        assert(is_close(dy[5 + j], 0.5 * ref[j * 4 + 2] - 2 * ref[j * 4], 1e-5));
+    }
+    float gy[] = {0, 1, 0, 0, 2};
+    partial.vjp(gy, 1, gx.data());
+    assert(is_close(gx[0], ref[4 + 2] + 2 * ref[16 + 2], 1e-5) && gx[1] == 0);
+
+    // More inputs than outputs goes in reverse, custom nodes included,
+    // which forward mode rejects
+    vector<shared_ptr<Value>> leaves;
+    auto loss = wide_graph(leaves, 40);
+    loss->backward();
+    Derivatives g(leaves, {loss});
+    auto grad = g.jacobian();
+    for (int i = 0; i < 40; i++)
+    {
+        assert(std::fabs(grad[i] - leaves[i]->getGrad()) < 1e-4 * (1 + std::fabs(grad[i])));
+    }
+    bool threw = false;
+    try
+    {
+        g.jvp(grad.data(), 1, grad.data());
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try
+    {
+        Derivatives({y[0]}, y);
+    }
+    catch (const runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    cout << "Value derivatives test passed." << endl;
+}
+
+void test_value_backward_release()
+{
+    for (int threads : {1, 4})
+    {
+        setIntraOpThreads(threads);
+        setIntraOpThreshold(0);
+        vector<shared_ptr<Value>> x1, x2;
+        auto kept = wide_graph(x1, 60);
+        auto freed = wide_graph(x2, 60);
+        kept->backward();
+
+        // A chain on top of the graph. By the time the node at its bottom
+        // runs, the nodes above it have been released.
+        weak_ptr<Value> top;
+        bool released = false;
+        auto bottom = Value::create(freed->getData(), {freed});
+        bottom->setBackward([&](Value *self)
+                            { released = top.expired();
+                              auto c = self->get_prev()->front();
+                              c->setGrad(c->getGrad() + self->getGrad()); });
+        auto chain = bottom;
+        for (int i = 0; i < 10; i++)
+        {
+            chain = chain * make_shared<Value>(1.0);
+            if (i == 5)
+            {
+                top = chain;
+            }
+        }
+        weak_ptr<Value> inner = freed;
+        freed.reset();
+        chain->backward(true);
+        assert(released && inner.expired());
+        // The root stays, as a leaf
+        assert(chain->get_prev()->empty());
+        for (int i = 0; i < 60; i++)
+        {
+            assert(std::fabs(x1[i]->getGrad() - x2[i]->getGrad()) < 1e-4 * (1 + std::fabs(x1[i]->getGrad())));
+        }
+    }
+    setIntraOpThreads(1);
+    setIntraOpThreshold(1 << 18);
+
+    // Several roots; a node still held elsewhere survives as a leaf
+    auto a = make_shared<Value>(2.0);
+    auto b = make_shared<Value>(-1.5);
+    auto y1 = a * b;
+    auto y2 = y1 + a;
+    float seeds[] = {2, 3};
+    backward({y1, y2}, seeds, true);
+    assert(std::fabs(a->getGrad() - (2 * -1.5 + 3 * (-1.5 + 1))) < 1e-6);
+    assert(y1->get_prev()->empty() && y1->getData() == -3);
+
+    // A release drops the orders cached on other roots of the graph, which
+    // would point to the nodes it freed
+    auto x = make_shared<Value>(0.5);
+    auto d = tanh(x * x);
+    weak_ptr<Value> square = d->get_prev()->front();
+    auto A = d + make_shared<Value>(1.0);
+    auto B = d * make_shared<Value>(2.0);
+    B->backward();
+    A->backward(true);
+    assert(square.expired() && d->get_prev()->empty());
+    // Lets the memory go too, so a stale order would read freed nodes
+    square.reset();
+    float gx = x->getGrad(), gd = d->getGrad();
+    B->backward();
+    assert(x->getGrad() == gx && d->getGrad() == gd + 2);
+    cout << "Value backward release test passed." << endl;
+}
+
+void test_value_detach_no_grad()
+{
+    auto a = make_shared<Value>(2.0);
+    auto b = make_shared<Value>(3.0);
+    auto y = a * b;
+    auto d = y->detach();
+    assert(d->getData() == 6 && d->get_prev()->empty());
+    // A running total of detached losses is a single leaf each time
+    auto total = make_shared<Value>(0.0);
+    for (int i = 0; i < 3; i++)
+    {
+        total = (total + (a * b)->detach())->detach();
+    }
+    assert(total->getData() == 18 && total->get_prev()->empty());
+    // Detached values outlive the arena of the step that computed them
+    GraphArena arena;
+    for (int i = 0; i < 3; i++)
+    {
+        {
+            ArenaScope scope(arena);
+            total = (total + (a * b)->detach())->detach();
+        }
+        arena.reset();
+    }
+    assert(total->getData() == 36);
+    (d * a)->backward();
+    assert(a->getGrad() == 6 && b->getGrad() == 0);
+
+    assert(gradEnabled());
+    {
+        NoGradScope off;
+        assert(!gradEnabled());
+        auto z = tanh(a * b + a) - b / a;
+        assert(z->get_prev()->empty());
+        assert(std::fabs(z->getData() - (std::tanh(8.0) - 1.5)) < 1e-6);
+        {
+            NoGradScope nested;
+        }
+        assert(!gradEnabled());
+        vector<shared_ptr<Value>> terms{a, b, exp(a), log(b), relu(a) ^ 2};
+        assert(sum(terms)->get_prev()->empty());
+    }
+    assert(gradEnabled() && (a * b)->get_prev()->size() == 2);
+    cout << "Value detach and no-grad test passed." << endl;
+}
+
 int main()
 {
     test_value_addition_complex();
     test_value_multiplication_complex();
     test_value_backward_complex();
     test_value_chain_rule();
+    test_value_backward_deep_chain();
+    test_value_backward_repeated();
+    test_value_pow_accumulates();
+    test_value_custom_backward();
+    test_value_labels();
+    test_value_backward_seeded();
+    test_value_parallel_backward();
+    test_value_derivatives();
+    test_value_backward_release();
+    test_value_detach_no_grad();
     cout << "All ValueStructure detailed tests passed!" << endl;
     return 0;
 }